@@ -119,6 +119,114 @@ struct blkio_cgroup *task_blkio_cgroup(struct task_struct *tsk)
 }
 EXPORT_SYMBOL_GPL(task_blkio_cgroup);
 
+#ifdef CONFIG_BLK_CGROUP
+static const char *blkio_class_names[BLKIO_NR_CLASSES] = {
+	"normal", "foreground", "background",
+};
+
+/*
+ * Class of a page cache write issued by a kernel thread, i.e. writeback
+ * by the flusher threads or kswapd: that of the task which last dirtied
+ * the file, see blkiocg_page_dirtied().  -1 for other bios.
+ */
+static int blkiocg_writeback_class(struct bio *bio)
+{
+	struct address_space *mapping;
+	struct page *page;
+
+	if (!(current->flags & PF_KTHREAD) || !(bio->bi_rw & WRITE) ||
+	    !bio->bi_vcnt)
+		return -1;
+
+	page = bio->bi_io_vec[0].bv_page;
+	if (PageAnon(page))
+		return -1;
+	mapping = page->mapping;
+	if (!mapping || !mapping->host || !S_ISREG(mapping->host->i_mode))
+		return -1;
+
+	return mapping->dirty_io_class;
+}
+
+/*
+ * Tag a bio with the class of the issuing task's cgroup, so that io
+ * schedulers and drivers can tell foreground from background I/O.  A bio
+ * passed on by a stacking driver keeps the tag it was first given.
+ */
+void blkiocg_tag_bio(struct bio *bio)
+{
+	struct blkio_cgroup *blkcg;
+	int class;
+
+	if (bio->bi_rw & (REQ_FG | REQ_BG))
+		return;
+
+	class = blkiocg_writeback_class(bio);
+	if (class < 0) {
+		rcu_read_lock();
+		blkcg = task_blkio_cgroup(current);
+		class = blkcg->io_class;
+		rcu_read_unlock();
+	}
+
+	if (class == BLKIO_CLASS_FOREGROUND)
+		bio->bi_rw |= REQ_FG;
+	else if (class == BLKIO_CLASS_BACKGROUND)
+		bio->bi_rw |= REQ_BG;
+}
+
+/*
+ * Called when a page of 'mapping' is dirtied, with interrupts disabled.
+ * Remembers the class of the dirtying task, so that writeback issued
+ * later by the flusher threads is tagged as if that task issued it.
+ * Kernel threads only redirty pages, or dirty them for someone else.
+ */
+void blkiocg_page_dirtied(struct address_space *mapping)
+{
+	if (in_interrupt() || (current->flags & PF_KTHREAD))
+		return;
+
+	rcu_read_lock();
+	mapping->dirty_io_class = task_blkio_cgroup(current)->io_class;
+	rcu_read_unlock();
+}
+
+/* Remember the issuing cgroup of a request, for its latency histogram */
+void blkiocg_init_request(struct request *rq)
+{
+	rcu_read_lock();
+	rq->blkcg_id = css_id(&task_blkio_cgroup(current)->css);
+	rcu_read_unlock();
+}
+
+/* Called on request completion, with the queue lock held */
+void blkiocg_update_latency(struct request *rq)
+{
+	struct cgroup_subsys_state *css;
+	struct blkio_cgroup *blkcg;
+	unsigned long long now = sched_clock();
+	unsigned long flags;
+	unsigned int ms;
+	int bucket;
+
+	if (!rq->blkcg_id || time_after64(rq_start_time_ns(rq), now))
+		return;
+
+	ms = div_u64(now - rq_start_time_ns(rq), NSEC_PER_MSEC);
+	bucket = min_t(int, fls(ms), BLKIO_LAT_BUCKETS - 1);
+
+	rcu_read_lock();
+	css = css_lookup(&blkio_subsys, rq->blkcg_id);
+	if (css) {
+		blkcg = container_of(css, struct blkio_cgroup, css);
+		spin_lock_irqsave(&blkcg->lock, flags);
+		blkcg->lat_hist[rq_data_dir(rq)][bucket]++;
+		spin_unlock_irqrestore(&blkcg->lock, flags);
+	}
+	rcu_read_unlock();
+}
+#endif
+
 static inline void
 blkio_update_group_weight(struct blkio_group *blkg, unsigned int weight)
 {
@@ -620,6 +728,7 @@ blkiocg_reset_stats(struct cgroup *cgroup, struct cftype *cftype, u64 val)
 		blkio_reset_stats_cpu(blkg);
 	}
 
+	memset(blkcg->lat_hist, 0, sizeof(blkcg->lat_hist));
 	spin_unlock_irq(&blkcg->lock);
 	return 0;
 }
@@ -1365,6 +1474,63 @@ blkiocg_file_write_u64(struct cgroup *cgrp, struct cftype *cft, u64 val)
 	return 0;
 }
 
+#ifdef CONFIG_BLK_CGROUP
+static int blkiocg_class_read(struct cgroup *cgrp, struct cftype *cft,
+			      struct seq_file *m)
+{
+	struct blkio_cgroup *blkcg = cgroup_to_blkio_cgroup(cgrp);
+	int i;
+
+	for (i = 0; i < BLKIO_NR_CLASSES; i++)
+		seq_printf(m, i == blkcg->io_class ? "%s[%s]" : "%s%s",
+			   i ? " " : "", blkio_class_names[i]);
+	seq_printf(m, "\n");
+	return 0;
+}
+
+static int blkiocg_class_write(struct cgroup *cgrp, struct cftype *cft,
+			       const char *buffer)
+{
+	struct blkio_cgroup *blkcg = cgroup_to_blkio_cgroup(cgrp);
+	int i;
+
+	for (i = 0; i < BLKIO_NR_CLASSES; i++) {
+		if (!strcmp(buffer, blkio_class_names[i])) {
+			blkcg->io_class = i;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static int blkiocg_latency_read(struct cgroup *cgrp, struct cftype *cft,
+				struct seq_file *m)
+{
+	struct blkio_cgroup *blkcg = cgroup_to_blkio_cgroup(cgrp);
+	uint64_t hist[2][BLKIO_LAT_BUCKETS];
+	char range[16];
+	int i;
+
+	spin_lock_irq(&blkcg->lock);
+	memcpy(hist, blkcg->lat_hist, sizeof(hist));
+	spin_unlock_irq(&blkcg->lock);
+
+	seq_printf(m, "%-10s %12s %12s\n", "ms", "Read", "Write");
+	for (i = 0; i < BLKIO_LAT_BUCKETS; i++) {
+		if (i == BLKIO_LAT_BUCKETS - 1)
+			snprintf(range, sizeof(range), "%u-", 1U << (i - 1));
+		else
+			snprintf(range, sizeof(range), "%u-%u",
+				 i ? 1U << (i - 1) : 0, 1U << i);
+		seq_printf(m, "%-10s %12llu %12llu\n", range,
+			   (unsigned long long)hist[READ][i],
+			   (unsigned long long)hist[WRITE][i]);
+	}
+	return 0;
+}
+#endif
+
 struct cftype blkio_files[] = {
 	{
 		.name = "weight_device",
@@ -1433,6 +1599,18 @@ struct cftype blkio_files[] = {
 		.name = "reset_stats",
 		.write_u64 = blkiocg_reset_stats,
 	},
+#ifdef CONFIG_BLK_CGROUP
+	{
+		.name = "class",
+		.read_seq_string = blkiocg_class_read,
+		.write_string = blkiocg_class_write,
+		.max_write_len = 16,
+	},
+	{
+		.name = "latency_histogram",
+		.read_seq_string = blkiocg_latency_read,
+	},
+#endif
 #ifdef CONFIG_BLK_DEV_THROTTLING
 	{
 		.name = "throttle.read_bps_device",
@@ -1576,7 +1754,7 @@ static void blkiocg_destroy(struct cgroup_subsys *subsys, struct cgroup *cgroup)
 	free_css_id(&blkio_subsys, &blkcg->css);
 	rcu_read_unlock();
 	if (blkcg != &blkio_root_cgroup)
-		kfree(blkcg);
+		kfree_rcu(blkcg, rcu_head);
 }
 
 static struct cgroup_subsys_state *
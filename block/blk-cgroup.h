@@ -111,12 +111,31 @@ enum blkcg_file_name_throtl {
 	BLKIO_THROTL_io_serviced,
 };
 
+/* Classes the I/O of a cgroup can be put in, see blkio.class */
+enum blkio_class {
+	BLKIO_CLASS_NORMAL = 0,
+	BLKIO_CLASS_FOREGROUND,		/* bios tagged REQ_FG */
+	BLKIO_CLASS_BACKGROUND,		/* bios tagged REQ_BG */
+	BLKIO_NR_CLASSES,
+};
+
+/*
+ * Request latency histogram: below 1ms, then powers of two up to 1024ms,
+ * the last bucket takes everything slower.
+ */
+#define BLKIO_LAT_BUCKETS	12
+
 struct blkio_cgroup {
 	struct cgroup_subsys_state css;
 	unsigned int weight;
+	unsigned int io_class;
 	spinlock_t lock;
 	struct hlist_head blkg_list;
 	struct list_head policy_list; /* list of blkio_policy_node */
+	/* completed requests by latency and direction, protected by lock */
+	uint64_t lat_hist[2][BLKIO_LAT_BUCKETS];
+	/* requests look the cgroup up by css id under rcu */
+	struct rcu_head rcu_head;
 };
 
 struct blkio_group_stats {
@@ -1202,6 +1202,7 @@ void init_request_from_bio(struct request *req, struct bio *bio)
 	req->__sector = bio->bi_sector;
 	req->ioprio = bio_prio(bio);
 	blk_rq_bio_prep(req->q, req, bio);
+	blkiocg_init_request(req);
 }
 
 static int __make_request(struct request_queue *q, struct bio *bio)
@@ -1524,6 +1525,8 @@ static inline void __generic_make_request(struct bio *bio)
 			goto end_io;
 		}
 
+		blkiocg_tag_bio(bio);
+
 		if (blk_throtl_bio(q, &bio))
 			goto end_io;
 
@@ -2209,6 +2212,7 @@ static void blk_finish_request(struct request *req, int error)
 
 
 	blk_account_io_done(req);
+	blkiocg_update_latency(req);
 
 	if (req->end_io)
 		req->end_io(req, error);
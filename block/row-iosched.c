@@ -0,0 +1,489 @@
+/*
+ *  ROW (Read Over Write) i/o scheduler.
+ *
+ *  Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 and
+ *  only version 2 as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/iocontext.h>
+#include <linux/ioprio.h>
+
+/*
+ * See Documentation/block/row-iosched.txt
+ *
+ * Flash has no seek cost, so requests are not sorted by sector.  Each
+ * class of I/O gets its own fifo instead, and the fifos are served in
+ * rounds: in every round a queue may dispatch up to its quantum of
+ * requests, and queues are always looked at in the order below, so a
+ * read that arrives in the middle of a round of writes goes out next.
+ * Idle class I/O is only dispatched when nothing else is queued.
+ *
+ * I/O tagged by the blkio cgroup of its issuer (see blkio.class) has
+ * queues of its own: foreground reads go ahead of everything, background
+ * I/O only gets a small share of each round.
+ *
+ * A request that waited past its queue's expire time is dispatched
+ * before anything else, so no queue can be starved.
+ */
+enum row_queue_idx {
+	ROW_FG_READ,
+	ROW_SYNC_READ,
+	ROW_SYNC_WRITE,
+	ROW_ASYNC_WRITE,
+	ROW_BG,
+	ROW_IDLE,
+	ROW_NR_QUEUES
+};
+
+static const char *row_queue_names[ROW_NR_QUEUES] = {
+	"fg_read", "sync_read", "sync_write", "async_write", "bg", "idle"
+};
+
+/* requests a queue may dispatch per round, the idle queue has none */
+static const int row_quantum[ROW_NR_QUEUES] = { 32, 16, 4, 2, 1, 0 };
+/* ms before a request is dispatched regardless of the rounds */
+static const int row_expire[ROW_NR_QUEUES] = {
+	50, 100, 500, 5000, 5000, 10000
+};
+
+struct row_queue_stats {
+	unsigned long dispatched;
+	unsigned long expired;		/* dispatched because they expired */
+	unsigned long wait_total;	/* jiffies */
+	unsigned long wait_max;		/* jiffies */
+};
+
+struct row_queue {
+	struct list_head fifo;
+	int disp_in_round;		/* dispatched in the current round */
+
+	/* tunables */
+	int quantum;
+	int fifo_expire;		/* jiffies */
+
+	struct row_queue_stats stats;
+};
+
+struct row_data {
+	struct row_queue queues[ROW_NR_QUEUES];
+	unsigned long rounds;
+};
+
+/*
+ * The queue a request is on and the time it was added are kept in
+ * elevator_private; rq_fifo_time() holds its deadline.
+ */
+#define rq_row_queue(rq)	((unsigned long) (rq)->elevator_private[0])
+#define rq_row_added(rq)	((unsigned long) (rq)->elevator_private[1])
+
+/* I/O without a priority of its own takes that of the submitting task */
+static bool row_ioprio_idle_class(unsigned short ioprio)
+{
+	struct io_context *ioc = current->io_context;
+
+	if (ioprio_valid(ioprio))
+		return IOPRIO_PRIO_CLASS(ioprio) == IOPRIO_CLASS_IDLE;
+
+	return ioc && task_ioprio_class(ioc) == IOPRIO_CLASS_IDLE;
+}
+
+static bool row_rq_idle_class(struct request *rq)
+{
+	return row_ioprio_idle_class(req_get_ioprio(rq));
+}
+
+static enum row_queue_idx row_rq_queue(struct request *rq)
+{
+	if (row_rq_idle_class(rq))
+		return ROW_IDLE;
+	if (rq->cmd_flags & REQ_BG)
+		return ROW_BG;
+	if (rq_is_urgent(rq))
+		return ROW_FG_READ;
+	if (rq_data_dir(rq) == READ)
+		return ROW_SYNC_READ;
+	if (rq_is_sync(rq))
+		return ROW_SYNC_WRITE;
+	return ROW_ASYNC_WRITE;
+}
+
+static void row_add_request(struct request_queue *q, struct request *rq)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+	enum row_queue_idx idx = row_rq_queue(rq);
+	struct row_queue *rqueue = &rd->queues[idx];
+
+	rq->elevator_private[0] = (void *) (unsigned long) idx;
+	rq->elevator_private[1] = (void *) jiffies;
+	rq_set_fifo_time(rq, jiffies + rqueue->fifo_expire);
+	list_add_tail(&rq->queuelist, &rqueue->fifo);
+}
+
+/*
+ * Keep sync I/O from being merged into async requests, and foreground,
+ * background or idle class I/O into requests of another class, or it
+ * would be served from the wrong queue.
+ */
+static int row_allow_merge(struct request_queue *q, struct request *rq,
+			   struct bio *bio)
+{
+	bool bio_sync = bio_data_dir(bio) == READ || (bio->bi_rw & REQ_SYNC);
+	bool rq_idle;
+
+	if ((rq->cmd_flags ^ bio->bi_rw) & (REQ_FG | REQ_BG))
+		return 0;
+
+	/*
+	 * Requests still on a plug list were not added to a queue yet, but
+	 * were submitted by the task submitting the bio.
+	 */
+	if (rq->cmd_flags & REQ_SORTED)
+		rq_idle = rq_row_queue(rq) == ROW_IDLE;
+	else
+		rq_idle = row_rq_idle_class(rq);
+	if (rq_idle != row_ioprio_idle_class(bio_prio(bio)))
+		return 0;
+
+	return !!rq_is_sync(rq) == bio_sync;
+}
+
+static void row_merged_requests(struct request_queue *q, struct request *rq,
+				struct request *next)
+{
+	/*
+	 * if next expires before rq, assign its expire time to rq
+	 * and move into next position (next will be deleted) in fifo
+	 */
+	if (!list_empty(&rq->queuelist) && !list_empty(&next->queuelist) &&
+	    rq_row_queue(rq) == rq_row_queue(next)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(rq))) {
+			list_move(&rq->queuelist, &next->queuelist);
+			rq_set_fifo_time(rq, rq_fifo_time(next));
+			rq->elevator_private[1] = next->elevator_private[1];
+		}
+	}
+
+	rq_fifo_clear(next);
+}
+
+static void row_dispatch_insert(struct row_data *rd, enum row_queue_idx idx)
+{
+	struct row_queue *rqueue = &rd->queues[idx];
+	struct request *rq = rq_entry_fifo(rqueue->fifo.next);
+	unsigned long wait = jiffies - rq_row_added(rq);
+
+	rq_fifo_clear(rq);
+	elv_dispatch_add_tail(rq->q, rq);
+
+	rqueue->disp_in_round++;
+	rqueue->stats.dispatched++;
+	rqueue->stats.wait_total += wait;
+	if (wait > rqueue->stats.wait_max)
+		rqueue->stats.wait_max = wait;
+}
+
+/*
+ * Returns the queue whose oldest request has been waiting longest past
+ * its deadline, or -1 if nothing has expired.
+ */
+static int row_expired_queue(struct row_data *rd)
+{
+	struct request *rq;
+	unsigned long oldest = 0;
+	int i, idx = -1;
+
+	for (i = 0; i < ROW_NR_QUEUES; i++) {
+		if (list_empty(&rd->queues[i].fifo))
+			continue;
+
+		rq = rq_entry_fifo(rd->queues[i].fifo.next);
+		if (!time_after(jiffies, rq_fifo_time(rq)))
+			continue;
+		if (idx < 0 || time_before(rq_fifo_time(rq), oldest)) {
+			oldest = rq_fifo_time(rq);
+			idx = i;
+		}
+	}
+
+	return idx;
+}
+
+/* Returns the queue to dispatch from in the current round, or -1 */
+static int row_round_queue(struct row_data *rd)
+{
+	struct row_queue *rqueue;
+	bool busy = false;
+	int i;
+
+	for (i = 0; i < ROW_IDLE; i++) {
+		rqueue = &rd->queues[i];
+		if (list_empty(&rqueue->fifo))
+			continue;
+
+		busy = true;
+		if (rqueue->disp_in_round < rqueue->quantum)
+			return i;
+	}
+
+	if (!busy)
+		return -1;
+
+	/* every busy queue used up its quantum, start the next round */
+	for (i = 0; i < ROW_IDLE; i++)
+		rd->queues[i].disp_in_round = 0;
+	rd->rounds++;
+
+	for (i = 0; i < ROW_IDLE; i++) {
+		rqueue = &rd->queues[i];
+		if (!list_empty(&rqueue->fifo) && rqueue->quantum > 0)
+			return i;
+	}
+
+	/* all busy queues have a quantum of 0, go by queue order */
+	for (i = 0; i < ROW_IDLE; i++)
+		if (!list_empty(&rd->queues[i].fifo))
+			return i;
+
+	return -1;
+}
+
+static int row_dispatch_requests(struct request_queue *q, int force)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+	int i, dispatched = 0;
+
+	if (unlikely(force)) {
+		for (i = 0; i < ROW_NR_QUEUES; i++) {
+			while (!list_empty(&rd->queues[i].fifo)) {
+				row_dispatch_insert(rd, i);
+				dispatched++;
+			}
+		}
+		return dispatched;
+	}
+
+	i = row_expired_queue(rd);
+	if (i >= 0) {
+		rd->queues[i].stats.expired++;
+		goto dispatch;
+	}
+
+	i = row_round_queue(rd);
+	if (i >= 0)
+		goto dispatch;
+
+	if (list_empty(&rd->queues[ROW_IDLE].fifo))
+		return 0;
+	i = ROW_IDLE;
+
+dispatch:
+	row_dispatch_insert(rd, i);
+	return 1;
+}
+
+static void row_exit_queue(struct elevator_queue *e)
+{
+	struct row_data *rd = e->elevator_data;
+	int i;
+
+	for (i = 0; i < ROW_NR_QUEUES; i++)
+		BUG_ON(!list_empty(&rd->queues[i].fifo));
+
+	kfree(rd);
+}
+
+/*
+ * initialize elevator private data (row_data).
+ */
+static void *row_init_queue(struct request_queue *q)
+{
+	struct row_data *rd;
+	int i;
+
+	rd = kmalloc_node(sizeof(*rd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!rd)
+		return NULL;
+
+	for (i = 0; i < ROW_NR_QUEUES; i++) {
+		INIT_LIST_HEAD(&rd->queues[i].fifo);
+		rd->queues[i].quantum = row_quantum[i];
+		rd->queues[i].fifo_expire = msecs_to_jiffies(row_expire[i]);
+	}
+
+	return rd;
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+row_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+row_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct row_data *rd = e->elevator_data;				\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return row_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(row_fg_read_quantum_show, rd->queues[ROW_FG_READ].quantum, 0);
+SHOW_FUNCTION(row_read_quantum_show, rd->queues[ROW_SYNC_READ].quantum, 0);
+SHOW_FUNCTION(row_sync_write_quantum_show,
+	      rd->queues[ROW_SYNC_WRITE].quantum, 0);
+SHOW_FUNCTION(row_async_write_quantum_show,
+	      rd->queues[ROW_ASYNC_WRITE].quantum, 0);
+SHOW_FUNCTION(row_bg_quantum_show, rd->queues[ROW_BG].quantum, 0);
+SHOW_FUNCTION(row_fg_read_expire_show, rd->queues[ROW_FG_READ].fifo_expire, 1);
+SHOW_FUNCTION(row_read_expire_show, rd->queues[ROW_SYNC_READ].fifo_expire, 1);
+SHOW_FUNCTION(row_sync_write_expire_show,
+	      rd->queues[ROW_SYNC_WRITE].fifo_expire, 1);
+SHOW_FUNCTION(row_async_write_expire_show,
+	      rd->queues[ROW_ASYNC_WRITE].fifo_expire, 1);
+SHOW_FUNCTION(row_bg_expire_show, rd->queues[ROW_BG].fifo_expire, 1);
+SHOW_FUNCTION(row_idle_expire_show, rd->queues[ROW_IDLE].fifo_expire, 1);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct row_data *rd = e->elevator_data;				\
+	int __data;							\
+	int ret = row_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(row_fg_read_quantum_store,
+	       &rd->queues[ROW_FG_READ].quantum, 0, INT_MAX, 0);
+STORE_FUNCTION(row_read_quantum_store,
+	       &rd->queues[ROW_SYNC_READ].quantum, 0, INT_MAX, 0);
+STORE_FUNCTION(row_sync_write_quantum_store,
+	       &rd->queues[ROW_SYNC_WRITE].quantum, 0, INT_MAX, 0);
+STORE_FUNCTION(row_async_write_quantum_store,
+	       &rd->queues[ROW_ASYNC_WRITE].quantum, 0, INT_MAX, 0);
+STORE_FUNCTION(row_bg_quantum_store,
+	       &rd->queues[ROW_BG].quantum, 0, INT_MAX, 0);
+STORE_FUNCTION(row_fg_read_expire_store,
+	       &rd->queues[ROW_FG_READ].fifo_expire, 0, INT_MAX, 1);
+STORE_FUNCTION(row_read_expire_store,
+	       &rd->queues[ROW_SYNC_READ].fifo_expire, 0, INT_MAX, 1);
+STORE_FUNCTION(row_sync_write_expire_store,
+	       &rd->queues[ROW_SYNC_WRITE].fifo_expire, 0, INT_MAX, 1);
+STORE_FUNCTION(row_async_write_expire_store,
+	       &rd->queues[ROW_ASYNC_WRITE].fifo_expire, 0, INT_MAX, 1);
+STORE_FUNCTION(row_bg_expire_store,
+	       &rd->queues[ROW_BG].fifo_expire, 0, INT_MAX, 1);
+STORE_FUNCTION(row_idle_expire_store,
+	       &rd->queues[ROW_IDLE].fifo_expire, 0, INT_MAX, 1);
+#undef STORE_FUNCTION
+
+/* One line per queue: dispatched, expired, average and maximum wait in ms */
+static ssize_t row_stats_show(struct elevator_queue *e, char *page)
+{
+	struct row_data *rd = e->elevator_data;
+	struct row_queue_stats *stats;
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < ROW_NR_QUEUES; i++) {
+		stats = &rd->queues[i].stats;
+		len += sprintf(page + len, "%-12s %lu %lu %u %u\n",
+			       row_queue_names[i], stats->dispatched,
+			       stats->expired,
+			       stats->dispatched ? jiffies_to_msecs(
+				       stats->wait_total / stats->dispatched) : 0,
+			       jiffies_to_msecs(stats->wait_max));
+	}
+	len += sprintf(page + len, "rounds %lu\n", rd->rounds);
+
+	return len;
+}
+
+#define ROW_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, row_##name##_show, \
+				      row_##name##_store)
+
+static struct elv_fs_entry row_attrs[] = {
+	ROW_ATTR(fg_read_quantum),
+	ROW_ATTR(read_quantum),
+	ROW_ATTR(sync_write_quantum),
+	ROW_ATTR(async_write_quantum),
+	ROW_ATTR(bg_quantum),
+	ROW_ATTR(fg_read_expire),
+	ROW_ATTR(read_expire),
+	ROW_ATTR(sync_write_expire),
+	ROW_ATTR(async_write_expire),
+	ROW_ATTR(bg_expire),
+	ROW_ATTR(idle_expire),
+	__ATTR(stats, S_IRUGO, row_stats_show, NULL),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_row = {
+	.ops = {
+		.elevator_allow_merge_fn =	row_allow_merge,
+		.elevator_merge_req_fn =	row_merged_requests,
+		.elevator_dispatch_fn =		row_dispatch_requests,
+		.elevator_add_req_fn =		row_add_request,
+		.elevator_init_fn =		row_init_queue,
+		.elevator_exit_fn =		row_exit_queue,
+	},
+
+	.elevator_attrs = row_attrs,
+	.elevator_name = "row",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init row_init(void)
+{
+	elv_register(&iosched_row);
+
+	return 0;
+}
+
+static void __exit row_exit(void)
+{
+	elv_unregister(&iosched_row);
+}
+
+module_init(row_init);
+module_exit(row_exit);
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("Read Over Write IO scheduler");
@@ -0,0 +1,301 @@
+/*
+ * drivers/gpu/ion/ion_page_pool.c
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/highmem.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include "ion_priv.h"
+
+static void ion_page_pool_zero(struct page *page, unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < (1 << order); i++)
+		clear_highpage(page + i);
+}
+
+/*
+ * Items are split into order-0 pages, so that each page has a reference
+ * count of its own and can be inserted into user mappings with
+ * vm_insert_page().
+ */
+static struct page *ion_page_pool_alloc_pages(struct ion_page_pool *pool)
+{
+	struct page *page = alloc_pages(pool->gfp_mask | __GFP_ZERO,
+					pool->order);
+
+	if (page && pool->order)
+		split_page(page, pool->order);
+	return page;
+}
+
+static void ion_page_pool_free_pages(struct ion_page_pool *pool,
+				     struct page *page)
+{
+	int i;
+
+	for (i = 0; i < (1 << pool->order); i++)
+		__free_page(page + i);
+}
+
+/*
+ * Pages in the pool are linked through page->lru, which is unused while
+ * the pages are owned by the pool, so adding a page never allocates.
+ */
+
+/* Called with pool->mutex held */
+static void ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
+{
+	if (PageHighMem(page)) {
+		list_add_tail(&page->lru, &pool->high_items);
+		pool->high_count++;
+	} else {
+		list_add_tail(&page->lru, &pool->low_items);
+		pool->low_count++;
+	}
+}
+
+/* Called with pool->mutex held */
+static struct page *ion_page_pool_remove(struct ion_page_pool *pool, bool high)
+{
+	struct page *page;
+
+	if (high) {
+		BUG_ON(!pool->high_count);
+		page = list_first_entry(&pool->high_items, struct page, lru);
+		pool->high_count--;
+	} else {
+		BUG_ON(!pool->low_count);
+		page = list_first_entry(&pool->low_items, struct page, lru);
+		pool->low_count--;
+	}
+
+	list_del(&page->lru);
+	return page;
+}
+
+/* Called with pool->mutex held */
+static struct page *ion_page_pool_remove_dirty(struct ion_page_pool *pool)
+{
+	struct page *page;
+
+	BUG_ON(!pool->dirty_count);
+	page = list_first_entry(&pool->dirty_items, struct page, lru);
+	list_del(&page->lru);
+	pool->dirty_count--;
+	return page;
+}
+
+/*
+ * Zero the pages given back to the pool and move them to the clean lists,
+ * so that neither the free nor the allocation path has to pay for it.
+ */
+static void ion_page_pool_zero_work(struct work_struct *work)
+{
+	struct ion_page_pool *pool = container_of(work, struct ion_page_pool,
+						  zero_work);
+	struct page *page;
+	ktime_t start;
+	s64 ns;
+
+	for (;;) {
+		mutex_lock(&pool->mutex);
+		if (!pool->dirty_count) {
+			mutex_unlock(&pool->mutex);
+			break;
+		}
+		page = ion_page_pool_remove_dirty(pool);
+		mutex_unlock(&pool->mutex);
+
+		start = ktime_get();
+		ion_page_pool_zero(page, pool->order);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		mutex_lock(&pool->mutex);
+		ion_page_pool_add(pool, page);
+		pool->zeroed++;
+		pool->zero_ns += ns;
+		mutex_unlock(&pool->mutex);
+
+		cond_resched();
+	}
+}
+
+/**
+ * ion_page_pool_alloc - take a zeroed page of the pool's order
+ *
+ * Pages already zeroed by the pool's worker are used first.  A page still
+ * waiting for the worker is zeroed here, which is no slower than getting
+ * a zeroed page from the page allocator.  Only when the pool is empty do
+ * pages come from the page allocator.
+ */
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool)
+{
+	struct page *page = NULL;
+	bool dirty = false;
+
+	BUG_ON(!pool);
+
+	mutex_lock(&pool->mutex);
+	if (pool->high_count) {
+		page = ion_page_pool_remove(pool, true);
+	} else if (pool->low_count) {
+		page = ion_page_pool_remove(pool, false);
+	} else if (pool->dirty_count) {
+		page = ion_page_pool_remove_dirty(pool);
+		dirty = true;
+	}
+	if (page)
+		pool->hits++;
+	else
+		pool->misses++;
+	if (dirty)
+		pool->zeroed_inline++;
+	mutex_unlock(&pool->mutex);
+
+	if (dirty)
+		ion_page_pool_zero(page, pool->order);
+	else if (!page)
+		page = ion_page_pool_alloc_pages(pool);
+
+	return page;
+}
+
+/*
+ * Pages of a buffer that were mapped with vm_insert_page() may still be
+ * pinned, e.g. by get_user_pages() for direct I/O, after the buffer is
+ * gone.  Such pages must not be zeroed and handed out again.
+ */
+static bool ion_page_pool_in_use(struct ion_page_pool *pool,
+				 struct page *page)
+{
+	int i;
+
+	for (i = 0; i < (1 << pool->order); i++)
+		if (page_count(page + i) != 1)
+			return true;
+	return false;
+}
+
+/**
+ * ion_page_pool_free - give a page back to the pool
+ *
+ * The page is queued for zeroing by the pool's worker, so freeing a buffer
+ * only costs a list insertion per page.  Pages still referenced elsewhere
+ * are released to the system instead, which frees each of them once its
+ * last reference is dropped.
+ */
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
+{
+	if (ion_page_pool_in_use(pool, page)) {
+		ion_page_pool_free_pages(pool, page);
+		return;
+	}
+
+	mutex_lock(&pool->mutex);
+	list_add_tail(&page->lru, &pool->dirty_items);
+	pool->dirty_count++;
+	if (pool->dirty_count > pool->dirty_max)
+		pool->dirty_max = pool->dirty_count;
+	mutex_unlock(&pool->mutex);
+
+	queue_work(system_unbound_wq, &pool->zero_work);
+}
+
+/* Number of 0-order pages held by the pool, zeroed or not */
+int ion_page_pool_total(struct ion_page_pool *pool, bool high)
+{
+	int count;
+
+	mutex_lock(&pool->mutex);
+	count = pool->low_count + pool->dirty_count;
+	if (high)
+		count += pool->high_count;
+	mutex_unlock(&pool->mutex);
+
+	return count << pool->order;
+}
+
+/**
+ * ion_page_pool_shrink - release pages held by the pool
+ * @gfp_mask:		the caller's allocation mask; highmem pages are only
+ *			released when it allows highmem
+ * @nr_to_scan:		number of 0-order pages to release, 0 just counts
+ *
+ * Pages still waiting to be zeroed are released first, so no work is
+ * thrown away.  Returns the number of 0-order pages released, or left in
+ * the pool when nr_to_scan is 0.
+ */
+int ion_page_pool_shrink(struct ion_page_pool *pool, gfp_t gfp_mask,
+			 int nr_to_scan)
+{
+	int nr_freed = 0;
+	int i;
+	bool high;
+
+	high = !!(gfp_mask & __GFP_HIGHMEM);
+
+	if (nr_to_scan == 0)
+		return ion_page_pool_total(pool, high);
+
+	for (i = 0; i < nr_to_scan; i += (1 << pool->order)) {
+		struct page *page;
+
+		mutex_lock(&pool->mutex);
+		if (pool->dirty_count) {
+			page = ion_page_pool_remove_dirty(pool);
+		} else if (pool->low_count) {
+			page = ion_page_pool_remove(pool, false);
+		} else if (high && pool->high_count) {
+			page = ion_page_pool_remove(pool, true);
+		} else {
+			mutex_unlock(&pool->mutex);
+			break;
+		}
+		mutex_unlock(&pool->mutex);
+		ion_page_pool_free_pages(pool, page);
+		nr_freed += (1 << pool->order);
+	}
+
+	return nr_freed;
+}
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
+{
+	struct ion_page_pool *pool = kzalloc(sizeof(struct ion_page_pool),
+					     GFP_KERNEL);
+	if (!pool)
+		return NULL;
+	INIT_LIST_HEAD(&pool->low_items);
+	INIT_LIST_HEAD(&pool->high_items);
+	INIT_LIST_HEAD(&pool->dirty_items);
+	INIT_WORK(&pool->zero_work, ion_page_pool_zero_work);
+	pool->gfp_mask = gfp_mask;
+	pool->order = order;
+	mutex_init(&pool->mutex);
+
+	return pool;
+}
+
+void ion_page_pool_destroy(struct ion_page_pool *pool)
+{
+	cancel_work_sync(&pool->zero_work);
+	ion_page_pool_shrink(pool, __GFP_HIGHMEM, INT_MAX);
+	kfree(pool);
+}
@@ -22,6 +22,7 @@
 #include <linux/mm_types.h>
 #include <linux/mutex.h>
 #include <linux/rbtree.h>
+#include <linux/workqueue.h>
 #include <linux/ion.h>
 #include <linux/iommu.h>
 
@@ -279,6 +280,59 @@ struct ion_heap *msm_get_contiguous_heap(void);
 void *ion_map_fmem_buffer(struct ion_buffer *buffer, unsigned long phys_base,
 				void *virt_base, unsigned long flags);
 
+/**
+ * struct ion_page_pool - pagepool struct
+ * @high_count:		number of zeroed highmem items in the pool
+ * @low_count:		number of zeroed lowmem items in the pool
+ * @dirty_count:	number of items waiting to be zeroed
+ * @dirty_max:		highest dirty_count seen
+ * @hits:		allocations served from the pool
+ * @misses:		allocations that went to the page allocator
+ * @zeroed:		items zeroed by the worker
+ * @zeroed_inline:	allocations that had to zero a dirty item themselves
+ * @zero_ns:		time the worker spent zeroing, i.e. kept off the
+ *			allocation and free paths
+ * @high_items:		list of zeroed highmem items
+ * @low_items:		list of zeroed lowmem items
+ * @dirty_items:	list of items waiting to be zeroed
+ * @zero_work:		worker zeroing the dirty items
+ * @mutex:		lock protecting this struct and especially the count
+ *			item list
+ * @gfp_mask:		gfp_mask to use from alloc
+ * @order:		order of pages in the pool
+ *
+ * Allows you to keep a pool of pre-zeroed pages of one order around for
+ * fast allocation.  Pages given back are queued on the dirty list and
+ * zeroed by a background worker, so neither freeing a buffer nor
+ * allocating from the pool has to clear memory.
+ */
+struct ion_page_pool {
+	int high_count;
+	int low_count;
+	int dirty_count;
+	int dirty_max;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long zeroed;
+	unsigned long zeroed_inline;
+	u64 zero_ns;
+	struct list_head high_items;
+	struct list_head low_items;
+	struct list_head dirty_items;
+	struct work_struct zero_work;
+	struct mutex mutex;
+	gfp_t gfp_mask;
+	unsigned int order;
+};
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order);
+void ion_page_pool_destroy(struct ion_page_pool *);
+struct page *ion_page_pool_alloc(struct ion_page_pool *);
+void ion_page_pool_free(struct ion_page_pool *, struct page *);
+int ion_page_pool_total(struct ion_page_pool *pool, bool high);
+int ion_page_pool_shrink(struct ion_page_pool *pool, gfp_t gfp_mask,
+			 int nr_to_scan);
+
 /**
  * ion_do_cache_op - do cache operations.
  *
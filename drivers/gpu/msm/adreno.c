@@ -450,6 +450,8 @@ adreno_probe(struct platform_device *pdev)
 
 	init_completion(&device->recovery_gate);
 
+	adreno_dispatcher_init(adreno_dev);
+
 	status = adreno_ringbuffer_init(device);
 	if (status != 0)
 		goto error;
@@ -491,6 +493,7 @@ static int __devexit adreno_remove(struct platform_device *pdev)
 	kgsl_pwrscale_detach_policy(device);
 	kgsl_pwrscale_close(device);
 
+	adreno_dispatcher_close(adreno_dev);
 	adreno_ringbuffer_close(&adreno_dev->ringbuffer);
 	kgsl_device_platform_remove(device);
 
@@ -910,6 +913,8 @@ int adreno_idle(struct kgsl_device *device, unsigned int timeout)
 	unsigned int msecs_first;
 	unsigned int msecs_part;
 
+	adreno_dispatcher_flush(adreno_dev);
+
 	kgsl_cffdump_regpoll(device->id, REG_RBBM_STATUS << 2,
 		0x00000000, 0x80000000);
 	/* first, wait until the CP has consumed all the commands in
@@ -942,8 +947,10 @@ retry:
 	wait_time = jiffies + wait_timeout;
 	while (time_before(jiffies, wait_time)) {
 		adreno_regread(device, REG_RBBM_STATUS, &rbbm_status);
-		if (rbbm_status == 0x110)
+		if (rbbm_status == 0x110) {
+			adreno_ringbuffer_account(rb);
 			return 0;
+		}
 	}
 
 err:
@@ -967,7 +974,8 @@ static unsigned int adreno_isidle(struct kgsl_device *device)
 	if (device->state == KGSL_STATE_ACTIVE) {
 		/* Is the ring buffer is empty? */
 		GSL_RB_GET_READPTR(rb, &rb->rptr);
-		if (!device->active_cnt && (rb->rptr == rb->wptr)) {
+		if (!device->active_cnt && !adreno_dev->dispatcher.queued &&
+		    (rb->rptr == rb->wptr)) {
 			/* Is the core idle? */
 			adreno_regread(device, REG_RBBM_STATUS,
 					    &rbbm_status);
@@ -986,6 +994,8 @@ static int adreno_suspend_context(struct kgsl_device *device)
 	int status = 0;
 	struct adreno_device *adreno_dev = ADRENO_DEVICE(device);
 
+	adreno_dispatcher_flush(adreno_dev);
+
 	/* switch to NULL ctxt */
 	if (adreno_dev->drawctxt_active != NULL) {
 		adreno_drawctxt_switch(adreno_dev, NULL, 0);
@@ -1191,6 +1201,9 @@ static int adreno_waittimestamp(struct kgsl_device *device,
 	if (msecs == -1)
 		msecs = adreno_dev->wait_timeout;
 
+	/* the timestamp may belong to a batch still in the dispatcher */
+	adreno_dispatcher_flush(adreno_dev);
+
 	if (timestamp_cmp(timestamp, adreno_dev->ringbuffer.timestamp) > 0) {
 		KGSL_DRV_ERR(device, "Cannot wait for invalid ts: %x, "
 			"rb->timestamp: %x\n",
@@ -1257,6 +1270,7 @@ static int adreno_waittimestamp(struct kgsl_device *device,
 			status = 0;
 	}
 done:
+	adreno_ringbuffer_account(&adreno_dev->ringbuffer);
 	return (int)status;
 }
 
@@ -1309,6 +1323,12 @@ static long adreno_ioctl(struct kgsl_device_private *dev_priv,
 
 }
 
+/* Charge retired batches as soon as the retire interrupt is handled */
+static void adreno_timestamp_expired(struct kgsl_device *device)
+{
+	adreno_ringbuffer_account(&ADRENO_DEVICE(device)->ringbuffer);
+}
+
 static inline s64 adreno_ticks_to_us(u32 ticks, u32 gpu_freq)
 {
 	gpu_freq /= 1000000;
@@ -1321,6 +1341,8 @@ static void adreno_power_stats(struct kgsl_device *device,
 	unsigned int reg;
 	struct kgsl_pwrctrl *pwr = &device->pwrctrl;
 
+	adreno_ringbuffer_account(&ADRENO_DEVICE(device)->ringbuffer);
+
 	/* In order to calculate idle you have to have run the algorithm *
 	 * at least once to get a start time. */
 	if (pwr->time != 0) {
@@ -1400,7 +1422,7 @@ static const struct kgsl_functable adreno_functable = {
 	.getproperty = adreno_getproperty,
 	.waittimestamp = adreno_waittimestamp,
 	.readtimestamp = adreno_readtimestamp,
-	.issueibcmds = adreno_ringbuffer_issueibcmds,
+	.issueibcmds = adreno_dispatcher_queue_cmds,
 	.ioctl = adreno_ioctl,
 	.setup_pt = adreno_setup_pt,
 	.cleanup_pt = adreno_cleanup_pt,
@@ -1412,6 +1434,7 @@ static const struct kgsl_functable adreno_functable = {
 	.setstate = adreno_setstate,
 	.drawctxt_create = adreno_drawctxt_create,
 	.drawctxt_destroy = adreno_drawctxt_destroy,
+	.timestamp_expired = adreno_timestamp_expired,
 };
 
 static struct platform_device_id adreno_id_table[] = {
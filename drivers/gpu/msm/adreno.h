@@ -13,6 +13,8 @@
 #ifndef __ADRENO_H
 #define __ADRENO_H
 
+#include <linux/ktime.h>
+
 #include "kgsl_device.h"
 #include "adreno_drawctxt.h"
 #include "adreno_ringbuffer.h"
@@ -57,6 +59,45 @@ enum adreno_gpurev {
 
 struct adreno_gpudev;
 
+/*
+ * Maximum number of command batches a context may have waiting for the
+ * dispatcher.  A context that reaches it sleeps until the worker has
+ * dispatched some of them.
+ */
+#define ADRENO_CONTEXT_QUEUE_MAX	16
+
+/* A command batch waiting in a context's queue for the dispatcher */
+struct adreno_cmdbatch {
+	struct list_head node;
+	struct kgsl_context *context;
+	struct kgsl_ibdesc *ibdesc;
+	unsigned int numibs;
+	unsigned int flags;
+	unsigned int timestamp;
+	ktime_t queued;
+};
+
+/*
+ * The dispatcher moves command batches from the context queues to the
+ * ringbuffer.  All fields are protected by the device mutex.
+ */
+struct adreno_dispatcher {
+	struct list_head contexts;	/* contexts with queued batches */
+	unsigned int queued;		/* batches queued on all contexts */
+	int dispatching;
+	struct delayed_work work;
+	wait_queue_head_t wq;		/* woken when batches are dispatched */
+	struct {
+		unsigned int queued_max;
+		unsigned int dispatched;
+		unsigned int inline_flushes;
+		unsigned int queue_waits;
+		unsigned int ring_full;
+		u64 latency_ns;
+		u64 latency_max_ns;
+	} stats;
+};
+
 struct adreno_device {
 	struct kgsl_device dev;    /* Must be first field in this struct */
 	unsigned int chip_id;
@@ -75,6 +116,7 @@ struct adreno_device {
 	unsigned int wait_timeout;
 	unsigned int istore_size;
 	unsigned int pix_shader_start;
+	struct adreno_dispatcher dispatcher;
 };
 
 struct adreno_gpudev {
@@ -95,6 +137,16 @@ extern const unsigned int a200_registers_count;
 extern const unsigned int a220_registers_count;
 
 int adreno_idle(struct kgsl_device *device, unsigned int timeout);
+
+void adreno_dispatcher_init(struct adreno_device *adreno_dev);
+void adreno_dispatcher_close(struct adreno_device *adreno_dev);
+void adreno_dispatcher_flush(struct adreno_device *adreno_dev);
+int adreno_dispatcher_queue_cmds(struct kgsl_device_private *dev_priv,
+				struct kgsl_context *context,
+				struct kgsl_ibdesc *ibdesc,
+				unsigned int numibs,
+				uint32_t *timestamp,
+				unsigned int flags);
 void adreno_regread(struct kgsl_device *device, unsigned int offsetwords,
 				unsigned int *value);
 void adreno_regwrite(struct kgsl_device *device, unsigned int offsetwords,
@@ -15,6 +15,7 @@
 #include <linux/debugfs.h>
 #include <linux/uaccess.h>
 #include <linux/io.h>
+#include <linux/seq_file.h>
 
 #include "kgsl.h"
 #include "adreno_postmortem.h"
@@ -326,6 +327,52 @@ static const struct file_operations kgsl_mh_debug_fops = {
 	.read = kgsl_mh_debug_read,
 };
 
+static int kgsl_dispatcher_show(struct seq_file *s, void *unused)
+{
+	struct kgsl_device *device = s->private;
+	struct adreno_device *adreno_dev = ADRENO_DEVICE(device);
+	struct adreno_dispatcher *dispatcher = &adreno_dev->dispatcher;
+	struct adreno_context *drawctxt;
+	u64 avg = 0;
+
+	mutex_lock(&device->mutex);
+
+	if (dispatcher->stats.dispatched) {
+		avg = dispatcher->stats.latency_ns;
+		do_div(avg, dispatcher->stats.dispatched);
+	}
+
+	seq_printf(s, "queued: %u\n", dispatcher->queued);
+	seq_printf(s, "queued_max: %u\n", dispatcher->stats.queued_max);
+	seq_printf(s, "dispatched: %u\n", dispatcher->stats.dispatched);
+	seq_printf(s, "inline_flushes: %u\n",
+		   dispatcher->stats.inline_flushes);
+	seq_printf(s, "queue_waits: %u\n", dispatcher->stats.queue_waits);
+	seq_printf(s, "ring_full: %u\n", dispatcher->stats.ring_full);
+	seq_printf(s, "latency_avg_us: %llu\n", div_u64(avg, NSEC_PER_USEC));
+	seq_printf(s, "latency_max_us: %llu\n",
+		   div_u64(dispatcher->stats.latency_max_ns, NSEC_PER_USEC));
+
+	list_for_each_entry(drawctxt, &dispatcher->contexts, dispatch_node)
+		seq_printf(s, "context %p: %u queued\n", drawctxt,
+			   drawctxt->queued);
+
+	mutex_unlock(&device->mutex);
+	return 0;
+}
+
+static int kgsl_dispatcher_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, kgsl_dispatcher_show, inode->i_private);
+}
+
+static const struct file_operations kgsl_dispatcher_fops = {
+	.open = kgsl_dispatcher_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 void adreno_debugfs_init(struct kgsl_device *device)
 {
 	struct adreno_device *adreno_dev = ADRENO_DEVICE(device);
@@ -345,6 +392,8 @@ void adreno_debugfs_init(struct kgsl_device *device)
 			    &kgsl_cff_dump_enable_fops);
 	debugfs_create_u32("wait_timeout", 0644, device->d_debugfs,
 		&adreno_dev->wait_timeout);
+	debugfs_create_file("dispatcher", 0444, device->d_debugfs, device,
+			    &kgsl_dispatcher_fops);
 
 	/* Create post mortem control files */
 
@@ -0,0 +1,343 @@
+/* Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/sched.h>
+#include <linux/workqueue.h>
+
+#include "kgsl.h"
+#include "kgsl_sharedmem.h"
+#include "adreno.h"
+#include "adreno_pm4types.h"
+
+/*
+ * Command batch dispatcher
+ *
+ * IOCTL_KGSL_RINGBUFFER_ISSUEIBCMDS only puts the batch on its context's
+ * queue and hands back the timestamp the batch will retire with.  The
+ * dispatcher worker later writes the queued batches to the ringbuffer,
+ * so the submitting thread never waits for ringbuffer space.
+ *
+ * Timestamps are global to the device, so batches have to reach the
+ * ringbuffer in timestamp order: the dispatcher always takes the oldest
+ * head of all context queues.  Timestamps are handed out in advance as
+ * rb->timestamp + number of queued batches; while batches are queued,
+ * kernel commands reuse the last timestamp (see adreno_ringbuffer_addcmds)
+ * so that the handed out timestamps stay valid.
+ *
+ * A context is kept from starving the others by ADRENO_CONTEXT_QUEUE_MAX:
+ * a context that has that many batches queued sleeps, with the device
+ * mutex dropped, until the worker has dispatched some of them.
+ */
+
+/*
+ * Ringbuffer dwords kept free for the context switch and state commands
+ * written along with a batch.  The worker backs off rather than spin in
+ * adreno_ringbuffer_allocspace() when there is less room than this.
+ */
+#define ADRENO_DISPATCH_RB_RESERVE	512
+
+static unsigned int adreno_dispatcher_rb_space(struct adreno_ringbuffer *rb)
+{
+	GSL_RB_GET_READPTR(rb, &rb->rptr);
+	return rb->sizedwords - adreno_ringbuffer_count(rb, rb->rptr) - 1;
+}
+
+/* Oldest batch queued on any context, or NULL */
+static struct adreno_cmdbatch *
+adreno_dispatcher_next(struct adreno_dispatcher *dispatcher)
+{
+	struct adreno_context *drawctxt;
+	struct adreno_cmdbatch *batch, *oldest = NULL;
+
+	list_for_each_entry(drawctxt, &dispatcher->contexts, dispatch_node) {
+		batch = list_first_entry(&drawctxt->cmdqueue,
+					 struct adreno_cmdbatch, node);
+		if (oldest == NULL ||
+		    timestamp_cmp(oldest->timestamp, batch->timestamp) > 0)
+			oldest = batch;
+	}
+
+	return oldest;
+}
+
+/*
+ * Write one batch to the ringbuffer.  If the batch can not be issued its
+ * timestamp is still retired, so nobody waits for it forever.
+ */
+static void adreno_dispatcher_issue(struct adreno_device *adreno_dev,
+				    struct adreno_cmdbatch *batch)
+{
+	struct kgsl_device *device = &adreno_dev->dev;
+	struct adreno_ringbuffer *rb = &adreno_dev->ringbuffer;
+	struct kgsl_context *context = batch->context;
+	unsigned int timestamp;
+	unsigned int cmds[2];
+	s64 latency;
+	int ret;
+
+	ret = adreno_ringbuffer_issueibcmds(context->dev_priv, context,
+					    batch->ibdesc, batch->numibs,
+					    &timestamp, batch->flags);
+	if (ret == 0) {
+		WARN(timestamp != batch->timestamp,
+		     "kgsl: batch retires at %x instead of %x\n",
+		     timestamp, batch->timestamp);
+	} else if (device->state & KGSL_STATE_HUNG) {
+		/*
+		 * The GPU will not run again, so nothing would write the
+		 * timestamp.  Retire it from here and wake the waiters.
+		 */
+		rb->timestamp++;
+		kgsl_sharedmem_writel(&device->memstore,
+				KGSL_DEVICE_MEMSTORE_OFFSET(soptimestamp),
+				rb->timestamp);
+		kgsl_sharedmem_writel(&device->memstore,
+				KGSL_DEVICE_MEMSTORE_OFFSET(eoptimestamp),
+				rb->timestamp);
+		wmb();
+		queue_work(device->work_queue, &device->ts_expired_ws);
+		wake_up_interruptible_all(&device->wait_queue);
+		atomic_notifier_call_chain(&device->ts_notifier_list,
+					   device->id, NULL);
+	} else {
+		KGSL_CMD_ERR(device, "ctxt %d ts %x dropped: %d\n",
+			     context->id, batch->timestamp, ret);
+		cmds[0] = cp_nop_packet(1);
+		cmds[1] = KGSL_CMD_IDENTIFIER;
+		adreno_ringbuffer_issuecmds(device,
+					    KGSL_CMD_FLAGS_NOT_KERNEL_CMD,
+					    cmds, 2);
+	}
+
+	latency = ktime_to_ns(ktime_sub(ktime_get(), batch->queued));
+	adreno_dev->dispatcher.stats.dispatched++;
+	adreno_dev->dispatcher.stats.latency_ns += latency;
+	if (latency > adreno_dev->dispatcher.stats.latency_max_ns)
+		adreno_dev->dispatcher.stats.latency_max_ns = latency;
+}
+
+/*
+ * Dispatch queued batches in timestamp order.  With wait_for_space false
+ * the ringbuffer is only written while it has room; returns the number
+ * of batches left queued.  Caller must hold the device mutex.
+ */
+static unsigned int adreno_dispatcher_run(struct adreno_device *adreno_dev,
+					  bool wait_for_space)
+{
+	struct adreno_dispatcher *dispatcher = &adreno_dev->dispatcher;
+	struct adreno_context *drawctxt;
+	struct adreno_cmdbatch *batch;
+	unsigned int dispatched = dispatcher->stats.dispatched;
+
+	/* dispatching writes kernel commands, which may call back in here */
+	if (dispatcher->dispatching)
+		return dispatcher->queued;
+	dispatcher->dispatching = 1;
+
+	while ((batch = adreno_dispatcher_next(dispatcher)) != NULL) {
+		if (!wait_for_space &&
+		    adreno_dispatcher_rb_space(&adreno_dev->ringbuffer) <
+		    batch->numibs * 3 + ADRENO_DISPATCH_RB_RESERVE) {
+			dispatcher->stats.ring_full++;
+			break;
+		}
+
+		adreno_dispatcher_issue(adreno_dev, batch);
+
+		drawctxt = batch->context->devctxt;
+		list_del(&batch->node);
+		if (--drawctxt->queued == 0)
+			list_del_init(&drawctxt->dispatch_node);
+		dispatcher->queued--;
+
+		kfree(batch->ibdesc);
+		kfree(batch);
+	}
+
+	dispatcher->dispatching = 0;
+	if (dispatcher->stats.dispatched != dispatched)
+		wake_up_all(&dispatcher->wq);
+	return dispatcher->queued;
+}
+
+static void adreno_dispatcher_work(struct work_struct *work)
+{
+	struct adreno_dispatcher *dispatcher = container_of(work,
+				struct adreno_dispatcher, work.work);
+	struct adreno_device *adreno_dev = container_of(dispatcher,
+				struct adreno_device, dispatcher);
+	struct kgsl_device *device = &adreno_dev->dev;
+
+	mutex_lock(&device->mutex);
+	kgsl_check_suspended(device);
+
+	/* Try again on the next tick if the ringbuffer filled up */
+	if (adreno_dispatcher_run(adreno_dev, false))
+		queue_delayed_work(device->work_queue, &dispatcher->work, 1);
+
+	mutex_unlock(&device->mutex);
+}
+
+/**
+ * adreno_dispatcher_flush - write all queued batches to the ringbuffer
+ * @adreno_dev - Adreno device
+ *
+ * Used before waiting on the ringbuffer or switching away from a context,
+ * when the queued batches have to be in the ringbuffer.  Caller must hold
+ * the device mutex.
+ */
+void adreno_dispatcher_flush(struct adreno_device *adreno_dev)
+{
+	struct adreno_dispatcher *dispatcher = &adreno_dev->dispatcher;
+
+	if (!dispatcher->queued || dispatcher->dispatching)
+		return;
+
+	dispatcher->stats.inline_flushes++;
+	adreno_dispatcher_run(adreno_dev, true);
+}
+
+/*
+ * Sleep until the worker has dispatched a batch.  The device mutex is
+ * dropped meanwhile, so the caller has to look up its context again.
+ */
+static int adreno_dispatcher_wait(struct adreno_device *adreno_dev)
+{
+	struct kgsl_device *device = &adreno_dev->dev;
+	struct adreno_dispatcher *dispatcher = &adreno_dev->dispatcher;
+	unsigned int dispatched = dispatcher->stats.dispatched;
+	int ret;
+
+	dispatcher->stats.queue_waits++;
+	queue_delayed_work(device->work_queue, &dispatcher->work, 0);
+
+	mutex_unlock(&device->mutex);
+	ret = wait_event_interruptible(dispatcher->wq,
+			ACCESS_ONCE(dispatcher->stats.dispatched) != dispatched);
+	mutex_lock(&device->mutex);
+
+	return ret;
+}
+
+/**
+ * adreno_dispatcher_queue_cmds - queue a command batch for the dispatcher
+ * @dev_priv - KGSL device handle of the submitter
+ * @context - Context the batch belongs to
+ * @ibdesc - Indirect buffers to issue, copied by this function
+ * @numibs - Number of entries in @ibdesc
+ * @timestamp - Returns the timestamp the batch will retire with
+ * @flags - Flags passed from user space
+ *
+ * Replaces adreno_ringbuffer_issueibcmds() as the issueibcmds hook.
+ * Caller must hold the device mutex.
+ */
+int adreno_dispatcher_queue_cmds(struct kgsl_device_private *dev_priv,
+				struct kgsl_context *context,
+				struct kgsl_ibdesc *ibdesc,
+				unsigned int numibs,
+				uint32_t *timestamp,
+				unsigned int flags)
+{
+	struct kgsl_device *device = dev_priv->device;
+	struct adreno_device *adreno_dev = ADRENO_DEVICE(device);
+	struct adreno_dispatcher *dispatcher = &adreno_dev->dispatcher;
+	struct adreno_context *drawctxt;
+	struct adreno_cmdbatch *batch;
+	unsigned int id = context ? context->id : 0;
+	int ret;
+
+#ifdef CONFIG_MSM_KGSL_CFF_DUMP
+	/* the dump has to see the commands as they are submitted */
+	return adreno_ringbuffer_issueibcmds(dev_priv, context, ibdesc,
+					     numibs, timestamp, flags);
+#endif
+
+again:
+	if (device->state & KGSL_STATE_HUNG)
+		return -EBUSY;
+	if (!(adreno_dev->ringbuffer.flags & KGSL_FLAGS_STARTED) ||
+	      context == NULL || ibdesc == 0 || numibs == 0)
+		return -EINVAL;
+
+	drawctxt = context->devctxt;
+
+	if (drawctxt->flags & CTXT_FLAGS_GPU_HANG) {
+		KGSL_CTXT_WARN(device, "Context %p caused a gpu hang.."
+			" will not accept commands for this context\n",
+			drawctxt);
+		return -EDEADLK;
+	}
+
+	if (drawctxt->queued >= ADRENO_CONTEXT_QUEUE_MAX) {
+		ret = adreno_dispatcher_wait(adreno_dev);
+		if (ret)
+			return ret;
+		/* the context may have been destroyed meanwhile */
+		if (kgsl_find_context(dev_priv, id) != context)
+			return -EINVAL;
+		goto again;
+	}
+
+	batch = kzalloc(sizeof(*batch), GFP_KERNEL);
+	if (batch == NULL)
+		return -ENOMEM;
+
+	batch->ibdesc = kmemdup(ibdesc, sizeof(*ibdesc) * numibs, GFP_KERNEL);
+	if (batch->ibdesc == NULL) {
+		kfree(batch);
+		return -ENOMEM;
+	}
+
+	batch->context = context;
+	batch->numibs = numibs;
+	batch->flags = flags;
+	batch->queued = ktime_get();
+
+	dispatcher->queued++;
+	batch->timestamp = adreno_dev->ringbuffer.timestamp +
+			   dispatcher->queued;
+
+	list_add_tail(&batch->node, &drawctxt->cmdqueue);
+	if (drawctxt->queued++ == 0)
+		list_add_tail(&drawctxt->dispatch_node, &dispatcher->contexts);
+
+	if (dispatcher->queued > dispatcher->stats.queued_max)
+		dispatcher->stats.queued_max = dispatcher->queued;
+
+	*timestamp = batch->timestamp;
+
+	KGSL_CMD_INFO(device, "ctxt %d numibs %d ts %d queued %d\n",
+		context->id, numibs, *timestamp, dispatcher->queued);
+
+	queue_delayed_work(device->work_queue, &dispatcher->work, 0);
+
+	return 0;
+}
+
+void adreno_dispatcher_init(struct adreno_device *adreno_dev)
+{
+	struct adreno_dispatcher *dispatcher = &adreno_dev->dispatcher;
+
+	memset(dispatcher, 0, sizeof(*dispatcher));
+	INIT_LIST_HEAD(&dispatcher->contexts);
+	init_waitqueue_head(&dispatcher->wq);
+	INIT_DELAYED_WORK(&dispatcher->work, adreno_dispatcher_work);
+}
+
+/* The device mutex must not be held, the worker takes it */
+void adreno_dispatcher_close(struct adreno_device *adreno_dev)
+{
+	cancel_delayed_work_sync(&adreno_dev->dispatcher.work);
+}
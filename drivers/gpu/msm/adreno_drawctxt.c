@@ -138,6 +138,8 @@ int adreno_drawctxt_create(struct kgsl_device *device,
 
 	drawctxt->pagetable = pagetable;
 	drawctxt->bin_base_offset = 0;
+	INIT_LIST_HEAD(&drawctxt->cmdqueue);
+	INIT_LIST_HEAD(&drawctxt->dispatch_node);
 
 	if (flags & KGSL_CONTEXT_PREAMBLE)
 		drawctxt->flags |= CTXT_FLAGS_PREAMBLE;
@@ -176,6 +178,10 @@ void adreno_drawctxt_destroy(struct kgsl_device *device,
 	if (drawctxt == NULL)
 		return;
 
+	/* the context's queued commands must reach the ringbuffer first */
+	if (drawctxt->queued)
+		adreno_dispatcher_flush(adreno_dev);
+
 	/* deactivate context */
 	if (adreno_dev->drawctxt_active == drawctxt) {
 		/* no need to save GMEM or shader, the context is
@@ -190,6 +196,7 @@ void adreno_drawctxt_destroy(struct kgsl_device *device,
 	}
 
 	adreno_idle(device, KGSL_TIMEOUT_DEFAULT);
+	adreno_ringbuffer_forget_context(&adreno_dev->ringbuffer, context);
 
 	kgsl_sharedmem_free(&drawctxt->gpustate);
 	kgsl_sharedmem_free(&drawctxt->context_gmem_shadow.gmemshadow);
@@ -81,6 +81,10 @@ struct adreno_context {
 	unsigned int bin_base_offset;
 	/* Information of the GMEM shadow that is created in context create */
 	struct gmem_shadow_t context_gmem_shadow;
+	/* Command batches waiting for the dispatcher, oldest first */
+	struct list_head cmdqueue;
+	unsigned int queued;
+	struct list_head dispatch_node;
 };
 
 int adreno_drawctxt_create(struct kgsl_device *device,
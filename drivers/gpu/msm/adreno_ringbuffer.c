@@ -400,6 +400,10 @@ void adreno_ringbuffer_stop(struct adreno_ringbuffer *rb)
 		adreno_regwrite(rb->device, REG_CP_ME_CNTL, 0x10000000);
 		rb->flags &= ~KGSL_FLAGS_STARTED;
 	}
+
+	/* timestamps may restart from 0, drop whatever did not retire */
+	adreno_ringbuffer_account(rb);
+	rb->busy_count = 0;
 }
 
 int adreno_ringbuffer_init(struct kgsl_device *device)
@@ -503,7 +507,14 @@ adreno_ringbuffer_addcmds(struct adreno_ringbuffer *rb,
 		GSL_RB_WRITE(ringcmds, rcmd_gpu, 1);
 	}
 
-	rb->timestamp++;
+	/*
+	 * The timestamps of batches waiting for the dispatcher have already
+	 * been handed out, so kernel commands issued meanwhile retire with
+	 * the last timestamp instead of taking the next one.
+	 */
+	if ((flags & KGSL_CMD_FLAGS_NOT_KERNEL_CMD) ||
+	    !ADRENO_DEVICE(rb->device)->dispatcher.queued)
+		rb->timestamp++;
 	timestamp = rb->timestamp;
 
 	/* start-of-pipeline and end-of-pipeline timestamps */
@@ -538,6 +549,92 @@ adreno_ringbuffer_addcmds(struct adreno_ringbuffer *rb,
 	return timestamp;
 }
 
+/**
+ * adreno_ringbuffer_account - charge retired batches to their contexts
+ * @rb - Ringbuffer the batches were submitted to
+ *
+ * The GPU runs one batch at a time, so a batch is charged from when it
+ * was submitted, or the previous batch retired if that was later, until
+ * it retired.  Retirement is only noticed here, so the time since the
+ * previous call is split evenly between the batches that retired in it;
+ * the more often this runs, the closer the estimate.  It runs from the
+ * retire interrupt's kgsl_timestamp_expired(), when timestamps are
+ * waited for, before each submission and on every idle check.  Caller
+ * must hold the device mutex.
+ */
+void adreno_ringbuffer_account(struct adreno_ringbuffer *rb)
+{
+	struct kgsl_device *device = rb->device;
+	struct adreno_busy_record *rec;
+	unsigned int retired, i, n;
+	ktime_t now, start;
+	s64 ns;
+
+	if (rb->busy_count == 0)
+		return;
+
+	retired = device->ftbl->readtimestamp(device, KGSL_TIMESTAMP_RETIRED);
+
+	for (n = 0; n < rb->busy_count; n++) {
+		rec = &rb->busy[(rb->busy_tail + n) % ADRENO_BUSY_RECORDS];
+		if (timestamp_cmp(retired, rec->timestamp) < 0)
+			break;
+	}
+	if (n == 0)
+		return;
+
+	now = ktime_get();
+	start = rb->busy[rb->busy_tail].submitted;
+	if (ktime_to_ns(ktime_sub(rb->busy_last, start)) > 0)
+		start = rb->busy_last;
+	ns = div_s64(ktime_to_ns(ktime_sub(now, start)), n);
+
+	for (i = 0; i < n; i++) {
+		rec = &rb->busy[rb->busy_tail];
+		if (rec->context)
+			kgsl_context_add_busy(rec->context, ns);
+		rb->busy_tail = (rb->busy_tail + 1) % ADRENO_BUSY_RECORDS;
+	}
+	rb->busy_count -= n;
+	rb->busy_last = now;
+}
+
+/* Stop charging batches of a context that is being destroyed */
+void adreno_ringbuffer_forget_context(struct adreno_ringbuffer *rb,
+				      struct kgsl_context *context)
+{
+	unsigned int i;
+
+	for (i = 0; i < rb->busy_count; i++) {
+		struct adreno_busy_record *rec =
+			&rb->busy[(rb->busy_tail + i) % ADRENO_BUSY_RECORDS];
+
+		if (rec->context == context)
+			rec->context = NULL;
+	}
+}
+
+static void adreno_ringbuffer_add_busy(struct adreno_ringbuffer *rb,
+				       struct kgsl_context *context,
+				       unsigned int timestamp)
+{
+	struct adreno_busy_record *rec;
+
+	adreno_ringbuffer_account(rb);
+
+	/* Out of records, the oldest batch goes unaccounted */
+	if (rb->busy_count == ADRENO_BUSY_RECORDS) {
+		rb->busy_tail = (rb->busy_tail + 1) % ADRENO_BUSY_RECORDS;
+		rb->busy_count--;
+	}
+
+	rec = &rb->busy[(rb->busy_tail + rb->busy_count) % ADRENO_BUSY_RECORDS];
+	rec->context = context;
+	rec->timestamp = timestamp;
+	rec->submitted = ktime_get();
+	rb->busy_count++;
+}
+
 void
 adreno_ringbuffer_issuecmds(struct kgsl_device *device,
 						unsigned int flags,
@@ -607,9 +704,17 @@ adreno_ringbuffer_issueibcmds(struct kgsl_device_private *dev_priv,
 		*cmds++ = ibdesc[i].sizedwords;
 	}
 
-	kgsl_setstate(device,
-		      kgsl_mmu_pt_get_flags(device->mmu.hwpagetable,
-					device->id));
+	/*
+	 * A flush pending for the current pagetable is only needed if it
+	 * stays current; switching to the context's pagetable flushes the
+	 * TLB anyway, and the old pagetable keeps its flag until it is
+	 * switched back to.
+	 */
+	if (adreno_dev->drawctxt_active == drawctxt ||
+	    device->mmu.hwpagetable == drawctxt->pagetable)
+		kgsl_setstate(device,
+			      kgsl_mmu_pt_get_flags(device->mmu.hwpagetable,
+						device->id));
 
 	adreno_drawctxt_switch(adreno_dev, drawctxt, flags);
 
@@ -617,6 +722,9 @@ adreno_ringbuffer_issueibcmds(struct kgsl_device_private *dev_priv,
 					KGSL_CMD_FLAGS_NOT_KERNEL_CMD,
 					&link[0], (cmds - link));
 
+	adreno_ringbuffer_add_busy(&adreno_dev->ringbuffer, context,
+				   *timestamp);
+
 	KGSL_CMD_INFO(device, "ctxt %d g %08x numibs %d ts %d\n",
 		context->id, (unsigned int)ibdesc, numibs, *timestamp);
 
@@ -44,6 +44,16 @@ struct kgsl_rbmemptrs {
 #define GSL_RB_MEMPTRS_WPTRPOLL_OFFSET \
 	(offsetof(struct kgsl_rbmemptrs, wptr_poll))
 
+/* Number of submitted command batches tracked for GPU busy accounting */
+#define ADRENO_BUSY_RECORDS	128
+
+/* A command batch submitted to the ringbuffer that has not retired yet */
+struct adreno_busy_record {
+	struct kgsl_context *context;
+	unsigned int timestamp;
+	ktime_t submitted;
+};
+
 struct adreno_ringbuffer {
 	struct kgsl_device *device;
 	uint32_t flags;
@@ -59,6 +69,12 @@ struct adreno_ringbuffer {
 	unsigned int wptr; /* write pointer offset in dwords from baseaddr */
 	unsigned int rptr; /* read pointer offset in dwords from baseaddr */
 	uint32_t timestamp;
+
+	/* in flight batches, oldest at busy_tail */
+	struct adreno_busy_record busy[ADRENO_BUSY_RECORDS];
+	unsigned int busy_tail;
+	unsigned int busy_count;
+	ktime_t busy_last;	/* when the last accounted batch retired */
 };
 
 
@@ -126,6 +142,11 @@ void adreno_ringbuffer_issuecmds(struct kgsl_device *device,
 					unsigned int *cmdaddr,
 					int sizedwords);
 
+void adreno_ringbuffer_account(struct adreno_ringbuffer *rb);
+
+void adreno_ringbuffer_forget_context(struct adreno_ringbuffer *rb,
+				      struct kgsl_context *context);
+
 void kgsl_cp_intrcallback(struct kgsl_device *device);
 
 int adreno_ringbuffer_extract(struct adreno_ringbuffer *rb,
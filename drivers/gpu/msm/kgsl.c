@@ -32,6 +32,7 @@
 #include "kgsl_cffdump.h"
 #include "kgsl_log.h"
 #include "kgsl_sharedmem.h"
+#include "kgsl_pool.h"
 #include "kgsl_device.h"
 #include "kgsl_trace.h"
 
@@ -212,16 +213,87 @@ kgsl_mem_entry_destroy(struct kref *kref)
 }
 EXPORT_SYMBOL(kgsl_mem_entry_destroy);
 
-static
-void kgsl_mem_entry_attach_process(struct kgsl_mem_entry *entry,
-				   struct kgsl_process_private *process)
+/* call with process->mem_lock locked */
+static void _kgsl_mem_entry_insert(struct kgsl_process_private *process,
+				   struct kgsl_mem_entry *entry)
 {
-	spin_lock(&process->mem_lock);
-	list_add(&entry->list, &process->mem_list);
-	spin_unlock(&process->mem_lock);
+	struct rb_node **node = &process->mem_rb.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*node) {
+		struct kgsl_mem_entry *cur;
+
+		parent = *node;
+		cur = rb_entry(parent, struct kgsl_mem_entry, node);
+
+		if (entry->memdesc.gpuaddr < cur->memdesc.gpuaddr)
+			node = &parent->rb_left;
+		else
+			node = &parent->rb_right;
+	}
+
+	rb_link_node(&entry->node, parent, node);
+	rb_insert_color(&entry->node, &process->mem_rb);
+}
+
+/*
+ * kgsl_mem_entry_attach_process - make an entry visible to a process
+ * @entry: the entry, which must already be mapped to its GPU address
+ * @process: the process that owns it
+ *
+ * Gives the entry an id and adds it to the process' lookup tree.
+ */
+int kgsl_mem_entry_attach_process(struct kgsl_mem_entry *entry,
+				  struct kgsl_process_private *process)
+{
+	int id, ret;
 
 	entry->priv = process;
+
+	do {
+		if (idr_pre_get(&process->mem_idr, GFP_KERNEL) == 0)
+			return -ENOMEM;
+
+		spin_lock(&process->mem_lock);
+		ret = idr_get_new_above(&process->mem_idr, entry, 1, &id);
+		if (ret == 0) {
+			entry->id = id;
+			_kgsl_mem_entry_insert(process, entry);
+		}
+		spin_unlock(&process->mem_lock);
+	} while (ret == -EAGAIN);
+
+	return ret;
+}
+EXPORT_SYMBOL(kgsl_mem_entry_attach_process);
+
+/* call with entry->priv->mem_lock locked */
+static void _kgsl_mem_entry_detach(struct kgsl_mem_entry *entry)
+{
+	struct kgsl_process_private *process = entry->priv;
+
+	if (entry->id == 0)
+		return;
+
+	rb_erase(&entry->node, &process->mem_rb);
+	idr_remove(&process->mem_idr, entry->id);
+	entry->id = 0;
+}
+
+/*
+ * kgsl_mem_entry_detach_process - remove an entry from its process
+ *
+ * Lookups no longer find the entry; the caller still holds its reference.
+ */
+void kgsl_mem_entry_detach_process(struct kgsl_mem_entry *entry)
+{
+	struct kgsl_process_private *process = entry->priv;
+
+	spin_lock(&process->mem_lock);
+	_kgsl_mem_entry_detach(entry);
+	spin_unlock(&process->mem_lock);
 }
+EXPORT_SYMBOL(kgsl_mem_entry_detach_process);
 
 /* Allocate a new context id */
 
@@ -258,6 +330,11 @@ kgsl_create_context(struct kgsl_device_private *dev_priv)
 	context->id = id;
 	context->dev_priv = dev_priv;
 
+	spin_lock(&dev_priv->process_priv->mem_lock);
+	list_add_tail(&context->proc_node,
+		      &dev_priv->process_priv->context_list);
+	spin_unlock(&dev_priv->process_priv->mem_lock);
+
 	return context;
 }
 
@@ -273,6 +350,10 @@ kgsl_destroy_context(struct kgsl_device_private *dev_priv,
 	/* Fire a bug if the devctxt hasn't been freed */
 	BUG_ON(context->devctxt);
 
+	spin_lock(&context->dev_priv->process_priv->mem_lock);
+	list_del(&context->proc_node);
+	spin_unlock(&context->dev_priv->process_priv->mem_lock);
+
 	id = context->id;
 	kfree(context);
 
@@ -288,6 +369,9 @@ static void kgsl_timestamp_expired(struct work_struct *work)
 
 	mutex_lock(&device->mutex);
 
+	if (device->ftbl->timestamp_expired)
+		device->ftbl->timestamp_expired(device);
+
 	/* get current EOP timestamp */
 	ts_processed = device->ftbl->readtimestamp(device,
 		KGSL_TIMESTAMP_RETIRED);
@@ -583,7 +667,9 @@ kgsl_get_process_private(struct kgsl_device_private *cur_dev_priv)
 	private->refcnt = 1;
 	private->pid = task_tgid_nr(current);
 
-	INIT_LIST_HEAD(&private->mem_list);
+	private->mem_rb = RB_ROOT;
+	idr_init(&private->mem_idr);
+	INIT_LIST_HEAD(&private->context_list);
 
 	if (kgsl_mmu_enabled())
 	{
@@ -592,6 +678,7 @@ kgsl_get_process_private(struct kgsl_device_private *cur_dev_priv)
 		pt_name = task_tgid_nr(current);
 		private->pagetable = kgsl_mmu_getpagetable(pt_name);
 		if (private->pagetable == NULL) {
+			idr_destroy(&private->mem_idr);
 			kfree(private);
 			private = NULL;
 			goto out;
@@ -612,7 +699,7 @@ kgsl_put_process_private(struct kgsl_device *device,
 			 struct kgsl_process_private *private)
 {
 	struct kgsl_mem_entry *entry = NULL;
-	struct kgsl_mem_entry *entry_tmp = NULL;
+	struct rb_node *node;
 
 	if (!private)
 		return;
@@ -626,10 +713,12 @@ kgsl_put_process_private(struct kgsl_device *device,
 
 	list_del(&private->list);
 
-	list_for_each_entry_safe(entry, entry_tmp, &private->mem_list, list) {
-		list_del(&entry->list);
+	while ((node = rb_first(&private->mem_rb)) != NULL) {
+		entry = rb_entry(node, struct kgsl_mem_entry, node);
+		kgsl_mem_entry_detach_process(entry);
 		kgsl_mem_entry_put(entry);
 	}
+	idr_destroy(&private->mem_idr);
 
 	kgsl_mmu_putpagetable(private->pagetable);
 	kfree(private);
@@ -758,44 +847,60 @@ err_pmruntime:
 
 
 /*call with private->mem_lock locked */
-static struct kgsl_mem_entry *
-kgsl_sharedmem_find(struct kgsl_process_private *private, unsigned int gpuaddr)
+struct kgsl_mem_entry *
+kgsl_sharedmem_find_region(struct kgsl_process_private *private,
+				unsigned int gpuaddr,
+				size_t size)
 {
-	struct kgsl_mem_entry *entry = NULL, *result = NULL;
+	struct rb_node *node;
 
 	BUG_ON(private == NULL);
 
-	gpuaddr &= PAGE_MASK;
+	/* Entries of a process never overlap, so one path down the tree
+	 * reaches the only entry that can contain the region */
+	node = private->mem_rb.rb_node;
+	while (node != NULL) {
+		struct kgsl_mem_entry *entry;
 
-	list_for_each_entry(entry, &private->mem_list, list) {
-		if (entry->memdesc.gpuaddr == gpuaddr) {
-			result = entry;
-			break;
-		}
+		entry = rb_entry(node, struct kgsl_mem_entry, node);
+
+		if (kgsl_gpuaddr_in_memdesc(&entry->memdesc, gpuaddr, size))
+			return entry;
+
+		if (gpuaddr < entry->memdesc.gpuaddr)
+			node = node->rb_left;
+		else
+			node = node->rb_right;
 	}
-	return result;
+
+	return NULL;
 }
+EXPORT_SYMBOL(kgsl_sharedmem_find_region);
 
 /*call with private->mem_lock locked */
-struct kgsl_mem_entry *
-kgsl_sharedmem_find_region(struct kgsl_process_private *private,
-				unsigned int gpuaddr,
-				size_t size)
+static struct kgsl_mem_entry *
+kgsl_sharedmem_find(struct kgsl_process_private *private, unsigned int gpuaddr)
 {
-	struct kgsl_mem_entry *entry = NULL, *result = NULL;
+	struct kgsl_mem_entry *entry;
 
-	BUG_ON(private == NULL);
+	gpuaddr &= PAGE_MASK;
 
-	list_for_each_entry(entry, &private->mem_list, list) {
-		if (kgsl_gpuaddr_in_memdesc(&entry->memdesc, gpuaddr, size)) {
-			result = entry;
-			break;
-		}
-	}
+	entry = kgsl_sharedmem_find_region(private, gpuaddr, 1);
+	if (entry && entry->memdesc.gpuaddr != gpuaddr)
+		entry = NULL;
 
-	return result;
+	return entry;
 }
-EXPORT_SYMBOL(kgsl_sharedmem_find_region);
+
+/*call with private->mem_lock locked */
+struct kgsl_mem_entry *
+kgsl_sharedmem_find_id(struct kgsl_process_private *private, unsigned int id)
+{
+	BUG_ON(private == NULL);
+
+	return idr_find(&private->mem_idr, id);
+}
+EXPORT_SYMBOL(kgsl_sharedmem_find_id);
 
 /*call all ioctl sub functions with driver locked*/
 static long kgsl_ioctl_device_getproperty(struct kgsl_device_private *dev_priv,
@@ -1055,9 +1160,7 @@ static void kgsl_freemem_event_cb(struct kgsl_device *device,
 	void *priv, u32 timestamp)
 {
 	struct kgsl_mem_entry *entry = priv;
-	spin_lock(&entry->priv->mem_lock);
-	list_del(&entry->list);
-	spin_unlock(&entry->priv->mem_lock);
+	kgsl_mem_entry_detach_process(entry);
 	kgsl_mem_entry_put(entry);
 }
 
@@ -1148,7 +1251,7 @@ static long kgsl_ioctl_sharedmem_free(struct kgsl_device_private *dev_priv,
 	spin_lock(&private->mem_lock);
 	entry = kgsl_sharedmem_find(private, param->gpuaddr);
 	if (entry)
-		list_del(&entry->list);
+		_kgsl_mem_entry_detach(entry);
 	spin_unlock(&private->mem_lock);
 
 	if (entry) {
@@ -1250,7 +1353,9 @@ kgsl_ioctl_sharedmem_from_vmalloc(struct kgsl_device_private *dev_priv,
 
 	entry->memtype = KGSL_MEM_ENTRY_KERNEL;
 
-	kgsl_mem_entry_attach_process(entry, private);
+	result = kgsl_mem_entry_attach_process(entry, private);
+	if (result)
+		goto error_free_vmalloc;
 
 	/* Process specific statistics */
 	kgsl_process_add_stats(private, entry->memtype, len);
@@ -1677,6 +1782,10 @@ static long kgsl_ioctl_map_user_mem(struct kgsl_device_private *dev_priv,
 	if (result)
 		goto error_put_file_ptr;
 
+	result = kgsl_mem_entry_attach_process(entry, private);
+	if (result)
+		goto error_unmap;
+
 	/* Adjust the returned value for a non 4k aligned offset */
 	param->gpuaddr = entry->memdesc.gpuaddr + (param->offset & ~PAGE_MASK);
 
@@ -1685,11 +1794,12 @@ static long kgsl_ioctl_map_user_mem(struct kgsl_device_private *dev_priv,
 
 	kgsl_process_add_stats(private, entry->memtype, param->len);
 
-	kgsl_mem_entry_attach_process(entry, private);
-
 	kgsl_check_idle(dev_priv->device);
 	return result;
 
+error_unmap:
+	kgsl_mmu_unmap(private->pagetable, &entry->memdesc);
+
 error_put_file_ptr:
 	if (memtype == KGSL_USER_MEM_TYPE_ION) {
 		ion_free(kgsl_ion_client, entry->priv_data);
@@ -1750,18 +1860,27 @@ kgsl_ioctl_gpumem_alloc(struct kgsl_device_private *dev_priv,
 
 	result = kgsl_allocate_user(&entry->memdesc, private->pagetable,
 		param->size, param->flags);
-
-	if (result == 0) {
-		entry->memtype = KGSL_MEM_ENTRY_KERNEL;
-		kgsl_mem_entry_attach_process(entry, private);
-		param->gpuaddr = entry->memdesc.gpuaddr;
-
-		kgsl_process_add_stats(private, entry->memtype, param->size);
-	} else {
+	if (result) {
 		KGSL_CORE_ERR("[%s] kgsl_allocate_user, result:%d\n", __func__, result);
-		kfree(entry);
+		goto err;
 	}
 
+	entry->memtype = KGSL_MEM_ENTRY_KERNEL;
+	result = kgsl_mem_entry_attach_process(entry, private);
+	if (result)
+		goto err_free;
+
+	param->gpuaddr = entry->memdesc.gpuaddr;
+
+	kgsl_process_add_stats(private, entry->memtype, param->size);
+
+	kgsl_check_idle(dev_priv->device);
+	return 0;
+
+err_free:
+	kgsl_sharedmem_free(&entry->memdesc);
+err:
+	kfree(entry);
 	kgsl_check_idle(dev_priv->device);
 	return result;
 }
@@ -2104,7 +2223,7 @@ static int kgsl_mmap(struct file *file, struct vm_area_struct *vma)
 	unsigned long vma_offset = vma->vm_pgoff << PAGE_SHIFT;
 	struct kgsl_device_private *dev_priv = file->private_data;
 	struct kgsl_process_private *private = dev_priv->process_priv;
-	struct kgsl_mem_entry *tmp, *entry = NULL;
+	struct kgsl_mem_entry *entry = NULL;
 	struct kgsl_device *device = dev_priv->device;
 
 	/* Handle leagacy behavior for memstore */
@@ -2115,13 +2234,9 @@ static int kgsl_mmap(struct file *file, struct vm_area_struct *vma)
 	/* Find a chunk of GPU memory */
 
 	spin_lock(&private->mem_lock);
-	list_for_each_entry(tmp, &private->mem_list, list) {
-		if (vma_offset == tmp->memdesc.gpuaddr) {
-			kgsl_mem_entry_get(tmp);
-			entry = tmp;
-			break;
-		}
-	}
+	entry = kgsl_sharedmem_find(private, vma_offset);
+	if (entry)
+		kgsl_mem_entry_get(entry);
 	spin_unlock(&private->mem_lock);
 
 	if (entry == NULL)
@@ -2440,6 +2555,7 @@ static void kgsl_core_exit(void)
 	kgsl_drm_exit();
 	kgsl_cffdump_destroy();
 	kgsl_core_debugfs_close();
+	kgsl_pool_exit();
 	kgsl_sharedmem_uninit_sysfs();
 }
 
@@ -2497,6 +2613,7 @@ static int __init kgsl_core_init(void)
 	kgsl_core_debugfs_init();
 
 	kgsl_sharedmem_init_sysfs();
+	kgsl_pool_init();
 	kgsl_cffdump_init();
 
 	INIT_LIST_HEAD(&kgsl_driver.process_list);
@@ -22,6 +22,7 @@
 #include <linux/cdev.h>
 #include <linux/regulator/consumer.h>
 #include <linux/mm.h>
+#include <linux/rbtree.h>
 
 #define KGSL_NAME "kgsl"
 
@@ -143,7 +144,10 @@ struct kgsl_mem_entry {
 	struct kgsl_memdesc memdesc;
 	int memtype;
 	void *priv_data;
-	struct list_head list;
+	/* node in the owning process' mem_rb, keyed by memdesc.gpuaddr */
+	struct rb_node node;
+	/* handle in the owning process' mem_idr */
+	unsigned int id;
 	uint32_t free_timestamp;
 	/* back pointer to private structure under whose context this
 	* allocation is made */
@@ -160,6 +164,11 @@ void kgsl_mem_entry_destroy(struct kref *kref);
 struct kgsl_mem_entry *kgsl_sharedmem_find_region(
 	struct kgsl_process_private *private, unsigned int gpuaddr,
 	size_t size);
+struct kgsl_mem_entry *kgsl_sharedmem_find_id(
+	struct kgsl_process_private *private, unsigned int id);
+int kgsl_mem_entry_attach_process(struct kgsl_mem_entry *entry,
+				  struct kgsl_process_private *process);
+void kgsl_mem_entry_detach_process(struct kgsl_mem_entry *entry);
 
 extern const struct dev_pm_ops kgsl_pm_ops;
 
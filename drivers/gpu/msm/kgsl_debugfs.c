@@ -12,6 +12,10 @@
  */
 
 #include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
 
 #include "kgsl.h"
 #include "kgsl_device.h"
@@ -74,11 +78,172 @@ void kgsl_device_debugfs_init(struct kgsl_device *device)
 				&mem_log_fops);
 	debugfs_create_file("log_level_pwr", 0644, device->d_debugfs, device,
 				&pwr_log_fops);
+
+	debugfs_create_u32("mmu_pt_switches", 0444, device->d_debugfs,
+			   &device->mmu.stats.pt_switches);
+	debugfs_create_u32("mmu_tlb_flushes", 0444, device->d_debugfs,
+			   &device->mmu.stats.tlb_flushes);
+	debugfs_create_u32("mmu_tlb_flushes_deferred", 0444,
+			   device->d_debugfs,
+			   &device->mmu.stats.tlb_flushes_deferred);
+}
+
+/*
+ * Memory entry lookup benchmark.  Reading mem_lookup_bench fills a dummy
+ * process with entries and reports the average cost of looking one up by
+ * GPU address, by id, and by walking all entries in address order the
+ * way the lookups used to.
+ */
+
+#define KGSL_BENCH_LOOKUPS	4096
+#define KGSL_BENCH_BASE		0x10000000
+#define KGSL_BENCH_STRIDE	(4 * PAGE_SIZE)
+
+static const int kgsl_bench_counts[] = { 16, 256, 1024, 4096 };
+
+static struct kgsl_mem_entry *
+kgsl_bench_find_linear(struct kgsl_process_private *private,
+		       unsigned int gpuaddr, size_t size)
+{
+	struct rb_node *node;
+
+	for (node = rb_first(&private->mem_rb); node; node = rb_next(node)) {
+		struct kgsl_mem_entry *entry;
+
+		entry = rb_entry(node, struct kgsl_mem_entry, node);
+		if (kgsl_gpuaddr_in_memdesc(&entry->memdesc, gpuaddr, size))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static int kgsl_mem_lookup_bench_run(struct seq_file *s, int count)
+{
+	struct kgsl_process_private *private;
+	struct kgsl_mem_entry **entries;
+	struct kgsl_mem_entry *entry;
+	s64 tree_ns = 0, id_ns = 0, linear_ns = 0;
+	ktime_t start;
+	int i, ret = 0, errors = 0;
+
+	private = kzalloc(sizeof(*private), GFP_KERNEL);
+	entries = vzalloc(count * sizeof(*entries));
+	if (private == NULL || entries == NULL) {
+		ret = -ENOMEM;
+		goto done;
+	}
+
+	spin_lock_init(&private->mem_lock);
+	private->mem_rb = RB_ROOT;
+	idr_init(&private->mem_idr);
+
+	/* Attach in a scrambled order so the tree sees unsorted inserts */
+	for (i = 0; i < count; i++) {
+		int slot = (i * 7919) % count;
+
+		entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+		if (entry == NULL) {
+			ret = -ENOMEM;
+			goto done;
+		}
+		entry->memdesc.gpuaddr = KGSL_BENCH_BASE +
+			slot * KGSL_BENCH_STRIDE;
+		entry->memdesc.size = KGSL_BENCH_STRIDE - PAGE_SIZE;
+		entries[i] = entry;
+
+		ret = kgsl_mem_entry_attach_process(entry, private);
+		if (ret) {
+			kfree(entry);
+			entries[i] = NULL;
+			goto done;
+		}
+	}
+
+	for (i = 0; i < KGSL_BENCH_LOOKUPS; i++) {
+		struct kgsl_mem_entry *want = entries[(i * 4099) % count];
+		unsigned int gpuaddr = want->memdesc.gpuaddr + PAGE_SIZE;
+
+		start = ktime_get();
+		spin_lock(&private->mem_lock);
+		entry = kgsl_sharedmem_find_region(private, gpuaddr, 4);
+		spin_unlock(&private->mem_lock);
+		tree_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		errors += (entry != want);
+
+		start = ktime_get();
+		spin_lock(&private->mem_lock);
+		entry = kgsl_sharedmem_find_id(private, want->id);
+		spin_unlock(&private->mem_lock);
+		id_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		errors += (entry != want);
+
+		start = ktime_get();
+		spin_lock(&private->mem_lock);
+		entry = kgsl_bench_find_linear(private, gpuaddr, 4);
+		spin_unlock(&private->mem_lock);
+		linear_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		errors += (entry != want);
+	}
+
+	seq_printf(s, "%5d entries: addr %lld ns, id %lld ns, linear %lld ns",
+		   count, div_s64(tree_ns, KGSL_BENCH_LOOKUPS),
+		   div_s64(id_ns, KGSL_BENCH_LOOKUPS),
+		   div_s64(linear_ns, KGSL_BENCH_LOOKUPS));
+	if (errors)
+		seq_printf(s, " (%d wrong results)", errors);
+	seq_printf(s, "\n");
+
+done:
+	if (entries) {
+		for (i = 0; i < count; i++) {
+			if (entries[i] == NULL)
+				continue;
+			kgsl_mem_entry_detach_process(entries[i]);
+			kfree(entries[i]);
+		}
+		vfree(entries);
+	}
+	if (private)
+		idr_destroy(&private->mem_idr);
+	kfree(private);
+
+	return ret;
 }
 
+static int kgsl_mem_lookup_bench_show(struct seq_file *s, void *unused)
+{
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_bench_counts); i++) {
+		ret = kgsl_mem_lookup_bench_run(s, kgsl_bench_counts[i]);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int kgsl_mem_lookup_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, kgsl_mem_lookup_bench_show, NULL);
+}
+
+static const struct file_operations kgsl_mem_lookup_bench_fops = {
+	.open = kgsl_mem_lookup_bench_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 void kgsl_core_debugfs_init(void)
 {
 	kgsl_debugfs_dir = debugfs_create_dir("kgsl", 0);
+
+	if (kgsl_debugfs_dir && !IS_ERR(kgsl_debugfs_dir))
+		debugfs_create_file("mem_lookup_bench", 0400,
+				    kgsl_debugfs_dir, NULL,
+				    &kgsl_mem_lookup_bench_fops);
 }
 
 void kgsl_core_debugfs_close(void)
@@ -104,6 +104,8 @@ struct kgsl_functable {
 		struct kgsl_context *context);
 	long (*ioctl) (struct kgsl_device_private *dev_priv,
 		unsigned int cmd, void *data);
+	/* Called with the device mutex held when timestamps retire */
+	void (*timestamp_expired) (struct kgsl_device *device);
 };
 
 struct kgsl_memregion {
@@ -213,17 +215,29 @@ struct kgsl_context {
 	 * context was responsible for causing it
 	 */
 	unsigned int reset_status;
+
+	/* Node in the owning process' context_list */
+	struct list_head proc_node;
+	/* GPU time (ns) and command batches retired for this context */
+	u64 gpu_busy;
+	unsigned int gpu_batches;
 };
 
 struct kgsl_process_private {
 	unsigned int refcnt;
 	pid_t pid;
+	/* protects mem_rb, mem_idr, context_list and the GPU busy totals */
 	spinlock_t mem_lock;
-	struct list_head mem_list;
+	struct rb_root mem_rb;
+	struct idr mem_idr;
 	struct kgsl_pagetable *pagetable;
 	struct list_head list;
 	struct kobject kobj;
 
+	struct list_head context_list;
+	/* GPU time (ns) of all contexts, including destroyed ones */
+	u64 gpu_busy;
+
 	struct {
 		unsigned int cur;
 		unsigned int max;
@@ -242,6 +256,19 @@ struct kgsl_power_stats {
 
 struct kgsl_device *kgsl_get_device(int dev_idx);
 
+/* Charge GPU time of a retired command batch to its context and process */
+static inline void kgsl_context_add_busy(struct kgsl_context *context,
+					 s64 ns)
+{
+	struct kgsl_process_private *private = context->dev_priv->process_priv;
+
+	spin_lock(&private->mem_lock);
+	context->gpu_busy += ns;
+	context->gpu_batches++;
+	private->gpu_busy += ns;
+	spin_unlock(&private->mem_lock);
+}
+
 static inline void kgsl_process_add_stats(struct kgsl_process_private *priv,
 	unsigned int type, size_t size)
 {
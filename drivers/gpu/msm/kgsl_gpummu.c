@@ -260,7 +260,8 @@ static inline void _kgsl_ptpool_rm_chunk(struct kgsl_ptpool_chunk *chunk)
  * @pool:  A pointer to a ptpool structure
  * @addr: A pointer to the virtual address to free
  *
- * Free a pagetable allocated from the pool
+ * Free a pagetable allocated from the pool.  The caller must have
+ * cleared all the entries it wrote.
  */
 
 static void kgsl_ptpool_free(struct kgsl_ptpool *pool, void *addr)
@@ -278,7 +279,6 @@ static void kgsl_ptpool_free(struct kgsl_ptpool *pool, void *addr)
 				pool->ptsize;
 
 			clear_bit(bit, chunk->bitmap);
-			memset(addr, 0, pool->ptsize);
 
 			if (chunk->dynamic &&
 				bitmap_empty(chunk->bitmap, chunk->count))
@@ -362,6 +362,15 @@ void kgsl_gpummu_destroy_pagetable(void *mmu_specific_pt)
 {
 	struct kgsl_gpummu_pt *gpummu_pt = (struct kgsl_gpummu_pt *)
 						mmu_specific_pt;
+
+	/* Only clear the entries that were used, most processes map a
+	   small part of the address space */
+	if (gpummu_pt->pte_end > gpummu_pt->pte_start)
+		memset((uint32_t *)gpummu_pt->base.hostptr +
+			gpummu_pt->pte_start, 0,
+			(gpummu_pt->pte_end - gpummu_pt->pte_start) *
+			sizeof(uint32_t));
+
 	kgsl_ptpool_free((struct kgsl_ptpool *)kgsl_driver.ptpool,
 				gpummu_pt->base.hostptr);
 
@@ -405,7 +414,7 @@ static unsigned int kgsl_gpummu_pt_get_flags(struct kgsl_pagetable *pt,
 	gpummu_pt = pt->priv;
 
 	spin_lock(&pt->lock);
-	if (gpummu_pt->tlb_flags && (1<<id)) {
+	if (gpummu_pt->tlb_flags & (1<<id)) {
 		result = KGSL_MMUFLAGS_TLBFLUSH;
 		gpummu_pt->tlb_flags &= ~(1<<id);
 	}
@@ -439,6 +448,8 @@ static void *kgsl_gpummu_create_pagetable(void)
 
 	gpummu_pt->tlb_flags = 0;
 	gpummu_pt->last_superpte = 0;
+	gpummu_pt->pte_start = UINT_MAX;
+	gpummu_pt->pte_end = 0;
 
 	gpummu_pt->tlbflushfilter.size = (CONFIG_MSM_KGSL_PAGE_TABLE_SIZE /
 				(PAGE_SIZE * GSL_PT_SUPER_PTE * 8)) + 1;
@@ -508,6 +519,14 @@ static void kgsl_gpummu_setstate(struct kgsl_device *device,
 		 *  specified page table
 		 */
 		if (mmu->hwpagetable != pagetable) {
+			/* A flush still pending for the old pagetable is
+			 * left for when it is switched back to */
+			if (mmu->hwpagetable) {
+				gpummu_pt = mmu->hwpagetable->priv;
+				if (gpummu_pt->tlb_flags & (1<<device->id))
+					mmu->stats.tlb_flushes_deferred++;
+			}
+
 			mmu->hwpagetable = pagetable;
 			spin_lock(&mmu->hwpagetable->lock);
 			gpummu_pt = mmu->hwpagetable->priv;
@@ -677,6 +696,9 @@ kgsl_gpummu_map(void *mmu_specific_pt,
 
 	pte = kgsl_pt_entry_get(KGSL_PAGETABLE_BASE, memdesc->gpuaddr);
 
+	if (pte < gpummu_pt->pte_start)
+		gpummu_pt->pte_start = pte;
+
 	/* Flush the TLB if the first PTE isn't at the superpte boundary */
 	if (pte & (GSL_PT_SUPER_PTE - 1))
 		flushtlb = 1;
@@ -693,6 +715,9 @@ kgsl_gpummu_map(void *mmu_specific_pt,
 		}
 	}
 
+	if (pte > gpummu_pt->pte_end)
+		gpummu_pt->pte_end = pte;
+
 	/* Flush the TLB if the last PTE isn't at the superpte boundary */
 	if ((pte + 1) & (GSL_PT_SUPER_PTE - 1))
 		flushtlb = 1;
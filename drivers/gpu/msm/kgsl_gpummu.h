@@ -48,6 +48,9 @@ struct kgsl_gpummu_pt {
 	struct kgsl_memdesc  base;
 	unsigned int   last_superpte;
 	unsigned int tlb_flags;
+	/* Range of PTEs ever written, [pte_start, pte_end) */
+	unsigned int pte_start;
+	unsigned int pte_end;
 	/* Maintain filter to manage tlb flushing */
 	struct kgsl_tlbflushfilter tlbflushfilter;
 };
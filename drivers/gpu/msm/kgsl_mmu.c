@@ -303,9 +303,11 @@ void kgsl_mmu_setstate(struct kgsl_device *device,
 
 	if (KGSL_MMU_TYPE_NONE == kgsl_mmu_type)
 		return;
-	else
-		mmu->mmu_ops->mmu_setstate(device,
-					pagetable);
+
+	if ((mmu->flags & KGSL_FLAGS_STARTED) && mmu->hwpagetable != pagetable)
+		mmu->stats.pt_switches++;
+
+	mmu->mmu_ops->mmu_setstate(device, pagetable);
 }
 EXPORT_SYMBOL(kgsl_mmu_setstate);
 
@@ -482,7 +484,11 @@ void kgsl_setstate(struct kgsl_device *device, uint32_t flags)
 	struct kgsl_mmu *mmu = &device->mmu;
 	if (KGSL_MMU_TYPE_NONE == kgsl_mmu_type)
 		return;
-	else if (device->ftbl->setstate)
+
+	if (flags & KGSL_MMUFLAGS_TLBFLUSH)
+		mmu->stats.tlb_flushes++;
+
+	if (device->ftbl->setstate)
 		device->ftbl->setstate(device, flags);
 	else if (mmu->mmu_ops->mmu_device_setstate)
 		mmu->mmu_ops->mmu_device_setstate(device, flags);
@@ -145,6 +145,14 @@ struct kgsl_mmu {
 	struct kgsl_pagetable  *hwpagetable;
 	const struct kgsl_mmu_ops *mmu_ops;
 	void *priv;
+	struct {
+		/* pagetable switches done by kgsl_mmu_setstate() */
+		unsigned int pt_switches;
+		/* TLB invalidations requested through kgsl_setstate() */
+		unsigned int tlb_flushes;
+		/* pending TLB flushes left to a pagetable switch */
+		unsigned int tlb_flushes_deferred;
+	} stats;
 };
 
 #include "kgsl_gpummu.h"
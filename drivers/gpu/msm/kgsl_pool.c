@@ -0,0 +1,279 @@
+/* Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#include <linux/highmem.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+#include "kgsl.h"
+#include "kgsl_device.h"
+#include "kgsl_pool.h"
+
+/*
+ * Pool of pages freed by vmalloc memdescs.  Freed pages are queued on the
+ * dirty list and zeroed by a background worker, which moves them to the
+ * clean list for kgsl_pool_alloc_page() to hand out.  This keeps both the
+ * zeroing of new allocations and the release of old ones out of the
+ * ioctl path.  Pages are linked through page->lru, which is unused while
+ * the pool owns them.
+ */
+
+/* Pages kept in the pool, clean or dirty; the rest go back to the system */
+#define KGSL_POOL_MAX_PAGES 2048
+
+static struct {
+	spinlock_t lock;
+	struct list_head clean;
+	struct list_head dirty;
+	unsigned int clean_count;
+	unsigned int dirty_count;
+	unsigned int dirty_max;
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int zeroed;
+	u64 zero_ns;
+} kgsl_pool = {
+	.lock = __SPIN_LOCK_UNLOCKED(kgsl_pool.lock),
+	.clean = LIST_HEAD_INIT(kgsl_pool.clean),
+	.dirty = LIST_HEAD_INIT(kgsl_pool.dirty),
+};
+
+static struct page *_kgsl_pool_get(struct list_head *head,
+				   unsigned int *count)
+{
+	struct page *page;
+
+	page = list_first_entry(head, struct page, lru);
+	list_del(&page->lru);
+	(*count)--;
+	return page;
+}
+
+static void kgsl_pool_zero_work(struct work_struct *work)
+{
+	struct page *page;
+	ktime_t start;
+	s64 ns;
+
+	for (;;) {
+		spin_lock(&kgsl_pool.lock);
+		if (!kgsl_pool.dirty_count) {
+			spin_unlock(&kgsl_pool.lock);
+			break;
+		}
+		page = _kgsl_pool_get(&kgsl_pool.dirty,
+				      &kgsl_pool.dirty_count);
+		spin_unlock(&kgsl_pool.lock);
+
+		start = ktime_get();
+		clear_highpage(page);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		spin_lock(&kgsl_pool.lock);
+		list_add_tail(&page->lru, &kgsl_pool.clean);
+		kgsl_pool.clean_count++;
+		kgsl_pool.zeroed++;
+		kgsl_pool.zero_ns += ns;
+		spin_unlock(&kgsl_pool.lock);
+
+		cond_resched();
+	}
+}
+
+static DECLARE_WORK(kgsl_pool_work, kgsl_pool_zero_work);
+
+/**
+ * kgsl_pool_alloc_page - get a zeroed page for a vmalloc memdesc
+ *
+ * Returns a page zeroed by the pool's worker if there is one.  A page
+ * still queued for zeroing is cleared here, and when the pool is empty the
+ * page comes from the page allocator.  The caller still owns the cache
+ * maintenance of the page.
+ */
+struct page *kgsl_pool_alloc_page(void)
+{
+	struct page *page = NULL;
+	bool dirty = false;
+
+	spin_lock(&kgsl_pool.lock);
+	if (kgsl_pool.clean_count) {
+		page = _kgsl_pool_get(&kgsl_pool.clean,
+				      &kgsl_pool.clean_count);
+	} else if (kgsl_pool.dirty_count) {
+		page = _kgsl_pool_get(&kgsl_pool.dirty,
+				      &kgsl_pool.dirty_count);
+		dirty = true;
+	}
+	if (page)
+		kgsl_pool.hits++;
+	else
+		kgsl_pool.misses++;
+	spin_unlock(&kgsl_pool.lock);
+
+	if (dirty)
+		clear_highpage(page);
+	else if (!page)
+		page = alloc_page(GFP_KERNEL | __GFP_ZERO | __GFP_HIGHMEM);
+
+	return page;
+}
+
+/**
+ * kgsl_pool_free_page - give a page of a vmalloc memdesc back
+ * @page: the page, which must not be in use by the GPU any more
+ *
+ * The page is queued for the worker to zero.  Pages that are still
+ * referenced elsewhere, or that do not fit in the pool, are released to
+ * the system straight away.
+ */
+void kgsl_pool_free_page(struct page *page)
+{
+	if (page_count(page) != 1)
+		goto free;
+
+	spin_lock(&kgsl_pool.lock);
+	if (kgsl_pool.clean_count + kgsl_pool.dirty_count >=
+	    KGSL_POOL_MAX_PAGES) {
+		spin_unlock(&kgsl_pool.lock);
+		goto free;
+	}
+	list_add_tail(&page->lru, &kgsl_pool.dirty);
+	kgsl_pool.dirty_count++;
+	if (kgsl_pool.dirty_count > kgsl_pool.dirty_max)
+		kgsl_pool.dirty_max = kgsl_pool.dirty_count;
+	spin_unlock(&kgsl_pool.lock);
+
+	queue_work(system_unbound_wq, &kgsl_pool_work);
+	return;
+free:
+	__free_page(page);
+}
+
+/* Release up to nr pages, those not zeroed yet first */
+static int kgsl_pool_drain(int nr)
+{
+	struct page *page;
+	int freed = 0;
+
+	while (freed < nr) {
+		spin_lock(&kgsl_pool.lock);
+		if (kgsl_pool.dirty_count)
+			page = _kgsl_pool_get(&kgsl_pool.dirty,
+					      &kgsl_pool.dirty_count);
+		else if (kgsl_pool.clean_count)
+			page = _kgsl_pool_get(&kgsl_pool.clean,
+					      &kgsl_pool.clean_count);
+		else
+			page = NULL;
+		spin_unlock(&kgsl_pool.lock);
+
+		if (page == NULL)
+			break;
+		__free_page(page);
+		freed++;
+	}
+
+	return freed;
+}
+
+static int kgsl_pool_shrink(struct shrinker *shrinker,
+			    struct shrink_control *sc)
+{
+	if (sc->nr_to_scan)
+		kgsl_pool_drain(sc->nr_to_scan);
+
+	return kgsl_pool.clean_count + kgsl_pool.dirty_count;
+}
+
+/* Initialized so that kgsl_pool_exit() is safe even if init never ran */
+static struct shrinker kgsl_pool_shrinker = {
+	.shrink = kgsl_pool_shrink,
+	.seeks = DEFAULT_SEEKS,
+	.list = LIST_HEAD_INIT(kgsl_pool_shrinker.list),
+};
+
+static ssize_t kgsl_pool_show(struct device *dev,
+			  struct device_attribute *attr,
+			  char *buf)
+{
+	unsigned int val = 0;
+
+	spin_lock(&kgsl_pool.lock);
+	if (!strncmp(attr->attr.name, "page_pool_clean", 15))
+		val = kgsl_pool.clean_count;
+	else if (!strncmp(attr->attr.name, "page_pool_dirty_max", 19))
+		val = kgsl_pool.dirty_max;
+	else if (!strncmp(attr->attr.name, "page_pool_dirty", 15))
+		val = kgsl_pool.dirty_count;
+	else if (!strncmp(attr->attr.name, "page_pool_hits", 14))
+		val = kgsl_pool.hits;
+	else if (!strncmp(attr->attr.name, "page_pool_misses", 16))
+		val = kgsl_pool.misses;
+	else if (!strncmp(attr->attr.name, "page_pool_zeroed", 16))
+		val = kgsl_pool.zeroed;
+	spin_unlock(&kgsl_pool.lock);
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", val);
+}
+
+/* Time the worker spent zeroing pages the ioctl path would have zeroed */
+static ssize_t kgsl_pool_saved_show(struct device *dev,
+				struct device_attribute *attr,
+				char *buf)
+{
+	u64 ns;
+
+	spin_lock(&kgsl_pool.lock);
+	ns = kgsl_pool.zero_ns;
+	spin_unlock(&kgsl_pool.lock);
+
+	return snprintf(buf, PAGE_SIZE, "%llu\n", div_u64(ns, NSEC_PER_USEC));
+}
+
+static DEVICE_ATTR(page_pool_clean, 0444, kgsl_pool_show, NULL);
+static DEVICE_ATTR(page_pool_dirty, 0444, kgsl_pool_show, NULL);
+static DEVICE_ATTR(page_pool_dirty_max, 0444, kgsl_pool_show, NULL);
+static DEVICE_ATTR(page_pool_hits, 0444, kgsl_pool_show, NULL);
+static DEVICE_ATTR(page_pool_misses, 0444, kgsl_pool_show, NULL);
+static DEVICE_ATTR(page_pool_zeroed, 0444, kgsl_pool_show, NULL);
+static DEVICE_ATTR(page_pool_saved_us, 0444, kgsl_pool_saved_show, NULL);
+
+static const struct device_attribute *pool_attr_list[] = {
+	&dev_attr_page_pool_clean,
+	&dev_attr_page_pool_dirty,
+	&dev_attr_page_pool_dirty_max,
+	&dev_attr_page_pool_hits,
+	&dev_attr_page_pool_misses,
+	&dev_attr_page_pool_zeroed,
+	&dev_attr_page_pool_saved_us,
+	NULL
+};
+
+int kgsl_pool_init(void)
+{
+	register_shrinker(&kgsl_pool_shrinker);
+
+	return kgsl_create_device_sysfs_files(&kgsl_driver.virtdev,
+		pool_attr_list);
+}
+
+void kgsl_pool_exit(void)
+{
+	kgsl_remove_device_sysfs_files(&kgsl_driver.virtdev, pool_attr_list);
+	unregister_shrinker(&kgsl_pool_shrinker);
+	cancel_work_sync(&kgsl_pool_work);
+	kgsl_pool_drain(INT_MAX);
+}
@@ -0,0 +1,287 @@
+/* Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+
+#include "kgsl.h"
+#include "kgsl_pwrscale.h"
+#include "kgsl_device.h"
+#include "kgsl_trace.h"
+
+/*
+ * In-kernel GPU DCVS policy
+ *
+ * Busy and total time are accumulated into samples of at least sample_ms.
+ * Each sample also records how many timestamps retired in it, which is a
+ * count of completed frames for the usual one-submission-per-frame client.
+ * The last "window" samples form a sliding window.
+ *
+ * - a single sample busier than burst_threshold jumps to the fastest
+ *   allowed level;
+ * - a window busier than up_threshold, or a busy sample that completed
+ *   fewer frames than the window average, steps one level up;
+ * - a window less busy than down_threshold for down_samples samples in a
+ *   row steps one level down.
+ *
+ * Every decision is reported through the kgsl_dcvs tracepoint.
+ */
+
+#define DCVS_MAX_WINDOW		8
+
+#define DCVS_SAMPLE_MS		20
+#define DCVS_WINDOW		4
+#define DCVS_UP_THRESHOLD	60
+#define DCVS_BURST_THRESHOLD	90
+#define DCVS_DOWN_THRESHOLD	30
+#define DCVS_DOWN_SAMPLES	5
+
+struct dcvs_sample {
+	unsigned int total;	/* us */
+	unsigned int busy;	/* us */
+	unsigned int retired;	/* timestamps retired */
+};
+
+struct dcvs_priv {
+	/* tunables */
+	unsigned int sample_ms;
+	unsigned int window;
+	unsigned int up_threshold;
+	unsigned int burst_threshold;
+	unsigned int down_threshold;
+	unsigned int down_samples;
+
+	/* sample being accumulated */
+	struct dcvs_sample cur;
+	unsigned int last_retired;
+
+	/* sliding window of completed samples */
+	struct dcvs_sample samples[DCVS_MAX_WINDOW];
+	unsigned int head;
+	unsigned int count;
+	unsigned int below;
+
+	/* level changes made */
+	unsigned int bursts;
+	unsigned int ups;
+	unsigned int downs;
+};
+
+static void dcvs_reset(struct kgsl_device *device, struct dcvs_priv *priv)
+{
+	memset(&priv->cur, 0, sizeof(priv->cur));
+	priv->head = 0;
+	priv->count = 0;
+	priv->below = 0;
+	priv->last_retired = device->ftbl->readtimestamp(device,
+						KGSL_TIMESTAMP_RETIRED);
+}
+
+static unsigned int dcvs_percent(unsigned int busy, unsigned int total)
+{
+	return total ? (unsigned int)div_u64((u64)busy * 100, total) : 0;
+}
+
+static void dcvs_idle(struct kgsl_device *device,
+		      struct kgsl_pwrscale *pwrscale)
+{
+	struct kgsl_pwrctrl *pwr = &device->pwrctrl;
+	struct dcvs_priv *priv = pwrscale->priv;
+	struct kgsl_power_stats stats;
+	struct dcvs_sample *s;
+	unsigned int *stat = NULL;
+	unsigned int retired, total = 0, busy = 0, frames = 0;
+	unsigned int sample_pct, window_pct, i;
+	int level, new_level, max_level, min_level;
+
+	device->ftbl->power_stats(device, &stats);
+	if (stats.total_time == 0)
+		return;
+
+	priv->cur.total += stats.total_time;
+	priv->cur.busy += stats.busy_time;
+	if (priv->cur.total < priv->sample_ms * USEC_PER_MSEC)
+		return;
+
+	retired = device->ftbl->readtimestamp(device, KGSL_TIMESTAMP_RETIRED);
+	priv->cur.retired = retired - priv->last_retired;
+	priv->last_retired = retired;
+
+	priv->samples[priv->head] = priv->cur;
+	priv->head = (priv->head + 1) % priv->window;
+	if (priv->count < priv->window)
+		priv->count++;
+
+	for (i = 0; i < priv->count; i++) {
+		s = &priv->samples[i];
+		total += s->total;
+		busy += s->busy;
+		frames += s->retired;
+	}
+
+	sample_pct = dcvs_percent(priv->cur.busy, priv->cur.total);
+	window_pct = dcvs_percent(busy, total);
+
+	level = pwr->active_pwrlevel;
+	max_level = pwr->thermal_pwrlevel;
+	min_level = pwr->num_pwrlevels - 2;
+	new_level = level;
+
+	if (sample_pct >= priv->burst_threshold) {
+		new_level = max_level;
+		stat = &priv->bursts;
+		priv->below = 0;
+	} else if (window_pct >= priv->up_threshold ||
+		   (sample_pct >= priv->up_threshold &&
+		    priv->cur.retired * priv->count < frames)) {
+		new_level = level - 1;
+		stat = &priv->ups;
+		priv->below = 0;
+	} else if (window_pct < priv->down_threshold) {
+		if (++priv->below >= priv->down_samples) {
+			new_level = level + 1;
+			stat = &priv->downs;
+			priv->below = 0;
+		}
+	} else {
+		priv->below = 0;
+	}
+
+	new_level = clamp(new_level, max_level, min_level);
+
+	trace_kgsl_dcvs(device, sample_pct, window_pct, priv->cur.retired,
+			level, new_level);
+
+	if (new_level != level) {
+		if (stat)
+			(*stat)++;
+		kgsl_pwrctrl_pwrlevel_change(device, new_level);
+	}
+
+	memset(&priv->cur, 0, sizeof(priv->cur));
+}
+
+static void dcvs_busy(struct kgsl_device *device,
+		      struct kgsl_pwrscale *pwrscale)
+{
+	device->on_time = ktime_to_us(ktime_get());
+}
+
+static void dcvs_sleep(struct kgsl_device *device,
+		       struct kgsl_pwrscale *pwrscale)
+{
+	/* the history does not describe the next burst of work */
+	dcvs_reset(device, pwrscale->priv);
+}
+
+#define DCVS_TUNABLE(_name, _min, _max)					\
+static ssize_t dcvs_##_name##_show(struct kgsl_device *device,		\
+				   struct kgsl_pwrscale *pwrscale,	\
+				   char *buf)				\
+{									\
+	struct dcvs_priv *priv = pwrscale->priv;			\
+	return snprintf(buf, PAGE_SIZE, "%u\n", priv->_name);		\
+}									\
+static ssize_t dcvs_##_name##_store(struct kgsl_device *device,	\
+				    struct kgsl_pwrscale *pwrscale,	\
+				    const char *buf, size_t count)	\
+{									\
+	struct dcvs_priv *priv = pwrscale->priv;			\
+	unsigned int val;						\
+									\
+	if (sscanf(buf, "%u", &val) != 1 || val < (_min) || val > (_max)) \
+		return -EINVAL;						\
+									\
+	mutex_lock(&device->mutex);					\
+	priv->_name = val;						\
+	dcvs_reset(device, priv);					\
+	mutex_unlock(&device->mutex);					\
+	return count;							\
+}									\
+PWRSCALE_POLICY_ATTR(_name, 0644, dcvs_##_name##_show,			\
+		     dcvs_##_name##_store)
+
+DCVS_TUNABLE(sample_ms, 1, 1000);
+DCVS_TUNABLE(window, 1, DCVS_MAX_WINDOW);
+DCVS_TUNABLE(up_threshold, 0, 100);
+DCVS_TUNABLE(burst_threshold, 0, 101);
+DCVS_TUNABLE(down_threshold, 0, 100);
+DCVS_TUNABLE(down_samples, 1, 1000);
+
+static ssize_t dcvs_stats_show(struct kgsl_device *device,
+			       struct kgsl_pwrscale *pwrscale,
+			       char *buf)
+{
+	struct dcvs_priv *priv = pwrscale->priv;
+
+	return snprintf(buf, PAGE_SIZE, "bursts %u up %u down %u\n",
+			priv->bursts, priv->ups, priv->downs);
+}
+
+PWRSCALE_POLICY_ATTR(stats, 0444, dcvs_stats_show, NULL);
+
+static struct attribute *dcvs_attrs[] = {
+	&policy_attr_sample_ms.attr,
+	&policy_attr_window.attr,
+	&policy_attr_up_threshold.attr,
+	&policy_attr_burst_threshold.attr,
+	&policy_attr_down_threshold.attr,
+	&policy_attr_down_samples.attr,
+	&policy_attr_stats.attr,
+	NULL
+};
+
+static struct attribute_group dcvs_attr_group = {
+	.attrs = dcvs_attrs,
+};
+
+static int dcvs_init(struct kgsl_device *device,
+		     struct kgsl_pwrscale *pwrscale)
+{
+	struct dcvs_priv *priv;
+
+	priv = kzalloc(sizeof(struct dcvs_priv), GFP_KERNEL);
+	if (priv == NULL)
+		return -ENOMEM;
+
+	priv->sample_ms = DCVS_SAMPLE_MS;
+	priv->window = DCVS_WINDOW;
+	priv->up_threshold = DCVS_UP_THRESHOLD;
+	priv->burst_threshold = DCVS_BURST_THRESHOLD;
+	priv->down_threshold = DCVS_DOWN_THRESHOLD;
+	priv->down_samples = DCVS_DOWN_SAMPLES;
+	dcvs_reset(device, priv);
+
+	pwrscale->priv = priv;
+	kgsl_pwrscale_policy_add_files(device, pwrscale, &dcvs_attr_group);
+
+	return 0;
+}
+
+static void dcvs_close(struct kgsl_device *device,
+		       struct kgsl_pwrscale *pwrscale)
+{
+	kgsl_pwrscale_policy_remove_files(device, pwrscale, &dcvs_attr_group);
+	kfree(pwrscale->priv);
+	pwrscale->priv = NULL;
+}
+
+struct kgsl_pwrscale_policy kgsl_pwrscale_policy_dcvs = {
+	.name = "dcvs",
+	.init = dcvs_init,
+	.busy = dcvs_busy,
+	.idle = dcvs_idle,
+	.sleep = dcvs_sleep,
+	.close = dcvs_close
+};
+EXPORT_SYMBOL(kgsl_pwrscale_policy_dcvs);
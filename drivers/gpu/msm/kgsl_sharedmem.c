@@ -20,6 +20,7 @@
 #include "kgsl_sharedmem.h"
 #include "kgsl_cffdump.h"
 #include "kgsl_device.h"
+#include "kgsl_pool.h"
 
 /* An attribute for showing per-process memory statistics */
 struct kgsl_mem_entry_attribute {
@@ -108,6 +109,47 @@ mem_entry_max_show(struct kgsl_process_private *priv, int type, char *buf)
 	return snprintf(buf, PAGE_SIZE, "%d\n", priv->stats[type].max);
 }
 
+/**
+ * Show the GPU time used by the process, in microseconds
+ */
+
+static ssize_t
+gpu_busy_show(struct kgsl_process_private *priv, int type, char *buf)
+{
+	u64 busy;
+
+	spin_lock(&priv->mem_lock);
+	busy = priv->gpu_busy;
+	spin_unlock(&priv->mem_lock);
+
+	return snprintf(buf, PAGE_SIZE, "%llu\n", div_u64(busy, NSEC_PER_USEC));
+}
+
+/**
+ * Show the GPU time (us) and retired command batches of each context
+ */
+
+static ssize_t
+gpu_busy_contexts_show(struct kgsl_process_private *priv, int type, char *buf)
+{
+	struct kgsl_context *context;
+	ssize_t len = 0;
+
+	spin_lock(&priv->mem_lock);
+	list_for_each_entry(context, &priv->context_list, proc_node)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%u %llu %u\n",
+				 context->id,
+				 div_u64(context->gpu_busy, NSEC_PER_USEC),
+				 context->gpu_batches);
+	spin_unlock(&priv->mem_lock);
+
+	return len;
+}
+
+static struct kgsl_mem_entry_attribute gpu_busy_attrs[] = {
+	__MEM_ENTRY_ATTR(0, gpu_busy, gpu_busy_show),
+	__MEM_ENTRY_ATTR(0, gpu_busy_contexts, gpu_busy_contexts_show),
+};
 
 static void mem_entry_sysfs_release(struct kobject *kobj)
 {
@@ -167,6 +209,9 @@ kgsl_process_uninit_sysfs(struct kgsl_process_private *private)
 			&mem_stats[i].max_attr.attr);
 	}
 
+	for (i = 0; i < ARRAY_SIZE(gpu_busy_attrs); i++)
+		sysfs_remove_file(&private->kobj, &gpu_busy_attrs[i].attr);
+
 	kobject_put(&private->kobj);
 }
 
@@ -191,6 +236,10 @@ kgsl_process_init_sysfs(struct kgsl_process_private *private)
 		ret = sysfs_create_file(&private->kobj,
 			&mem_stats[i].max_attr.attr);
 	}
+
+	for (i = 0; i < ARRAY_SIZE(gpu_busy_attrs); i++)
+		ret = sysfs_create_file(&private->kobj,
+			&gpu_busy_attrs[i].attr);
 }
 
 static int kgsl_drv_memstat_show(struct device *dev,
@@ -330,7 +379,7 @@ static void kgsl_vmalloc_free(struct kgsl_memdesc *memdesc)
 		vunmap(memdesc->hostptr);
 	if (memdesc->sg)
 		for_each_sg(memdesc->sg, sg, memdesc->sglen, i)
-			__free_page(sg_page(sg));
+			kgsl_pool_free_page(sg_page(sg));
 }
 
 static int kgsl_contiguous_vmflags(struct kgsl_memdesc *memdesc)
@@ -475,8 +524,7 @@ _kgsl_sharedmem_vmalloc(struct kgsl_memdesc *memdesc,
 	sg_init_table(memdesc->sg, sglen);
 
 	for (i = 0; i < memdesc->sglen; i++) {
-		struct page *page = alloc_page(GFP_KERNEL | __GFP_ZERO |
-						__GFP_HIGHMEM);
+		struct page *page = kgsl_pool_alloc_page();
 		if (!page) {
 			ret = -ENOMEM;
 			memdesc->sglen = i;
@@ -225,6 +225,48 @@ TRACE_EVENT(kgsl_pwrlevel,
 	)
 );
 
+/*
+ * Tracepoint for the dcvs pwrscale policy decisions
+ */
+TRACE_EVENT(kgsl_dcvs,
+
+	TP_PROTO(struct kgsl_device *device, unsigned int sample_busy,
+		 unsigned int window_busy, unsigned int retired,
+		 unsigned int pwrlevel, unsigned int new_pwrlevel),
+
+	TP_ARGS(device, sample_busy, window_busy, retired, pwrlevel,
+		new_pwrlevel),
+
+	TP_STRUCT__entry(
+		__string(device_name, device->name)
+		__field(unsigned int, sample_busy)
+		__field(unsigned int, window_busy)
+		__field(unsigned int, retired)
+		__field(unsigned int, pwrlevel)
+		__field(unsigned int, new_pwrlevel)
+	),
+
+	TP_fast_assign(
+		__assign_str(device_name, device->name);
+		__entry->sample_busy = sample_busy;
+		__entry->window_busy = window_busy;
+		__entry->retired = retired;
+		__entry->pwrlevel = pwrlevel;
+		__entry->new_pwrlevel = new_pwrlevel;
+	),
+
+	TP_printk(
+		"d_name=%s sample_busy=%u%% window_busy=%u%% retired=%u "
+		"pwrlevel=%u new_pwrlevel=%u",
+		__get_str(device_name),
+		__entry->sample_busy,
+		__entry->window_busy,
+		__entry->retired,
+		__entry->pwrlevel,
+		__entry->new_pwrlevel
+	)
+);
+
 DECLARE_EVENT_CLASS(kgsl_pwrstate_template,
 	TP_PROTO(struct kgsl_device *device, unsigned int state),
 
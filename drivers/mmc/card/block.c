@@ -102,6 +102,14 @@ struct mmc_blk_data {
 	 */
 	unsigned int	part_curr;
 	struct device_attribute force_ro;
+
+	/*
+	 * Packed write support, only set up for eMMC 4.5 cards.  packed_max
+	 * is the largest number of requests put in one packed command.
+	 */
+	__le32		*packed_hdr;
+	unsigned int	packed_max;
+	struct device_attribute packed_max_attr;
 };
 
 static DEFINE_MUTEX(open_lock);
@@ -141,6 +149,7 @@ static void mmc_blk_put(struct mmc_blk_data *md)
 		__clear_bit(devidx, dev_use);
 
 		put_disk(md->disk);
+		kfree(md->packed_hdr);
 		kfree(md);
 	}
 	mutex_unlock(&open_lock);
@@ -177,6 +186,39 @@ out:
 	return ret;
 }
 
+static ssize_t max_packed_writes_show(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	int ret;
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	ret = snprintf(buf, PAGE_SIZE, "%u\n", md->packed_max);
+	mmc_blk_put(md);
+	return ret;
+}
+
+/* Values below 2 turn packing off */
+static ssize_t max_packed_writes_store(struct device *dev,
+				       struct device_attribute *attr,
+				       const char *buf, size_t count)
+{
+	int ret;
+	char *end;
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	struct mmc_card *card = md->queue.card;
+	unsigned long set = simple_strtoul(buf, &end, 0);
+	if (end == buf || set > card->ext_csd.max_packed_writes ||
+	    set > MMC_PACKED_MAX_ENTRIES) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	md->packed_max = set;
+	ret = count;
+out:
+	mmc_blk_put(md);
+	return ret;
+}
+
 static int mmc_blk_open(struct block_device *bdev, fmode_t mode)
 {
 	struct mmc_blk_data *md = mmc_blk_get(bdev->bd_disk);
@@ -1265,6 +1307,7 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
 	int err;
 	u32 status;
 	int  no_ready = 0;
+	bool prepared;
 	ktime_t start, diff;
 
 	/*
@@ -1366,13 +1409,15 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
 		mmc_set_data_timeout(&brq.data, card);
 
 		brq.data.sg = mq->sg;
-		brq.data.sg_len = mmc_queue_map_sg(mq);
+		prepared = mmc_queue_use_prepared(mq, &brq.data);
+		if (!prepared)
+			brq.data.sg_len = mmc_queue_map_sg(mq);
 
 		/*
 		 * Adjust the sg list so it is the same size as the
-		 * request.
+		 * request.  A prepared request always goes out whole.
 		 */
-		if (brq.data.blocks != blk_rq_sectors(req)) {
+		if (!prepared && brq.data.blocks != blk_rq_sectors(req)) {
 			int i, data_size = brq.data.blocks << 9;
 			struct scatterlist *sg;
 
@@ -1388,9 +1433,14 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
 		}
 
 		start = ktime_get();
-		mmc_queue_bounce_pre(mq);
+		if (!prepared)
+			mmc_queue_bounce_pre(mq);
 
-		mmc_wait_for_req(card->host, &brq.mrq);
+		/* Prepare the next request while this one is on the bus */
+		mmc_start_req(card->host, &brq.mrq);
+		mmc_queue_prep_next(mq, &brq.mrq);
+		mmc_wait_for_req_done(card->host, &brq.mrq);
+		mmc_post_req(card->host, &brq.mrq, 0);
 
 		mmc_queue_bounce_post(mq);
 		diff = ktime_sub(ktime_get(), start);
@@ -1591,6 +1641,252 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
 	return 0;
 }
 
+/*
+ * Only plain writes are packed; reliable writes, discards and flushes
+ * are issued on their own.
+ */
+static bool mmc_blk_packable(struct request *req)
+{
+	return req->cmd_type == REQ_TYPE_FS && rq_data_dir(req) == WRITE &&
+		!(req->cmd_flags & (REQ_DISCARD | REQ_FLUSH | REQ_FUA | REQ_META));
+}
+
+/* Can a packed command of this many blocks and segments be issued? */
+static bool mmc_blk_packed_fits(struct mmc_host *host, unsigned int blocks,
+				unsigned int segs)
+{
+	return blocks <= host->max_blk_count && segs <= host->max_segs &&
+		blocks << 9 <= host->max_req_size;
+}
+
+/*
+ * Collect req and the writes queued right behind it on @list, linked
+ * through queuelist, for a packed command.  Returns the number of
+ * requests on the list, or 0 if req is to be issued on its own.
+ */
+static unsigned int mmc_blk_prep_packed_list(struct mmc_queue *mq,
+					     struct request *req,
+					     struct list_head *list)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	struct mmc_host *host = card->host;
+	struct request_queue *q = mq->queue;
+	struct request *next;
+	unsigned int nr = 1;
+	/* the header takes a block and a segment of its own */
+	unsigned int blocks = blk_rq_sectors(req) + 1;
+	unsigned int segs = req->nr_phys_segments + 1;
+
+	if (!md->packed_hdr || md->packed_max < 2 || !mmc_blk_packable(req))
+		return 0;
+
+	list_add_tail(&req->queuelist, list);
+
+	spin_lock_irq(q->queue_lock);
+	while (nr < md->packed_max &&
+	       mmc_blk_packed_fits(host, blocks, segs)) {
+		next = blk_peek_request(q);
+		if (!next || !mmc_blk_packable(next) ||
+		    !mmc_blk_packed_fits(host, blocks + blk_rq_sectors(next),
+					 segs + next->nr_phys_segments))
+			break;
+
+		blk_start_request(next);
+		list_add_tail(&next->queuelist, list);
+		blocks += blk_rq_sectors(next);
+		segs += next->nr_phys_segments;
+		nr++;
+	}
+	spin_unlock_irq(q->queue_lock);
+
+	if (nr == 1) {
+		list_del_init(&req->queuelist);
+		card->packed_stats.single_writes++;
+		return 0;
+	}
+
+	return nr;
+}
+
+/*
+ * After a failed packed write, find out from EXT_CSD how many of the
+ * packed requests were written before the one that failed.
+ */
+static unsigned int mmc_blk_packed_written(struct mmc_card *card,
+					   unsigned int nr)
+{
+	unsigned int written = 0;
+	u32 status;
+	u8 *ext_csd;
+
+	if (!card->ext_csd.packed_event_en ||
+	    get_card_status(card, &status, 0) ||
+	    !(status & R1_EXCEPTION_EVENT))
+		return 0;
+
+	ext_csd = kmalloc(512, GFP_KERNEL);
+	if (!ext_csd)
+		return 0;
+
+	if (!mmc_send_ext_csd(card, ext_csd) &&
+	    (ext_csd[EXT_CSD_EXP_EVENTS_STATUS] & EXT_CSD_PACKED_FAILURE) &&
+	    (ext_csd[EXT_CSD_PACKED_CMD_STATUS] &
+	     EXT_CSD_PACKED_INDEXED_ERROR) &&
+	    ext_csd[EXT_CSD_PACKED_FAILURE_INDEX] >= 1 &&
+	    ext_csd[EXT_CSD_PACKED_FAILURE_INDEX] <= nr)
+		written = ext_csd[EXT_CSD_PACKED_FAILURE_INDEX] - 1;
+
+	kfree(ext_csd);
+	return written;
+}
+
+/*
+ * Issue the writes on @list as one eMMC 4.5 packed command: CMD23 with
+ * the packed flag, then a CMD25 whose first block is a header listing the
+ * address and length of each request, followed by their data.
+ *
+ * If the packed command fails, the requests the card reports as written
+ * are completed and the others are issued again one at a time, which
+ * takes care of retrying and of failing the bad ones.
+ */
+static int mmc_blk_issue_packed_rq(struct mmc_queue *mq,
+				   struct list_head *list, unsigned int nr)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	struct mmc_packed_stats *stats = &card->packed_stats;
+	struct mmc_blk_request brq;
+	struct request *req, *tmp;
+	__le32 *hdr = md->packed_hdr;
+	unsigned int blocks = 0, written = 0, i = 1;
+	unsigned long timeout;
+	bool nomedium = false;
+	u32 status, addr;
+	int err;
+
+	/* The first request may have been mapped on its own */
+	mmc_queue_release_prepared(mq);
+
+	memset(hdr, 0, 512);
+	hdr[0] = cpu_to_le32((nr << 16) | (MMC_PACKED_CMD_WR << 8) |
+			     MMC_PACKED_CMD_VER);
+	list_for_each_entry(req, list, queuelist) {
+		addr = blk_rq_pos(req);
+		if (!mmc_card_blockaddr(card))
+			addr <<= 9;
+		hdr[i * 2] = cpu_to_le32(blk_rq_sectors(req));
+		hdr[i * 2 + 1] = cpu_to_le32(addr);
+		blocks += blk_rq_sectors(req);
+		i++;
+	}
+
+	memset(&brq, 0, sizeof(struct mmc_blk_request));
+	brq.mrq.sbc = &brq.sbc;
+	brq.mrq.cmd = &brq.cmd;
+	brq.mrq.data = &brq.data;
+	brq.mrq.stop = &brq.stop;
+
+	brq.sbc.opcode = MMC_SET_BLOCK_COUNT;
+	brq.sbc.arg = MMC_CMD23_ARG_PACKED | (blocks + 1);
+	brq.sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
+
+	brq.cmd.opcode = MMC_WRITE_MULTIPLE_BLOCK;
+	brq.cmd.arg = le32_to_cpu(hdr[3]);
+	brq.cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+
+	brq.stop.opcode = MMC_STOP_TRANSMISSION;
+	brq.stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
+
+	brq.data.blksz = 512;
+	brq.data.blocks = blocks + 1;
+	brq.data.flags = MMC_DATA_WRITE;
+	mmc_set_data_timeout(&brq.data, card);
+	brq.data.sg = mq->sg;
+	brq.data.sg_len = mmc_queue_packed_map_sg(mq, hdr, list);
+
+	mmc_wait_for_req(card->host, &brq.mrq);
+
+	req = list_first_entry(list, struct request, queuelist);
+
+	if (brq.sbc.error || brq.cmd.error || brq.stop.error) {
+		if (mmc_blk_cmd_recovery(card, req, &brq) == ERR_NOMEDIUM) {
+			nomedium = true;
+			goto fail;
+		}
+		if (brq.sbc.error || brq.cmd.error)
+			goto fail;
+	}
+
+	if (brq.cmd.resp[0] & CMD_ERRORS) {
+		pr_err("%s: packed write command failed, status = %#x\n",
+		       req->rq_disk->disk_name, brq.cmd.resp[0]);
+		goto fail;
+	}
+
+	/* Wait for the card to finish programming */
+	timeout = jiffies + HZ * 2;
+	do {
+		err = get_card_status(card, &status, 5);
+		if (err) {
+			pr_err("%s: error %d requesting status\n",
+			       req->rq_disk->disk_name, err);
+			goto fail;
+		}
+		if (time_after(jiffies, timeout)) {
+			pr_err("%s: card not ready after packed write, status %#x\n",
+			       req->rq_disk->disk_name, status);
+			goto fail;
+		}
+	} while (!(status & R1_READY_FOR_DATA) ||
+		 (R1_CURRENT_STATE(status) == R1_STATE_PRG));
+
+	if (brq.data.error) {
+		pr_err("%s: error %d in packed write of %u requests, card status %#x\n",
+		       req->rq_disk->disk_name, brq.data.error, nr, status);
+		goto fail;
+	}
+
+	stats->packed_cmds++;
+	stats->packed_reqs += nr;
+	stats->pack_size[nr]++;
+
+	list_for_each_entry_safe(req, tmp, list, queuelist) {
+		list_del_init(&req->queuelist);
+		spin_lock_irq(&md->lock);
+		__blk_end_request_all(req, 0);
+		spin_unlock_irq(&md->lock);
+	}
+
+	return 1;
+
+ fail:
+	stats->failures++;
+	if (!nomedium)
+		written = mmc_blk_packed_written(card, nr);
+
+	list_for_each_entry_safe(req, tmp, list, queuelist) {
+		list_del_init(&req->queuelist);
+		if (written) {
+			written--;
+			spin_lock_irq(&md->lock);
+			__blk_end_request_all(req, 0);
+			spin_unlock_irq(&md->lock);
+		} else if (nomedium) {
+			spin_lock_irq(&md->lock);
+			req->cmd_flags |= REQ_QUIET;
+			__blk_end_request_all(req, -EIO);
+			spin_unlock_irq(&md->lock);
+		} else {
+			stats->retried_reqs++;
+			mq->req = req;
+			mmc_blk_issue_rw_rq(mq, req);
+		}
+	}
+
+	return 0;
+}
+
 static int sd_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 {
 	int ret;
@@ -1709,6 +2005,8 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 	int ret;
 	struct mmc_blk_data *md = mq->data;
 	struct mmc_card *card = md->queue.card;
+	LIST_HEAD(packed);
+	unsigned int nr;
 
 #ifdef CONFIG_MMC_BLOCK_DEFERRED_RESUME
 	int err = 0, card_no_ready = 0;
@@ -1809,6 +2107,8 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 			ret = mmc_blk_issue_discard_rq(mq, req);
 	} else if (req->cmd_flags & REQ_FLUSH)
 		ret = mmc_blk_issue_flush(mq, req);
+	else if ((nr = mmc_blk_prep_packed_list(mq, req, &packed)))
+		ret = mmc_blk_issue_packed_rq(mq, &packed, nr);
 	else
 		ret = mmc_blk_issue_rw_rq(mq, req);
 
@@ -1925,6 +2225,20 @@ static struct mmc_blk_data *mmc_blk_alloc_req(struct mmc_card *card,
 		blk_queue_flush(md->queue.queue, REQ_FLUSH | REQ_FUA);
 	}
 
+	/*
+	 * Packed writes need CMD23 and the header has to fit in the sg
+	 * list next to the data, which rules out the bounce buffer.
+	 */
+	if (mmc_card_mmc(card) && card->ext_csd.max_packed_writes &&
+	    md->flags & MMC_BLK_CMD23 && !md->queue.bounce_buf &&
+	    card->host->max_segs > 1) {
+		md->packed_hdr = kzalloc(512, GFP_KERNEL);
+		if (md->packed_hdr)
+			md->packed_max = min_t(unsigned int,
+					       card->ext_csd.max_packed_writes,
+					       MMC_PACKED_MAX_ENTRIES);
+	}
+
 	return md;
 
  err_putdisk:
@@ -2031,6 +2345,9 @@ static void mmc_blk_remove_req(struct mmc_blk_data *md)
 	if (md) {
 		if (md->disk->flags & GENHD_FL_UP) {
 			device_remove_file(disk_to_dev(md->disk), &md->force_ro);
+			if (md->packed_hdr)
+				device_remove_file(disk_to_dev(md->disk),
+						   &md->packed_max_attr);
 
 			/* Stop new requests from getting into the queue */
 			del_gendisk_async(md->disk);
@@ -2068,8 +2385,26 @@ static int mmc_add_disk(struct mmc_blk_data *md)
 	md->force_ro.attr.mode = S_IRUGO | S_IWUSR;
 	ret = device_create_file(disk_to_dev(md->disk), &md->force_ro);
 	if (ret)
-		del_gendisk(md->disk);
+		goto err_del;
+
+	if (md->packed_hdr) {
+		md->packed_max_attr.show = max_packed_writes_show;
+		md->packed_max_attr.store = max_packed_writes_store;
+		sysfs_attr_init(&md->packed_max_attr.attr);
+		md->packed_max_attr.attr.name = "max_packed_writes";
+		md->packed_max_attr.attr.mode = S_IRUGO | S_IWUSR;
+		ret = device_create_file(disk_to_dev(md->disk),
+					 &md->packed_max_attr);
+		if (ret)
+			goto err_force_ro;
+	}
+
+	return 0;
 
+ err_force_ro:
+	device_remove_file(disk_to_dev(md->disk), &md->force_ro);
+ err_del:
+	del_gendisk(md->disk);
 	return ret;
 }
 
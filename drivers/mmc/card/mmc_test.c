@@ -1954,6 +1954,271 @@ static int mmc_test_large_seq_write_perf(struct mmc_test_card *test)
 	return mmc_test_large_seq_perf(test, 1);
 }
 
+/**
+ * struct mmc_test_async_req - request used by the pipelining tests.
+ * @mrq: request
+ * @cmd: read / write command
+ * @stop: stop command
+ * @data: data of the transfer
+ */
+struct mmc_test_async_req {
+	struct mmc_request mrq;
+	struct mmc_command cmd;
+	struct mmc_command stop;
+	struct mmc_data data;
+};
+
+/*
+ * Address of the i'th transfer of ssz sectors in the test area, either
+ * consecutive or random.
+ */
+static unsigned int mmc_test_async_addr(struct mmc_test_card *test,
+					unsigned int i, unsigned int ssz,
+					int random)
+{
+	struct mmc_test_area *t = &test->area;
+	unsigned int nr = (t->max_sz >> 9) / ssz;
+
+	if (random)
+		i = mmc_test_rnd_num(nr);
+	return t->dev_addr + (i % nr) * ssz;
+}
+
+/*
+ * Map sz bytes of one half of the test area memory into a scatterlist,
+ * mapping that half more than once if it is smaller than sz.  Requests
+ * built on different halves can be in flight together without sharing
+ * a buffer.
+ */
+static int mmc_test_map_sg_half(struct mmc_test_mem *mem, unsigned long sz,
+				int half, struct scatterlist *sglist,
+				unsigned int max_segs, unsigned int max_seg_sz,
+				unsigned int *sg_len)
+{
+	struct scatterlist *sg = NULL;
+	unsigned long total = 0, first, last, pos, end;
+	unsigned int i;
+
+	for (i = 0; i < mem->cnt; i++)
+		total += PAGE_SIZE << mem->arr[i].order;
+	first = half ? (total / 2) & PAGE_MASK : 0;
+	last = half ? total : (total / 2) & PAGE_MASK;
+	if (first >= last)
+		return -EINVAL;
+
+	sg_init_table(sglist, max_segs);
+
+	*sg_len = 0;
+	while (sz) {
+		pos = 0;
+		for (i = 0; i < mem->cnt && sz; i++, pos = end) {
+			unsigned long start = max(pos, first);
+			unsigned long len;
+
+			end = pos + (PAGE_SIZE << mem->arr[i].order);
+			if (min(end, last) <= start)
+				continue;
+			len = min(end, last) - start;
+			if (len > sz)
+				len = sz;
+			if (len > max_seg_sz)
+				len = max_seg_sz;
+			if (sg)
+				sg = sg_next(sg);
+			else
+				sg = sglist;
+			if (!sg)
+				return -EINVAL;
+			sg_set_page(sg, nth_page(mem->arr[i].page,
+						 (start - pos) >> PAGE_SHIFT),
+				    len, 0);
+			sz -= len;
+			*sg_len += 1;
+		}
+	}
+
+	if (sg)
+		sg_mark_end(sg);
+
+	return 0;
+}
+
+/*
+ * Set up a request for a buffer mapped by mmc_test_map_sg_half().  With
+ * async set, the host prepares it right away with mmc_pre_req().
+ */
+static void mmc_test_async_prep(struct mmc_test_card *test,
+				struct mmc_test_async_req *rq,
+				struct scatterlist *sg, unsigned int sg_len,
+				unsigned int dev_addr, int write, int async)
+{
+	struct mmc_test_area *t = &test->area;
+
+	memset(rq, 0, sizeof(struct mmc_test_async_req));
+	rq->mrq.cmd = &rq->cmd;
+	rq->mrq.data = &rq->data;
+	rq->mrq.stop = &rq->stop;
+
+	mmc_test_prepare_mrq(test, &rq->mrq, sg, sg_len, dev_addr,
+			     t->blocks, 512, write);
+
+	if (async)
+		mmc_pre_req(test->card->host, &rq->mrq);
+}
+
+/*
+ * Do cnt transfers of sz bytes, setting up each request while the previous
+ * one is in progress.  With async set the host prepares the requests in
+ * that window too, the way the block driver does, otherwise it prepares
+ * each request when it is started.  The two requests in flight use their
+ * own half of the test area memory, each with its own scatterlist.
+ */
+static int mmc_test_async_io(struct mmc_test_card *test, unsigned long sz,
+			     unsigned int cnt, int write, int random, int async)
+{
+	struct mmc_host *host = test->card->host;
+	struct mmc_test_area *t = &test->area;
+	struct mmc_test_async_req rq[2];
+	struct mmc_test_async_req *cur, *next;
+	struct scatterlist *sg[2];
+	unsigned int sg_len[2];
+	unsigned int i, ssz = sz >> 9;
+	struct timespec ts1, ts2;
+	int ret;
+
+	sg[0] = t->sg;
+	sg[1] = kmalloc(sizeof(struct scatterlist) * t->max_segs, GFP_KERNEL);
+	if (!sg[1])
+		return -ENOMEM;
+
+	for (i = 0; i < 2; i++) {
+		ret = mmc_test_map_sg_half(t->mem, sz, i, sg[i], t->max_segs,
+					   t->max_seg_sz, &sg_len[i]);
+		if (ret) {
+			printk(KERN_INFO "%s: Failed to map sg list\n",
+			       mmc_hostname(host));
+			goto out_free;
+		}
+	}
+	t->blocks = ssz;
+
+	getnstimeofday(&ts1);
+	cur = &rq[0];
+	mmc_test_async_prep(test, cur, sg[0], sg_len[0],
+			    mmc_test_async_addr(test, 0, ssz, random),
+			    write, async);
+	for (i = 0; i < cnt; i++) {
+		mmc_start_req(host, &cur->mrq);
+
+		next = NULL;
+		if (i + 1 < cnt) {
+			unsigned int n = (i + 1) & 1;
+
+			next = &rq[n];
+			mmc_test_async_prep(test, next, sg[n], sg_len[n],
+				mmc_test_async_addr(test, i + 1, ssz, random),
+				write, async);
+		}
+
+		mmc_wait_for_req_done(host, &cur->mrq);
+		mmc_post_req(host, &cur->mrq, 0);
+
+		ret = mmc_test_check_result(test, &cur->mrq);
+		if (!ret && write)
+			ret = mmc_test_wait_busy(test);
+		if (ret) {
+			if (next)
+				mmc_post_req(host, &next->mrq, ret);
+			goto out_free;
+		}
+		cur = next;
+	}
+	getnstimeofday(&ts2);
+
+	printk(KERN_INFO "%s: Requests prepared %s:\n", mmc_hostname(host),
+	       async ? "while the previous one is transferred" :
+	       "when started");
+	mmc_test_print_avg_rate(test, sz, cnt, &ts1, &ts2);
+
+out_free:
+	kfree(sg[1]);
+	return ret;
+}
+
+/*
+ * Compare preparing requests when they are started against preparing
+ * them while the previous request is transferred, with the same I/O.
+ */
+static int mmc_test_async_cmp(struct mmc_test_card *test, unsigned long sz,
+			      int write, int random)
+{
+	struct mmc_test_area *t = &test->area;
+	unsigned int next = rnd_next, cnt = t->max_sz / sz;
+	int async, ret;
+
+	for (async = 0; async < 2; async++) {
+		if (write) {
+			ret = mmc_test_area_erase(test);
+			if (ret)
+				return ret;
+		}
+		rnd_next = next;
+		ret = mmc_test_async_io(test, sz, cnt, write, random, async);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int mmc_test_async_perf(struct mmc_test_card *test, int write,
+			       int random)
+{
+	struct mmc_test_area *t = &test->area;
+	unsigned long sz;
+	int ret;
+
+	for (sz = 512; sz < t->max_tfr; sz <<= 1) {
+		ret = mmc_test_async_cmp(test, sz, write, random);
+		if (ret)
+			return ret;
+	}
+	sz = t->max_tfr;
+	return mmc_test_async_cmp(test, sz, write, random);
+}
+
+/*
+ * Consecutive read performance with and without preparing ahead.
+ */
+static int mmc_test_async_seq_read_perf(struct mmc_test_card *test)
+{
+	return mmc_test_async_perf(test, 0, 0);
+}
+
+/*
+ * Consecutive write performance with and without preparing ahead.
+ */
+static int mmc_test_async_seq_write_perf(struct mmc_test_card *test)
+{
+	return mmc_test_async_perf(test, 1, 0);
+}
+
+/*
+ * Random read performance with and without preparing ahead.
+ */
+static int mmc_test_async_rnd_read_perf(struct mmc_test_card *test)
+{
+	return mmc_test_async_perf(test, 0, 1);
+}
+
+/*
+ * Random write performance with and without preparing ahead.
+ */
+static int mmc_test_async_rnd_write_perf(struct mmc_test_card *test)
+{
+	return mmc_test_async_perf(test, 1, 1);
+}
+
 static const struct mmc_test_case mmc_test_cases[] = {
 	{
 		.name = "Basic write (no data verification)",
@@ -2221,6 +2486,34 @@ static const struct mmc_test_case mmc_test_cases[] = {
 		.cleanup = mmc_test_area_cleanup,
 	},
 
+	{
+		.name = "Consecutive read performance with requests prepared ahead",
+		.prepare = mmc_test_area_prepare_fill,
+		.run = mmc_test_async_seq_read_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Consecutive write performance with requests prepared ahead",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_async_seq_write_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Random read performance with requests prepared ahead",
+		.prepare = mmc_test_area_prepare_fill,
+		.run = mmc_test_async_rnd_read_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Random write performance with requests prepared ahead",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_async_rnd_write_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
 };
 
 static DEFINE_MUTEX(mmc_test_lock);
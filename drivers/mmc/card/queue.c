@@ -110,6 +110,83 @@ static int sd_queue_thread(void *d)
 	return 0;
 }
 
+/*
+ * Make the request prepared by mmc_queue_prep_next() the current one.  Its
+ * sg list and bounce buffer become the queue's, and those of the request
+ * just completed are reused for preparing the next one.
+ */
+static struct request *mmc_queue_take_next(struct mmc_queue *mq)
+{
+	struct mmc_queue_next *next = &mq->next;
+	struct request *req = next->req;
+
+	swap(mq->sg, next->sg);
+	swap(mq->bounce_buf, next->bounce_buf);
+	swap(mq->bounce_sg, next->bounce_sg);
+	swap(mq->bounce_sg_len, next->bounce_sg_len);
+
+	mq->prep_data = next->data;
+	mq->prepared = true;
+	next->req = NULL;
+
+	return req;
+}
+
+/*
+ * Undo the host preparation of a prepared request that issue_fn did not
+ * transfer, e.g. because the card could not be resumed or the request
+ * went out as part of a packed command.
+ */
+void mmc_queue_release_prepared(struct mmc_queue *mq)
+{
+	struct mmc_host *host = mq->card->host;
+	struct mmc_request mrq = {0};
+
+	if (!mq->prepared)
+		return;
+
+	mrq.data = &mq->prep_data;
+	mmc_post_req(host, &mrq, -ECANCELED);
+	mq->prepared = false;
+	host->async_stats.discarded++;
+}
+
+/*
+ * A read from a foreground blkio cgroup that was queued after the next
+ * request had been prepared does not wait for it: the prepared request
+ * is put back at the head of the queue and the read is taken instead.
+ * Called with the queue lock held.
+ */
+static struct request *mmc_queue_fetch_urgent(struct mmc_queue *mq)
+{
+	struct request_queue *q = mq->queue;
+	struct request *req;
+
+	if (rq_is_urgent(mq->next.req))
+		return NULL;
+
+	req = blk_peek_request(q);
+	if (!req || !rq_is_urgent(req))
+		return NULL;
+
+	blk_start_request(req);
+	blk_requeue_request(q, mq->next.req);
+
+	return req;
+}
+
+/* Undo the host preparation of a request put back on the queue */
+static void mmc_queue_put_back_next(struct mmc_queue *mq)
+{
+	struct mmc_host *host = mq->card->host;
+	struct mmc_request mrq = {0};
+
+	mrq.data = &mq->next.data;
+	mmc_post_req(host, &mrq, -ECANCELED);
+	mq->next.req = NULL;
+	host->async_stats.bumped++;
+}
+
 static int mmc_queue_thread(void *d)
 {
 	struct mmc_queue *mq = d;
@@ -131,10 +208,19 @@ static int mmc_queue_thread(void *d)
 
 		spin_lock_irq(q->queue_lock);
 		set_current_state(TASK_INTERRUPTIBLE);
-		req = blk_fetch_request(q);
+		if (mq->next.req) {
+			req = mmc_queue_fetch_urgent(mq);
+			if (!req)
+				req = mmc_queue_take_next(mq);
+		} else
+			req = blk_fetch_request(q);
 		mq->req = req;
 		spin_unlock_irq(q->queue_lock);
 
+		/* still set if it was put back for an urgent read */
+		if (mq->next.req)
+			mmc_queue_put_back_next(mq);
+
 		if (!req) {
 			if (kthread_should_stop()) {
 				set_current_state(TASK_RUNNING);
@@ -167,6 +253,7 @@ static int mmc_queue_thread(void *d)
 #else
 			mq->issue_fn(mq, req);
 #endif
+		mmc_queue_release_prepared(mq);
 	} while (1);
 	up(&mq->thread_sem);
 
@@ -196,6 +283,53 @@ static void mmc_request(struct request_queue *q)
 		wake_up_process(mq->thread);
 }
 
+/*
+ * A second sg list and bounce buffer let the next request be prepared
+ * while the current one is transferred.  Without them every request is
+ * simply prepared when it is issued.
+ */
+static void mmc_queue_free_next(struct mmc_queue *mq)
+{
+	struct mmc_queue_next *next = &mq->next;
+
+	kfree(next->sg);
+	next->sg = NULL;
+	kfree(next->bounce_sg);
+	next->bounce_sg = NULL;
+	kfree(next->bounce_buf);
+	next->bounce_buf = NULL;
+}
+
+static void mmc_queue_alloc_next(struct mmc_queue *mq)
+{
+	struct mmc_queue_next *next = &mq->next;
+	unsigned int nr_sg = mq->card->host->max_segs;
+	unsigned int bouncesz;
+
+	if (mq->bounce_buf) {
+		bouncesz = queue_max_hw_sectors(mq->queue) << 9;
+		nr_sg = 1;
+
+		next->bounce_buf = kmalloc(bouncesz, GFP_KERNEL);
+		next->bounce_sg = kmalloc(sizeof(struct scatterlist) *
+			bouncesz / 512, GFP_KERNEL);
+		if (!next->bounce_buf || !next->bounce_sg)
+			goto fail;
+		sg_init_table(next->bounce_sg, bouncesz / 512);
+	}
+
+	next->sg = kmalloc(sizeof(struct scatterlist) * nr_sg, GFP_KERNEL);
+	if (!next->sg)
+		goto fail;
+	sg_init_table(next->sg, nr_sg);
+	return;
+
+fail:
+	printk(KERN_WARNING "%s: unable to allocate buffers for "
+		"preparing requests ahead\n", mmc_card_name(mq->card));
+	mmc_queue_free_next(mq);
+}
+
 /**
  * mmc_init_queue - initialise a queue structure.
  * @mq: mmc queue
@@ -322,11 +456,13 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 
 	sema_init(&mq->thread_sem, 1);
 
-	if (mmc_card_sd(card))
+	if (mmc_card_sd(card)) {
 		mq->thread = kthread_run(sd_queue_thread, mq, "sd-qd");
-	else
+	} else {
+		mmc_queue_alloc_next(mq);
 		mq->thread = kthread_run(mmc_queue_thread, mq, "mmcqd/%d%s",
 					host->index, subname ? subname : "");
+	}
 
 	if (IS_ERR(mq->thread)) {
 		ret = PTR_ERR(mq->thread);
@@ -338,6 +474,7 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
  	if (mq->bounce_sg)
  		kfree(mq->bounce_sg);
  	mq->bounce_sg = NULL;
+	mmc_queue_free_next(mq);
  cleanup_queue:
 	if (mq->sg && mq->card->type != MMC_TYPE_SD)
 		kfree(mq->sg);
@@ -374,6 +511,7 @@ void mmc_cleanup_queue(struct mmc_queue *mq)
 		kfree(mq->sg);
 
 	mq->sg = NULL;
+	mmc_queue_free_next(mq);
 
 	if (mq->bounce_buf)
 		kfree(mq->bounce_buf);
@@ -427,34 +565,76 @@ void mmc_queue_resume(struct mmc_queue *mq)
 	}
 }
 
-/*
- * Prepare the sg list(s) to be handed of to the host driver
- */
-unsigned int mmc_queue_map_sg(struct mmc_queue *mq)
+static unsigned int mmc_queue_map_req(struct mmc_queue *mq,
+				      struct request *req,
+				      struct scatterlist *sg_list,
+				      char *bounce_buf,
+				      struct scatterlist *bounce_sg,
+				      unsigned int *bounce_sg_len)
 {
 	unsigned int sg_len;
 	size_t buflen;
 	struct scatterlist *sg;
 	int i;
 
-	if (!mq->bounce_buf)
-		return blk_rq_map_sg(mq->queue, mq->req, mq->sg);
+	if (!bounce_buf)
+		return blk_rq_map_sg(mq->queue, req, sg_list);
 
-	BUG_ON(!mq->bounce_sg);
+	BUG_ON(!bounce_sg);
 
-	sg_len = blk_rq_map_sg(mq->queue, mq->req, mq->bounce_sg);
+	sg_len = blk_rq_map_sg(mq->queue, req, bounce_sg);
 
-	mq->bounce_sg_len = sg_len;
+	*bounce_sg_len = sg_len;
 
 	buflen = 0;
-	for_each_sg(mq->bounce_sg, sg, sg_len, i)
+	for_each_sg(bounce_sg, sg, sg_len, i)
 		buflen += sg->length;
 
-	sg_init_one(mq->sg, mq->bounce_buf, buflen);
+	sg_init_one(sg_list, bounce_buf, buflen);
 
 	return 1;
 }
 
+/*
+ * Prepare the sg list(s) to be handed of to the host driver
+ */
+unsigned int mmc_queue_map_sg(struct mmc_queue *mq)
+{
+	return mmc_queue_map_req(mq, mq->req, mq->sg, mq->bounce_buf,
+				 mq->bounce_sg, &mq->bounce_sg_len);
+}
+
+/**
+ * mmc_queue_packed_map_sg - map a packed write into the queue's sg list
+ * @mq: MMC queue
+ * @hdr: 512 byte packed command header, sent as the first block
+ * @list: requests to pack, linked through queuelist
+ *
+ * The header is followed by the data of each request in turn.  The
+ * caller makes sure the whole list fits in mq->sg.
+ */
+unsigned int mmc_queue_packed_map_sg(struct mmc_queue *mq, void *hdr,
+				     struct list_head *list)
+{
+	struct scatterlist *sg = mq->sg;
+	struct request *req;
+	unsigned int sg_len = 1;
+
+	/*
+	 * blk_rq_map_sg() terminates the list after every request, clear
+	 * the termination bit again before appending the next one.
+	 */
+	sg_set_buf(sg, hdr, 512);
+	sg->page_link &= ~0x02;
+	list_for_each_entry(req, list, queuelist) {
+		sg_len += blk_rq_map_sg(mq->queue, req, sg + sg_len);
+		sg[sg_len - 1].page_link &= ~0x02;
+	}
+	sg_mark_end(&sg[sg_len - 1]);
+
+	return sg_len;
+}
+
 /*
  * If writing, bounce the data to the buffer before the request
  * is sent to the host driver
@@ -487,3 +667,104 @@ void mmc_queue_bounce_post(struct mmc_queue *mq)
 		mq->bounce_buf, mq->sg[0].length);
 }
 
+
+/*
+ * Only plain reads and writes that go out in a single transfer are
+ * prepared ahead, anything else is left to the issue path.
+ */
+static bool mmc_queue_can_prep(struct mmc_queue *mq, struct request *req)
+{
+	if (req->cmd_type != REQ_TYPE_FS)
+		return false;
+	if (req->cmd_flags & (REQ_DISCARD | REQ_FLUSH | REQ_FUA | REQ_META))
+		return false;
+	return blk_rq_sectors(req) <= mq->card->host->max_blk_count;
+}
+
+/**
+ * mmc_queue_prep_next - prepare the next request while one is transferred
+ * @mq: MMC queue
+ * @cur: request in progress on the host
+ *
+ * Take the next request off the block queue and do what can be done
+ * before it is started: map its sg list, bounce its data if writing and
+ * let the host driver map it for DMA.  The queue thread issues it next,
+ * so the bus does not sit idle while this is done.
+ */
+void mmc_queue_prep_next(struct mmc_queue *mq, struct mmc_request *cur)
+{
+	struct request_queue *q = mq->queue;
+	struct mmc_host *host = mq->card->host;
+	struct mmc_queue_next *next = &mq->next;
+	struct mmc_request mrq = {0};
+	struct request *req;
+	ktime_t start;
+	s64 ns;
+
+	if (!next->sg || next->req || (mq->flags & MMC_QUEUE_SUSPENDED))
+		return;
+
+	start = ktime_get();
+
+	spin_lock_irq(q->queue_lock);
+	req = blk_peek_request(q);
+	if (req && mmc_queue_can_prep(mq, req))
+		blk_start_request(req);
+	else
+		req = NULL;
+	spin_unlock_irq(q->queue_lock);
+
+	if (!req)
+		return;
+
+	memset(&next->data, 0, sizeof(next->data));
+	next->data.blksz = 512;
+	next->data.blocks = blk_rq_sectors(req);
+	if (rq_data_dir(req) == READ)
+		next->data.flags = MMC_DATA_READ;
+	else
+		next->data.flags = MMC_DATA_WRITE;
+	next->data.sg = next->sg;
+	next->data.sg_len = mmc_queue_map_req(mq, req, next->sg,
+			next->bounce_buf, next->bounce_sg,
+			&next->bounce_sg_len);
+	next->req = req;
+
+	if (next->bounce_buf && rq_data_dir(req) == WRITE)
+		sg_copy_to_buffer(next->bounce_sg, next->bounce_sg_len,
+			next->bounce_buf, next->sg[0].length);
+
+	mrq.data = &next->data;
+	mmc_pre_req(host, &mrq);
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	host->async_stats.prepared++;
+	host->async_stats.prep_ns += ns;
+	if (!completion_done(&cur->completion)) {
+		host->async_stats.overlapped++;
+		host->async_stats.overlap_ns += ns;
+	}
+}
+
+/**
+ * mmc_queue_use_prepared - pick up the preparation of the current request
+ * @mq: MMC queue
+ * @data: data of the transfer about to be started for mq->req
+ *
+ * Returns true if mq->req was prepared by mmc_queue_prep_next(); its sg
+ * list is then mapped and bounced, and @data is set up to use it.
+ * Otherwise the caller maps the request itself.
+ */
+bool mmc_queue_use_prepared(struct mmc_queue *mq, struct mmc_data *data)
+{
+	if (!mq->prepared) {
+		mq->card->host->async_stats.inline_prep++;
+		return false;
+	}
+
+	data->sg_len = mq->prep_data.sg_len;
+	data->host_cookie = mq->prep_data.host_cookie;
+	mq->prepared = false;
+
+	return true;
+}
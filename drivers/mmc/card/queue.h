@@ -1,9 +1,24 @@
 #ifndef MMC_QUEUE_H
 #define MMC_QUEUE_H
 
+#include <linux/mmc/core.h>
+
 struct request;
 struct task_struct;
 
+/*
+ * A request taken off the block queue and prepared for the host while
+ * the previous request was still being transferred.
+ */
+struct mmc_queue_next {
+	struct request		*req;
+	struct scatterlist	*sg;
+	char			*bounce_buf;
+	struct scatterlist	*bounce_sg;
+	unsigned int		bounce_sg_len;
+	struct mmc_data		data;
+};
+
 struct mmc_queue {
 	struct mmc_card		*card;
 	struct task_struct	*thread;
@@ -17,6 +32,9 @@ struct mmc_queue {
 	char			*bounce_buf;
 	struct scatterlist	*bounce_sg;
 	unsigned int		bounce_sg_len;
+	struct mmc_queue_next	next;
+	bool			prepared;	/* mq->req came from next */
+	struct mmc_data		prep_data;
 };
 
 extern int mmc_init_queue(struct mmc_queue *, struct mmc_card *, spinlock_t *,
@@ -26,8 +44,13 @@ extern void mmc_queue_suspend(struct mmc_queue *);
 extern void mmc_queue_resume(struct mmc_queue *);
 
 extern unsigned int mmc_queue_map_sg(struct mmc_queue *);
+extern unsigned int mmc_queue_packed_map_sg(struct mmc_queue *, void *,
+					    struct list_head *);
 extern void mmc_queue_bounce_pre(struct mmc_queue *);
 extern void mmc_queue_bounce_post(struct mmc_queue *);
+extern void mmc_queue_prep_next(struct mmc_queue *, struct mmc_request *);
+extern bool mmc_queue_use_prepared(struct mmc_queue *, struct mmc_data *);
+extern void mmc_queue_release_prepared(struct mmc_queue *);
 extern int mmc_reinit_card(struct mmc_host *host);
 extern int mmc_schedule_card_removal_work(struct delayed_work *work,
 				     unsigned long delay);
@@ -237,36 +237,95 @@ mmc_start_request(struct mmc_host *host, struct mmc_request *mrq)
 
 static void mmc_wait_done(struct mmc_request *mrq)
 {
-	complete(mrq->done_data);
+	complete(&mrq->completion);
 }
 
 /**
- *	mmc_wait_for_req - start a request and wait for completion
+ *	mmc_start_req - start a request without waiting for it
  *	@host: MMC host to start command
  *	@mrq: MMC request to start
  *
- *	Start a new MMC custom command request for a host, and wait
- *	for the command to complete. Does not attempt to parse the
- *	response.
+ *	Start a new MMC request and return while it is in progress, so
+ *	that the caller can prepare its next request in the meantime.
+ *	Completion must be waited for with mmc_wait_for_req_done().
  */
-void mmc_wait_for_req(struct mmc_host *host, struct mmc_request *mrq)
+void mmc_start_req(struct mmc_host *host, struct mmc_request *mrq)
 {
-	DECLARE_COMPLETION_ONSTACK(complete);
-
-	mrq->done_data = &complete;
+	init_completion(&mrq->completion);
 	mrq->done = mmc_wait_done;
 	if (mmc_card_removed(host->card)) {
 		mrq->cmd->error = -ENOMEDIUM;
+		complete(&mrq->completion);
 		return;
 	}
 
 	mmc_start_request(host, mrq);
+}
+
+EXPORT_SYMBOL(mmc_start_req);
 
-	wait_for_completion_io(&complete);
+/**
+ *	mmc_wait_for_req_done - wait for a request started by mmc_start_req
+ *	@host: MMC host the request was started on
+ *	@mrq: MMC request to wait for
+ */
+void mmc_wait_for_req_done(struct mmc_host *host, struct mmc_request *mrq)
+{
+	wait_for_completion_io(&mrq->completion);
+}
+
+EXPORT_SYMBOL(mmc_wait_for_req_done);
+
+/**
+ *	mmc_wait_for_req - start a request and wait for completion
+ *	@host: MMC host to start command
+ *	@mrq: MMC request to start
+ *
+ *	Start a new MMC custom command request for a host, and wait
+ *	for the command to complete. Does not attempt to parse the
+ *	response.
+ */
+void mmc_wait_for_req(struct mmc_host *host, struct mmc_request *mrq)
+{
+	mmc_start_req(host, mrq);
+	mmc_wait_for_req_done(host, mrq);
 }
 
 EXPORT_SYMBOL(mmc_wait_for_req);
 
+/**
+ *	mmc_pre_req - prepare a request ahead of starting it
+ *	@host: MMC host the request will be started on
+ *	@mrq: MMC request to prepare
+ *
+ *	Let the host driver do the work it would otherwise do when the
+ *	request is started, such as mapping the data for DMA.  This may be
+ *	called while another request is in progress on the host.  A
+ *	request prepared this way must be passed to mmc_post_req() once it
+ *	has completed, or if it is never started.
+ */
+void mmc_pre_req(struct mmc_host *host, struct mmc_request *mrq)
+{
+	if (host->ops->pre_req)
+		host->ops->pre_req(host, mrq);
+}
+
+EXPORT_SYMBOL(mmc_pre_req);
+
+/**
+ *	mmc_post_req - undo mmc_pre_req once a request is done with
+ *	@host: MMC host the request was prepared for
+ *	@mrq: MMC request that was prepared
+ *	@err: error, if the request was not started or did not complete
+ */
+void mmc_post_req(struct mmc_host *host, struct mmc_request *mrq, int err)
+{
+	if (host->ops->post_req)
+		host->ops->post_req(host, mrq, err);
+}
+
+EXPORT_SYMBOL(mmc_post_req);
+
 /**
  *	mmc_wait_for_cmd - start a command and wait for completion
  *	@host: MMC host to start command
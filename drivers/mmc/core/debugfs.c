@@ -161,6 +161,35 @@ static int mmc_clock_opt_set(void *data, u64 val)
 DEFINE_SIMPLE_ATTRIBUTE(mmc_clock_fops, mmc_clock_opt_get, mmc_clock_opt_set,
 	"%llu\n");
 
+static int mmc_async_stats_show(struct seq_file *s, void *data)
+{
+	struct mmc_host *host = s->private;
+
+	seq_printf(s, "prepared:\t%lu\n", host->async_stats.prepared);
+	seq_printf(s, "overlapped:\t%lu\n", host->async_stats.overlapped);
+	seq_printf(s, "discarded:\t%lu\n", host->async_stats.discarded);
+	seq_printf(s, "inline:\t\t%lu\n", host->async_stats.inline_prep);
+	seq_printf(s, "bumped:\t\t%lu\n", host->async_stats.bumped);
+	seq_printf(s, "prep us:\t%llu\n",
+		   div_u64(host->async_stats.prep_ns, NSEC_PER_USEC));
+	seq_printf(s, "overlap us:\t%llu\n",
+		   div_u64(host->async_stats.overlap_ns, NSEC_PER_USEC));
+
+	return 0;
+}
+
+static int mmc_async_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mmc_async_stats_show, inode->i_private);
+}
+
+static const struct file_operations mmc_async_stats_fops = {
+	.open		= mmc_async_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 void mmc_add_host_debugfs(struct mmc_host *host)
 {
 	struct dentry *root;
@@ -183,6 +212,10 @@ void mmc_add_host_debugfs(struct mmc_host *host)
 			&mmc_clock_fops))
 		goto err_node;
 
+	if (!debugfs_create_file("async_stats", S_IRUSR, root, host,
+			&mmc_async_stats_fops))
+		goto err_node;
+
 #ifdef CONFIG_MMC_CLKGATE
 	if (!debugfs_create_u32("clk_delay", (S_IRUSR | S_IWUSR),
 				root, &host->clk_delay))
@@ -284,6 +317,50 @@ static const struct file_operations mmc_dbg_ext_csd_fops = {
 	.llseek		= default_llseek,
 };
 
+static int mmc_packed_stats_show(struct seq_file *s, void *data)
+{
+	struct mmc_card *card = s->private;
+	struct mmc_packed_stats *stats = &card->packed_stats;
+	unsigned long writes;
+	int i;
+
+	writes = stats->packed_reqs + stats->single_writes;
+
+	seq_printf(s, "max packed writes:\t%u\n",
+		   card->ext_csd.max_packed_writes);
+	seq_printf(s, "packed commands:\t%lu\n", stats->packed_cmds);
+	seq_printf(s, "packed requests:\t%lu\n", stats->packed_reqs);
+	seq_printf(s, "single writes:\t\t%lu\n", stats->single_writes);
+	seq_printf(s, "failures:\t\t%lu\n", stats->failures);
+	seq_printf(s, "retried requests:\t%lu\n", stats->retried_reqs);
+	seq_printf(s, "packed ratio:\t\t%lu%%\n",
+		   writes ? stats->packed_reqs * 100 / writes : 0);
+	seq_printf(s, "requests per pack:\t%lu.%02lu\n",
+		   stats->packed_cmds ?
+		   stats->packed_reqs / stats->packed_cmds : 0,
+		   stats->packed_cmds ?
+		   stats->packed_reqs * 100 / stats->packed_cmds % 100 : 0);
+
+	for (i = 2; i <= MMC_PACKED_MAX_ENTRIES; i++)
+		if (stats->pack_size[i])
+			seq_printf(s, "packs of %d:\t\t%lu\n", i,
+				   stats->pack_size[i]);
+
+	return 0;
+}
+
+static int mmc_packed_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mmc_packed_stats_show, inode->i_private);
+}
+
+static const struct file_operations mmc_dbg_packed_stats_fops = {
+	.open		= mmc_packed_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 void mmc_add_card_debugfs(struct mmc_card *card)
 {
 	struct mmc_host	*host = card->host;
@@ -316,6 +393,11 @@ void mmc_add_card_debugfs(struct mmc_card *card)
 					&mmc_dbg_ext_csd_fops))
 			goto err;
 
+	if (mmc_card_mmc(card) && card->ext_csd.max_packed_writes)
+		if (!debugfs_create_file("packed_stats", S_IRUSR, root, card,
+					&mmc_dbg_packed_stats_fops))
+			goto err;
+
 	return;
 
 err:
@@ -264,7 +264,7 @@ static inline unsigned short msmsdcc_get_nr_sg(struct msmsdcc_host *host)
 	unsigned short ret = NR_SG;
 
 	if (host->is_sps_mode) {
-		ret = SPS_MAX_DESCS;
+		ret = SPS_MAX_SEGS;
 	} else { /* DMA or PIO mode */
 		if (NR_SG > MAX_NR_SG_DMA_PIO)
 			ret = MAX_NR_SG_DMA_PIO;
@@ -688,8 +688,9 @@ msmsdcc_dma_complete_tlet(unsigned long data)
 		if (!mrq->data->error)
 			mrq->data->error = -EIO;
 	}
-	dma_unmap_sg(mmc_dev(host->mmc), host->dma.sg, host->dma.num_ents,
-		     host->dma.dir);
+	if (!mrq->data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), host->dma.sg,
+			     host->dma.num_ents, host->dma.dir);
 
 	if (host->curr.user_pages) {
 		struct scatterlist *sg = host->dma.sg;
@@ -854,9 +855,10 @@ static void msmsdcc_sps_complete_tlet(unsigned long data)
 			mrq->data->error = -EIO;
 	}
 
-	/* Unmap sg buffers */
-	dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg, host->sps.num_ents,
-			 host->sps.dir);
+	/* Unmap sg buffers, unless msmsdcc_post_req() will */
+	if (!mrq->data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg,
+			     host->sps.num_ents, host->sps.dir);
 
 	host->sps.sg = NULL;
 	host->sps.busy = 0;
@@ -925,9 +927,10 @@ static void msmsdcc_sps_exit_curr_xfer(struct msmsdcc_host *host)
 	if (!mrq->data->error)
 		mrq->data->error = -EIO;
 
-	/* Unmap sg buffers */
-	dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg, host->sps.num_ents,
-			 host->sps.dir);
+	/* Unmap sg buffers, unless msmsdcc_post_req() will */
+	if (!mrq->data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg,
+			     host->sps.num_ents, host->sps.dir);
 
 	host->sps.sg = NULL;
 	host->sps.busy = 0;
@@ -975,6 +978,54 @@ static int msmsdcc_check_dma_op_req(struct mmc_data *data)
 		return 0;
 }
 
+/*
+ * Map the data of a request for DMA ahead of msmsdcc_request(), possibly
+ * while another request is being transferred.  Transfers that will be
+ * done in PIO mode are left alone.
+ */
+static void
+msmsdcc_pre_req(struct mmc_host *mmc, struct mmc_request *mrq)
+{
+	struct msmsdcc_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+	enum dma_data_direction dir;
+	int n;
+
+	if (!data || data->host_cookie)
+		return;
+
+	if (!(host->is_dma_mode || host->is_sps_mode) ||
+	    msmsdcc_check_dma_op_req(data) ||
+	    data->sg_len > msmsdcc_get_nr_sg(host))
+		return;
+
+	if (data->flags & MMC_DATA_READ)
+		dir = DMA_FROM_DEVICE;
+	else
+		dir = DMA_TO_DEVICE;
+
+	n = dma_map_sg(mmc_dev(mmc), data->sg, data->sg_len, dir);
+	if (!n)
+		return;
+
+	/* Entries may have been merged, remember how many are left */
+	data->host_cookie = n;
+}
+
+static void
+msmsdcc_post_req(struct mmc_host *mmc, struct mmc_request *mrq, int err)
+{
+	struct mmc_data *data = mrq->data;
+
+	if (!data || !data->host_cookie)
+		return;
+
+	dma_unmap_sg(mmc_dev(mmc), data->sg, data->sg_len,
+		     (data->flags & MMC_DATA_READ) ?
+		     DMA_FROM_DEVICE : DMA_TO_DEVICE);
+	data->host_cookie = 0;
+}
+
 static int msmsdcc_config_dma(struct msmsdcc_host *host, struct mmc_data *data)
 {
 	struct msmsdcc_nc_dmadata *nc;
@@ -982,7 +1033,7 @@ static int msmsdcc_config_dma(struct msmsdcc_host *host, struct mmc_data *data)
 	uint32_t rows;
 	unsigned int n;
 	int i, err = 0, box_cmd_cnt = 0;
-	struct scatterlist *sg = data->sg;
+	struct scatterlist *sg;
 	unsigned int len, offset;
 
 	if ((host->dma.channel == -1) || (host->dma.crci == -1))
@@ -1003,10 +1054,13 @@ static int msmsdcc_config_dma(struct msmsdcc_host *host, struct mmc_data *data)
 	else
 		host->dma.dir = DMA_TO_DEVICE;
 
-	n = dma_map_sg(mmc_dev(host->mmc), host->dma.sg,
-			host->dma.num_ents, host->dma.dir);
+	if (data->host_cookie)
+		n = data->host_cookie;
+	else
+		n = dma_map_sg(mmc_dev(host->mmc), host->dma.sg,
+				host->dma.num_ents, host->dma.dir);
 
-	if (n != host->dma.num_ents) {
+	if (!n) {
 		pr_err("[SD] %s: Unable to map in all sg elements\n",
 		       mmc_hostname(host->mmc));
 		host->dma.sg = NULL;
@@ -1017,7 +1071,7 @@ static int msmsdcc_config_dma(struct msmsdcc_host *host, struct mmc_data *data)
 	/* host->curr.user_pages = (data->flags & MMC_DATA_USERPAGE); */
 	host->curr.user_pages = 0;
 	box = &nc->cmd[0];
-	for (i = 0; i < host->dma.num_ents; i++) {
+	for_each_sg(host->dma.sg, sg, n, i) {
 		len = sg_dma_len(sg);
 		offset = 0;
 
@@ -1061,7 +1115,6 @@ static int msmsdcc_config_dma(struct msmsdcc_host *host, struct mmc_data *data)
 			box++;
 			box_cmd_cnt++;
 		} while (len);
-		sg++;
 	}
 	/* Mark last command */
 	box--;
@@ -1082,6 +1135,9 @@ unmap:
 	if (err) {
 		dma_unmap_sg(mmc_dev(host->mmc), host->dma.sg,
 				host->dma.num_ents, host->dma.dir);
+		data->host_cookie = 0;
+		host->dma.sg = NULL;
+		host->dma.num_ents = 0;
 		pr_err("[SD] %s: cannot do DMA, fall back to PIO mode err=%d\n",
 				mmc_hostname(host->mmc), err);
 	}
@@ -1090,6 +1146,19 @@ unmap:
 }
 
 #ifdef CONFIG_MMC_MSM_SPS_SUPPORT
+/* Number of BAM descriptors needed for the first @n mapped entries */
+static unsigned int msmsdcc_sps_nr_descs(struct scatterlist *sgl, int n)
+{
+	struct scatterlist *sg;
+	unsigned int descs = 0;
+	int i;
+
+	for_each_sg(sgl, sg, n, i)
+		descs += DIV_ROUND_UP(sg_dma_len(sg), SPS_MAX_DESC_SIZE);
+
+	return descs;
+}
+
 /**
  * Submits data transfer request to SPS driver
  *
@@ -1107,9 +1176,9 @@ static int msmsdcc_sps_start_xfer(struct msmsdcc_host *host,
 {
 	int rc = 0;
 	u32 flags;
-	int i;
+	int i, n;
 	u32 addr, len, data_cnt;
-	struct scatterlist *sg = data->sg;
+	struct scatterlist *sg;
 	struct sps_pipe *sps_pipe_handle;
 
 	/* Prevent memory corruption */
@@ -1126,16 +1195,28 @@ static int msmsdcc_sps_start_xfer(struct msmsdcc_host *host,
 		sps_pipe_handle = host->sps.cons.pipe_handle;
 	}
 
-	/* Make sg buffers DMA ready */
-	rc = dma_map_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
-			host->sps.dir);
+	/* Make sg buffers DMA ready, unless msmsdcc_pre_req() did */
+	if (data->host_cookie)
+		n = data->host_cookie;
+	else
+		n = dma_map_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+				host->sps.dir);
 
-	if (rc != data->sg_len) {
-		pr_err("[SD] %s: Unable to map in all sg elements, rc=%d\n",
-		       mmc_hostname(host->mmc), rc);
+	if (!n) {
+		pr_err("[SD] %s: Unable to map in all sg elements\n",
+		       mmc_hostname(host->mmc));
 		host->sps.sg = NULL;
 		host->sps.num_ents = 0;
-		rc = -ENOMEM;
+		return -ENOMEM;
+	}
+
+	/*
+	 * Queue nothing unless all of it fits the descriptor FIFO, a
+	 * transfer cut short by a full FIFO would leave the pipe with
+	 * descriptors nobody waits for.
+	 */
+	if (msmsdcc_sps_nr_descs(data->sg, n) > SPS_MAX_DESCS - 1) {
+		rc = -ENOSPC;
 		goto dma_map_err;
 	}
 
@@ -1144,7 +1225,7 @@ static int msmsdcc_sps_start_xfer(struct msmsdcc_host *host,
 		host->sps.dir == DMA_FROM_DEVICE ? "READ" : "WRITE",
 		(u32)sps_pipe_handle, host->curr.xfer_size, data->sg_len);
 
-	for (i = 0; i < data->sg_len; i++) {
+	for_each_sg(data->sg, sg, n, i) {
 		/*
 		 * Check if this is the last buffer to transfer?
 		 * If yes then set the INT and EOT flags.
@@ -1157,7 +1238,7 @@ static int msmsdcc_sps_start_xfer(struct msmsdcc_host *host,
 				data_cnt = SPS_MAX_DESC_SIZE;
 			} else {
 				data_cnt = len;
-				if (i == data->sg_len - 1)
+				if (i == n - 1)
 					flags = SPS_IOVEC_FLAG_INT |
 						SPS_IOVEC_FLAG_EOT;
 			}
@@ -1174,7 +1255,6 @@ static int msmsdcc_sps_start_xfer(struct msmsdcc_host *host,
 			len -= data_cnt;
 			host->sps.xfer_req_cnt++;
 		}
-		sg++;
 	}
 	goto out;
 
@@ -1182,6 +1262,10 @@ dma_map_err:
 	/* unmap sg buffers */
 	dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg, host->sps.num_ents,
 			host->sps.dir);
+	data->host_cookie = 0;
+	/* the data goes by PIO, the error path must not stop the pipe */
+	host->sps.sg = NULL;
+	host->sps.num_ents = 0;
 out:
 	return rc;
 }
@@ -1314,6 +1398,14 @@ msmsdcc_start_data(struct msmsdcc_host *host, struct mmc_data *data,
 	/* Is data transfer in PIO mode required? */
 	if (!(datactrl & MCI_DPSM_DMAENABLE)) {
 		host->use_pio = 1;
+		host->bounced_bytes += host->curr.xfer_size;
+		if ((host->is_dma_mode || host->is_sps_mode) &&
+		    !msmsdcc_check_dma_op_req(data))
+			host->dma_fallbacks++;
+
+		/* The CPU accesses the buffers, drop an early DMA mapping */
+		if (data->host_cookie)
+			msmsdcc_post_req(host->mmc, data->mrq, -EINVAL);
 
 		if (data->flags & MMC_DATA_READ) {
 			pio_irqmask = MCI_RXFIFOHALFFULLMASK;
@@ -1324,8 +1416,10 @@ msmsdcc_start_data(struct msmsdcc_host *host, struct mmc_data *data,
 					MCI_TXFIFOEMPTYMASK;
 
 		msmsdcc_sg_start(host);
-	} else
+	} else {
 		host->use_pio = 0;
+		host->direct_bytes += host->curr.xfer_size;
+	}
 
 	if (data->flags & MMC_DATA_READ)
 		datactrl |= (MCI_DPSM_DIRECTION | MCI_RX_DATA_PEND);
@@ -3581,6 +3675,8 @@ static const struct mmc_host_ops msmsdcc_ops = {
 	.enable		= msmsdcc_enable,
 	.disable	= msmsdcc_disable,
 	.request	= msmsdcc_request,
+	.pre_req	= msmsdcc_pre_req,
+	.post_req	= msmsdcc_post_req,
 	.set_ios	= msmsdcc_set_ios,
 	.get_ro		= msmsdcc_get_ro,
 #ifdef CONFIG_MMC_MSM_SDIO_SUPPORT
@@ -3629,6 +3725,8 @@ static const struct mmc_host_ops msmsdcc_ops_sd = {
 	.enable		= msmsdcc_enable,
 	.disable	= msmsdcc_disable,
 	.request	= msmsdcc_request,
+	.pre_req	= msmsdcc_pre_req,
+	.post_req	= msmsdcc_post_req,
 	.set_ios	= msmsdcc_set_ios,
 	.get_ro		= msmsdcc_get_ro,
 #ifdef CONFIG_MMC_MSM_SDIO_SUPPORT
@@ -5473,7 +5571,7 @@ msmsdcc_dbg_state_read(struct file *file, char __user *ubuf,
 		       size_t count, loff_t *ppos)
 {
 	struct msmsdcc_host *host = (struct msmsdcc_host *) file->private_data;
-	char buf[200];
+	char buf[300];
 	int max, i;
 
 	i = 0;
@@ -5498,6 +5596,10 @@ msmsdcc_dbg_state_read(struct file *file, char __user *ubuf,
 			      host->curr.xfer_size, host->curr.xfer_remain,
 			      host->curr.data_xfered, host->dma.sg);
 	}
+	i += scnprintf(buf + i, max - i,
+		      "XFER: direct %llu bounced %llu fallbacks %u\n",
+		      host->direct_bytes, host->bounced_bytes,
+		      host->dma_fallbacks);
 
 	return simple_read_from_buffer(ubuf, count, ppos, buf, i);
 }
@@ -247,6 +247,12 @@
 /* Each descriptor is of length 8 bytes */
 #define SPS_MAX_DESC_LENGTH	8
 #define SPS_MAX_DESCS		(SPS_MAX_DESC_FIFO_SIZE / SPS_MAX_DESC_LENGTH)
+/*
+ * A segment takes one descriptor per SPS_MAX_DESC_SIZE bytes plus one for
+ * the remainder; with this many segments any request fits the FIFO.
+ */
+#define SPS_MAX_SEGS		(SPS_MAX_DESCS - 1 - \
+		DIV_ROUND_UP(MMC_MAX_REQ_SIZE, SPS_MAX_DESC_SIZE))
 
 /*
  * DMA limitations
@@ -411,6 +417,11 @@ struct msmsdcc_host {
 	unsigned int	irq_status[5];
 	unsigned int	irq_counter;
 
+	/* data moved by DMA vs copied through the FIFO by the CPU */
+	u64		direct_bytes;
+	u64		bounced_bytes;
+	unsigned int	dma_fallbacks;	/* DMA was possible but failed */
+
 #ifdef CONFIG_WIMAX
     bool        is_runtime_resumed;
 #endif
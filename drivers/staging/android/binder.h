@@ -37,6 +37,17 @@ enum {
 enum {
 	FLAT_BINDER_FLAG_PRIORITY_MASK = 0xff,
 	FLAT_BINDER_FLAG_ACCEPTS_FDS = 0x100,
+	/*
+	 * Scheduling policy (SCHED_NORMAL, SCHED_FIFO, SCHED_RR or
+	 * SCHED_BATCH) the minimum priority above applies to. For
+	 * SCHED_NORMAL and SCHED_BATCH the priority is a nice value,
+	 * otherwise it is a real-time priority.
+	 */
+	FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT = 9,
+	FLAT_BINDER_FLAG_SCHED_POLICY_MASK =
+		3U << FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT,
+	/* let real-time callers run this node's transactions real-time */
+	FLAT_BINDER_FLAG_INHERIT_RT = 0x800,
 };
 
 /*
@@ -25,40 +25,89 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+/*
+ * Each CPU stages freshly written entries in a small buffer of its own, so
+ * writers only contend with other writers on the same CPU and never sleep
+ * while holding a lock. Staged entries are moved into the ring, oldest
+ * first, whenever a reader looks at the log or a staging buffer fills up.
+ *
+ * Timestamps only change once per tick, so they can not tell which of two
+ * entries staged on different CPUs came first.  Each entry is preceded in
+ * its staging buffer by a sequence number, taken from the log when it is
+ * staged, and the entries are merged on that.  Staged entries start on
+ * 4-byte boundaries.
+ */
+#define LOGGER_STAGE_HDR	sizeof(u32)
+#define LOGGER_STAGED_LEN(len)	(LOGGER_STAGE_HDR + ALIGN(len, 4))
+#define LOGGER_STAGE_SIZE	(2 * LOGGER_STAGED_LEN(LOGGER_ENTRY_MAX_LEN))
+
+/*
+ * struct logger_stage - per-CPU staging area of a log
+ *
+ * 'buf', 'len' and 'held' are protected by 'lock'. 'spare' holds the
+ * entries being drained into the ring and is only touched with log->lock
+ * held. Entries staged while a drain runs may be kept in 'spare' for the
+ * next one; 'held' makes writers leave room to move them back.
+ */
+struct logger_stage {
+	spinlock_t		lock;	/* protects buf, len and held */
+	unsigned char		*buf;	/* entries not yet in the ring */
+	size_t			len;	/* bytes used in buf */
+	size_t			held;	/* bytes of buf reserved for spare */
+	unsigned char		*spare;	/* buffer being drained */
+	size_t			spare_len; /* bytes used in spare */
+	size_t			spare_pos; /* next entry to drain */
+};
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting. The ring buffer and the readers are
+ * protected by the spinlock 'lock'.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
+	spinlock_t		lock;	/* lock protecting buffer */
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	struct logger_stage __percpu *stages; /* per-CPU staging areas */
+	atomic_t		seq;	/* sequence number of the last staged entry */
 };
 
 /*
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by log->lock, except for
+ * the read buffer which belongs to whoever holds 'mutex'.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	unsigned int		laps;	/* times pulled forward by writers */
+	struct mutex		mutex;	/* serializes reads, protects below */
+	int			batch;	/* read() returns many entries */
+	unsigned char		*buf;	/* entry bounce buffer */
+	size_t			buf_size; /* size of buf */
 };
 
+/* bounce buffer size for readers in LOGGER_READ_BATCH mode */
+#define LOGGER_BATCH_BUF_SIZE	(4 * LOGGER_ENTRY_MAX_LEN)
+
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
@@ -89,7 +138,7 @@ static inline struct logger_log *file_get_log(struct file *file)
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
@@ -108,15 +157,15 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * do_read_log - copies exactly 'count' bytes of the next entry into 'buf'
+ * and advances the reader past it.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static void do_read_log(struct logger_log *log,
+			struct logger_reader *reader,
+			unsigned char *buf,
+			size_t count)
 {
 	size_t len;
 
@@ -126,98 +175,23 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the log, whichever comes first.
 	 */
 	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
-		return -EFAULT;
+	memcpy(buf, log->buffer + reader->r_off, len);
 
 	/*
 	 * Second, we read any remaining bytes, starting back at the head of
 	 * the log.
 	 */
 	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+		memcpy(buf + len, log->buffer, count - len);
 
 	reader->r_off = logger_offset(reader->r_off + count);
-
-	return count;
-}
-
-/*
- * logger_read - our log's read() method
- *
- * Behavior:
- *
- * 	- O_NONBLOCK works
- * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
- *
- * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
- * buffer is insufficient to hold next entry.
- */
-static ssize_t logger_read(struct file *file, char __user *buf,
-			   size_t count, loff_t *pos)
-{
-	struct logger_reader *reader = file->private_data;
-	struct logger_log *log = reader->log;
-	ssize_t ret;
-	DEFINE_WAIT(wait);
-
-start:
-	while (1) {
-		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
-
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
-		if (!ret)
-			break;
-
-		if (file->f_flags & O_NONBLOCK) {
-			ret = -EAGAIN;
-			break;
-		}
-
-		if (signal_pending(current)) {
-			ret = -EINTR;
-			break;
-		}
-
-		schedule();
-	}
-
-	finish_wait(&log->wq, &wait);
-	if (ret)
-		return ret;
-
-	mutex_lock(&log->mutex);
-
-	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
-		goto start;
-	}
-
-	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
-	if (count < ret) {
-		ret = -EINVAL;
-		goto out;
-	}
-
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
-
-out:
-	mutex_unlock(&log->mutex);
-
-	return ret;
 }
 
 /*
  * get_next_entry - return the offset of the first valid entry at least 'len'
  * bytes after 'off'.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
 static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
 {
@@ -255,7 +229,7 @@ static inline int clock_interval(size_t a, size_t b, size_t c)
  * We do this by "pulling forward" the readers and start head to the first
  * entry after the new write head.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void fix_up_readers(struct logger_log *log, size_t len)
 {
@@ -267,14 +241,16 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 		log->head = get_next_entry(log, log->head, len);
 
 	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
+		if (clock_interval(old, new, reader->r_off)) {
 			reader->r_off = get_next_entry(log, reader->r_off, len);
+			reader->laps++;
+		}
 }
 
 /*
  * do_write_log - writes 'len' bytes from 'buf' to 'log'
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 {
@@ -290,44 +266,280 @@ static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 
 }
 
+/* seq_before - was the entry with sequence number 'a' staged before 'b'? */
+static inline int seq_before(u32 a, u32 b)
+{
+	return (s32)(a - b) < 0;
+}
+
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * logger_drain - moves the entries staged on every CPU into the ring,
+ * merging them by sequence number.
  *
- * The caller needs to hold log->mutex.
+ * Only entries staged before the drain started are moved: one staged on
+ * a CPU already looked at may be newer than one staged after it on a CPU
+ * not looked at yet. Later entries are kept for the next drain.
  *
- * Returns 'count' on success, negative error code on failure.
+ * The caller needs to hold log->lock.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static void logger_drain(struct logger_log *log)
 {
-	size_t len;
+	struct logger_stage *stage;
+	u32 last = atomic_read(&log->seq);
+	int staged = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		unsigned char *buf;
+		size_t left;
+
+		stage = per_cpu_ptr(log->stages, cpu);
+		spin_lock(&stage->lock);
+		left = stage->spare_len - stage->spare_pos;
+		if (stage->len && !left) {
+			buf = stage->buf;
+			stage->buf = stage->spare;
+			stage->spare = buf;
+			stage->spare_len = stage->len;
+			stage->spare_pos = 0;
+			stage->len = 0;
+		} else if (stage->len) {
+			/* 'held' kept room for the entries left last time */
+			memmove(stage->spare, stage->spare + stage->spare_pos,
+				left);
+			memcpy(stage->spare + left, stage->buf, stage->len);
+			stage->spare_len = left + stage->len;
+			stage->spare_pos = 0;
+			stage->len = 0;
+		}
+		stage->held = stage->spare_len - stage->spare_pos;
+		if (stage->held)
+			staged = 1;
+		spin_unlock(&stage->lock);
+	}
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	while (staged) {
+		struct logger_stage *oldest = NULL;
+		struct logger_entry *first;
+		u32 seq, first_seq = 0;
+		size_t len;
 
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
+		for_each_possible_cpu(cpu) {
+			stage = per_cpu_ptr(log->stages, cpu);
+			if (stage->spare_pos == stage->spare_len)
+				continue;
+			seq = *(u32 *)(stage->spare + stage->spare_pos);
+			if (seq_before(last, seq))
+				continue;
+			if (!oldest || seq_before(seq, first_seq)) {
+				oldest = stage;
+				first_seq = seq;
+			}
+		}
+		if (!oldest)
+			break;
 
-	log->w_off = logger_offset(log->w_off + count);
+		first = (struct logger_entry *)
+			(oldest->spare + oldest->spare_pos + LOGGER_STAGE_HDR);
+		len = sizeof(struct logger_entry) + first->len;
+		fix_up_readers(log, len);
+		do_write_log(log, first, len);
+		oldest->spare_pos += LOGGER_STAGED_LEN(len);
+	}
+
+	if (!staged)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		stage = per_cpu_ptr(log->stages, cpu);
+		spin_lock(&stage->lock);
+		stage->held = stage->spare_len - stage->spare_pos;
+		spin_unlock(&stage->lock);
+	}
+}
+
+/*
+ * logger_readable - drains the staged entries and tells whether 'reader'
+ * has anything left to read.
+ */
+static int logger_readable(struct logger_log *log,
+			   struct logger_reader *reader)
+{
+	int ret;
+
+	spin_lock(&log->lock);
+	logger_drain(log);
+	ret = log->w_off != reader->r_off;
+	spin_unlock(&log->lock);
+
+	return ret;
+}
+
+/*
+ * logger_read - our log's read() method
+ *
+ * Behavior:
+ *
+ * 	- O_NONBLOCK works
+ * 	- If there are no log entries to read, blocks until log is written to
+ * 	- Atomically reads exactly one log entry, or in LOGGER_READ_BATCH mode
+ * 	  as many complete entries as fit in the buffer
+ *
+ * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
+ * buffer is insufficient to hold next entry.
+ */
+static ssize_t logger_read(struct file *file, char __user *buf,
+			   size_t count, loff_t *pos)
+{
+	struct logger_reader *reader = file->private_data;
+	struct logger_log *log = reader->log;
+	ssize_t ret;
+	DEFINE_WAIT(wait);
+
+start:
+	while (1) {
+		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
+
+		ret = !logger_readable(log, reader);
+		if (!ret)
+			break;
+
+		if (file->f_flags & O_NONBLOCK) {
+			ret = -EAGAIN;
+			break;
+		}
+
+		if (signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+
+		schedule();
+	}
+
+	finish_wait(&log->wq, &wait);
+	if (ret)
+		return ret;
+
+	mutex_lock(&reader->mutex);
+	spin_lock(&log->lock);
+
+	/* is there still something to read or did we race? */
+	if (unlikely(log->w_off == reader->r_off)) {
+		spin_unlock(&log->lock);
+		mutex_unlock(&reader->mutex);
+		goto start;
+	}
+
+	/* get the size of the next entry */
+	ret = get_entry_len(log, reader->r_off);
+	if (count < ret) {
+		spin_unlock(&log->lock);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (!reader->batch) {
+		/* get exactly one entry from the log */
+		do_read_log(log, reader, reader->buf, ret);
+		spin_unlock(&log->lock);
+
+		if (copy_to_user(buf, reader->buf, ret))
+			ret = -EFAULT;
+		goto out;
+	}
+
+	/*
+	 * Batch mode: fill the bounce buffer with whole entries, copy them
+	 * out with the lock dropped and repeat until the user buffer is full
+	 * or the log is empty.
+	 */
+	ret = 0;
+	while (1) {
+		size_t len = 0;
+
+		while (log->w_off != reader->r_off) {
+			size_t nr = get_entry_len(log, reader->r_off);
+
+			if (ret + len + nr > count ||
+			    len + nr > reader->buf_size)
+				break;
+			do_read_log(log, reader, reader->buf + len, nr);
+			len += nr;
+		}
+		spin_unlock(&log->lock);
+
+		if (!len)
+			break;
+		if (copy_to_user(buf + ret, reader->buf, len)) {
+			if (!ret)
+				ret = -EFAULT;
+			break;
+		}
+		ret += len;
+
+		spin_lock(&log->lock);
+	}
 
-	return count;
+out:
+	mutex_unlock(&reader->mutex);
+	return ret;
+}
+
+/*
+ * stage_entry_from_user - appends the entry 'header' with its payload taken
+ * from 'iov' to 'stage', without faulting.
+ *
+ * The caller needs to hold stage->lock and to have checked for room.
+ *
+ * Returns 0 on success, -EFAULT if the payload was not resident.
+ */
+static int stage_entry_from_user(struct logger_stage *stage,
+				 struct logger_entry *header,
+				 const struct iovec *iov)
+{
+	unsigned char *p = stage->buf + stage->len + LOGGER_STAGE_HDR;
+	size_t left = header->len;
+	int ret = 0;
+
+	memcpy(p, header, sizeof(struct logger_entry));
+	p += sizeof(struct logger_entry);
+
+	pagefault_disable();
+	while (left) {
+		size_t len = min_t(size_t, iov->iov_len, left);
+
+		if (__copy_from_user_inatomic(p, iov->iov_base, len)) {
+			ret = -EFAULT;
+			break;
+		}
+		p += len;
+		left -= len;
+		iov++;
+	}
+	pagefault_enable();
+
+	return ret;
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The entry is staged on the current CPU. The payload is copied straight
+ * from user space with page faults disabled; if that fails it is first
+ * copied into a temporary buffer outside of any lock.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	struct logger_stage *stage;
 	struct logger_entry header;
 	struct timespec now;
+	unsigned char *entry = NULL;
+	size_t len;
 	ssize_t ret = 0;
 
 	now = current_kernel_time();
@@ -337,43 +549,58 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	header.sec = now.tv_sec;
 	header.nsec = now.tv_nsec;
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
+	header.__pad = 0;
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	len = sizeof(struct logger_entry) + header.len;
 
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+retry:
+	stage = per_cpu_ptr(log->stages, raw_smp_processor_id());
+	spin_lock(&stage->lock);
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	if (stage->held + stage->len + LOGGER_STAGED_LEN(len) >
+	    LOGGER_STAGE_SIZE) {
+		spin_unlock(&stage->lock);
+		spin_lock(&log->lock);
+		logger_drain(log);
+		spin_unlock(&log->lock);
+		goto retry;
+	}
 
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
+	if (entry)
+		memcpy(stage->buf + stage->len + LOGGER_STAGE_HDR, entry, len);
+	else if (stage_entry_from_user(stage, &header, iov)) {
+		size_t off = sizeof(struct logger_entry);
+		size_t left = header.len;
 
-		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
+		spin_unlock(&stage->lock);
 
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		entry = kmalloc(len, GFP_KERNEL);
+		if (!entry)
+			return -ENOMEM;
+		memcpy(entry, &header, sizeof(struct logger_entry));
+		while (nr_segs-- > 0 && left) {
+			size_t seg = min_t(size_t, iov->iov_len, left);
+
+			if (copy_from_user(entry + off, iov->iov_base, seg)) {
+				kfree(entry);
+				return -EFAULT;
+			}
+			off += seg;
+			left -= seg;
+			iov++;
 		}
-
-		iov++;
-		ret += nr;
+		goto retry;
 	}
+	*(u32 *)(stage->buf + stage->len) = atomic_inc_return(&log->seq);
+	stage->len += LOGGER_STAGED_LEN(len);
+	ret = header.len;
 
-	mutex_unlock(&log->mutex);
+	spin_unlock(&stage->lock);
+	kfree(entry);
 
 	/* wake up any blocked readers */
 	wake_up_interruptible(&log->wq);
@@ -408,13 +635,23 @@ static int logger_open(struct inode *inode, struct file *file)
 		if (!reader)
 			return -ENOMEM;
 
+		reader->buf = kmalloc(LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+		if (!reader->buf) {
+			kfree(reader);
+			return -ENOMEM;
+		}
+		reader->buf_size = LOGGER_ENTRY_MAX_LEN;
+		reader->batch = 0;
+		reader->laps = 0;
+		mutex_init(&reader->mutex);
+
 		reader->log = log;
 		INIT_LIST_HEAD(&reader->list);
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		reader->r_off = log->head;
 		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
 		file->private_data = reader;
 	} else
@@ -433,9 +670,10 @@ static int logger_release(struct inode *ignored, struct file *file)
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
 		struct logger_log *log = reader->log;
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		list_del(&reader->list);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
+		kfree(reader->buf);
 		kfree(reader);
 	}
 
@@ -465,21 +703,151 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	if (logger_readable(log, reader))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
 
 	return ret;
 }
 
+/*
+ * logger_set_read_mode - switches 'reader' between returning one entry and
+ * as many entries as fit per read().
+ */
+static long logger_set_read_mode(struct logger_reader *reader,
+				 unsigned long mode)
+{
+	unsigned char *buf;
+
+	if (mode != LOGGER_READ_SINGLE && mode != LOGGER_READ_BATCH)
+		return -EINVAL;
+
+	mutex_lock(&reader->mutex);
+	if (mode == LOGGER_READ_BATCH &&
+	    reader->buf_size < LOGGER_BATCH_BUF_SIZE) {
+		buf = kmalloc(LOGGER_BATCH_BUF_SIZE, GFP_KERNEL);
+		if (!buf) {
+			mutex_unlock(&reader->mutex);
+			return -ENOMEM;
+		}
+		kfree(reader->buf);
+		reader->buf = buf;
+		reader->buf_size = LOGGER_BATCH_BUF_SIZE;
+	}
+	reader->batch = (mode == LOGGER_READ_BATCH);
+	mutex_unlock(&reader->mutex);
+
+	return 0;
+}
+
+/*
+ * logger_get_cursor - drains the staged entries and reports where 'reader'
+ * stands in the ring, for readers consuming the log through mmap().
+ */
+static long logger_get_cursor(struct logger_log *log,
+			      struct logger_reader *reader,
+			      void __user *arg)
+{
+	struct logger_cursor cursor;
+
+	spin_lock(&log->lock);
+	logger_drain(log);
+	cursor.r_off = reader->r_off;
+	cursor.w_off = log->w_off;
+	cursor.laps = reader->laps;
+	spin_unlock(&log->lock);
+
+	if (copy_to_user(arg, &cursor, sizeof(cursor)))
+		return -EFAULT;
+
+	return 0;
+}
+
+/*
+ * logger_commit_read - moves 'reader' forward to cursor.r_off once it has
+ * consumed the entries up to there from the mapped ring. Fails with
+ * -ESTALE if a writer lapped the reader since LOGGER_GET_CURSOR, as the
+ * entries it saw may have been overwritten meanwhile.
+ */
+static long logger_commit_read(struct logger_log *log,
+			       struct logger_reader *reader,
+			       void __user *arg)
+{
+	struct logger_cursor cursor;
+	size_t off;
+	long ret = -EINVAL;
+
+	if (copy_from_user(&cursor, arg, sizeof(cursor)))
+		return -EFAULT;
+
+	spin_lock(&log->lock);
+
+	if (cursor.laps != reader->laps) {
+		ret = -ESTALE;
+		goto out;
+	}
+
+	/* the new offset has to be an entry boundary not past the writer */
+	off = reader->r_off;
+	while (off != cursor.r_off && off != log->w_off)
+		off = logger_offset(off + get_entry_len(log, off));
+	if (off == cursor.r_off) {
+		reader->r_off = off;
+		ret = 0;
+	}
+
+out:
+	spin_unlock(&log->lock);
+
+	return ret;
+}
+
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps the whole ring read-only, so that readers can walk the entries
+ * between LOGGER_GET_CURSOR and LOGGER_COMMIT_READ without copying them.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+
+	log = file_get_log(file);
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != log->size)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_vmalloc_range(vma, log->buffer, 0);
+}
+
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
+	/* reader commands that need to sleep or copy to/from user space */
+	switch (cmd) {
+	case LOGGER_SET_READ_MODE:
+	case LOGGER_GET_CURSOR:
+	case LOGGER_COMMIT_READ:
+		if (!(file->f_mode & FMODE_READ))
+			return -EBADF;
+		reader = file->private_data;
+		if (cmd == LOGGER_SET_READ_MODE)
+			return logger_set_read_mode(reader, arg);
+		if (cmd == LOGGER_GET_CURSOR)
+			return logger_get_cursor(log, reader,
+						 (void __user *)arg);
+		return logger_commit_read(log, reader, (void __user *)arg);
+	}
+
+	spin_lock(&log->lock);
+	logger_drain(log);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -519,7 +887,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -529,6 +897,7 @@ static const struct file_operations logger_fops = {
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -541,9 +910,7 @@ static const struct file_operations logger_fops = {
  * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
 static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -552,10 +919,11 @@ static struct logger_log VAR = { \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
+	.seq = ATOMIC_INIT(0), \
 };
 
 DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 256*1024)
@@ -576,10 +944,59 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+static int __init init_stages(struct logger_log *log)
+{
+	int cpu;
+
+	log->stages = alloc_percpu(struct logger_stage);
+	if (!log->stages)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct logger_stage *stage = per_cpu_ptr(log->stages, cpu);
+
+		spin_lock_init(&stage->lock);
+		stage->buf = kmalloc(LOGGER_STAGE_SIZE, GFP_KERNEL);
+		stage->spare = kmalloc(LOGGER_STAGE_SIZE, GFP_KERNEL);
+		if (!stage->buf || !stage->spare)
+			goto err_alloc;
+	}
+
+	return 0;
+
+err_alloc:
+	for_each_possible_cpu(cpu) {
+		struct logger_stage *stage = per_cpu_ptr(log->stages, cpu);
+
+		kfree(stage->buf);
+		kfree(stage->spare);
+	}
+	free_percpu(log->stages);
+	log->stages = NULL;
+	return -ENOMEM;
+}
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	/* vmalloc_user() so that logger_mmap() can map the ring */
+	log->buffer = vmalloc_user(log->size);
+	if (unlikely(!log->buffer)) {
+		printk(KERN_ERR "logger: failed to allocate buffer for "
+		       "log '%s'!\n", log->misc.name);
+		return -ENOMEM;
+	}
+
+	ret = init_stages(log);
+	if (unlikely(ret)) {
+		printk(KERN_ERR "logger: failed to allocate staging "
+		       "buffers for log '%s'!\n", log->misc.name);
+		vfree(log->buffer);
+		log->buffer = NULL;
+		return ret;
+	}
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
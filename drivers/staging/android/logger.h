@@ -35,6 +35,20 @@ struct logger_entry {
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
 #define LOGGER_LOG_MAIN		"log_main"	/* everything else */
 
+/*
+ * struct logger_cursor - read position of a reader that consumes the log
+ * through mmap(). Entries between r_off and w_off are readable; 'laps'
+ * changes whenever writers overwrite entries the reader had not consumed.
+ */
+struct logger_cursor {
+	__u32		r_off;	/* reader's offset into the ring */
+	__u32		w_off;	/* end of the readable entries */
+	__u32		laps;	/* times the reader was lapped */
+};
+
+#define LOGGER_READ_SINGLE	0	/* read() returns one entry */
+#define LOGGER_READ_BATCH	1	/* read() returns all entries that fit */
+
 #define LOGGER_ENTRY_MAX_LEN		(4*1024)
 #define LOGGER_ENTRY_MAX_PAYLOAD	\
 	(LOGGER_ENTRY_MAX_LEN - sizeof(struct logger_entry))
@@ -45,5 +59,8 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_READ_MODE		_IO(__LOGGERIO, 5) /* LOGGER_READ_* */
+#define LOGGER_GET_CURSOR		_IOR(__LOGGERIO, 6, struct logger_cursor)
+#define LOGGER_COMMIT_READ		_IOW(__LOGGERIO, 7, struct logger_cursor)
 
 #endif /* _LINUX_LOGGER_H */
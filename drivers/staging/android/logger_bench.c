@@ -0,0 +1,200 @@
+/*
+ * drivers/staging/android/logger_bench.c
+ *
+ * Write latency benchmark for the Android log driver
+ *
+ * On load, runs 1..max_writers concurrent kernel threads, each of which
+ * writes 'writes' entries of 'payload' bytes to 'log_path' through the
+ * regular write() path, and reports latency percentiles for every run.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/fs.h>
+#include <linux/err.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include "logger.h"
+
+static char *log_path = "/dev/log/main";
+module_param(log_path, charp, S_IRUGO);
+
+static int max_writers = 4;
+module_param(max_writers, int, S_IRUGO);
+
+static int writes = 10000;
+module_param(writes, int, S_IRUGO);
+
+static int payload = 64;
+module_param(payload, int, S_IRUGO);
+
+#define BENCH_TAG	"logger_bench"
+
+struct bench_writer {
+	struct file		*filp;
+	u32			*lat;	/* per-write latency in ns */
+	int			err;	/* lat[] is not valid if set */
+	struct completion	done;
+};
+
+static DECLARE_COMPLETION(bench_start);
+
+static int bench_thread(void *data)
+{
+	struct bench_writer *w = data;
+	mm_segment_t old_fs;
+	char *buf;
+	loff_t pos = 0;
+	int i;
+
+	buf = kmalloc(payload, GFP_KERNEL);
+	if (!buf) {
+		w->err = -ENOMEM;
+		goto out;
+	}
+
+	/* priority, tag and message as written by liblog */
+	memset(buf, 'x', payload);
+	buf[0] = 3;
+	memcpy(buf + 1, BENCH_TAG, sizeof(BENCH_TAG));
+	buf[payload - 1] = '\0';
+
+	wait_for_completion(&bench_start);
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	for (i = 0; i < writes; i++) {
+		ktime_t start = ktime_get();
+		ssize_t n;
+
+		n = vfs_write(w->filp, (const char __user *)buf, payload, &pos);
+		w->lat[i] = ktime_to_ns(ktime_sub(ktime_get(), start));
+		if (n < 0) {
+			w->err = n;
+			break;
+		}
+	}
+	set_fs(old_fs);
+
+	kfree(buf);
+out:
+	complete(&w->done);
+	return 0;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static u32 percentile(u32 *lat, int n, int per_mille)
+{
+	return lat[(n - 1) * per_mille / 1000];
+}
+
+static int bench_run(int nr_writers)
+{
+	struct bench_writer *w;
+	struct file *filp;
+	u32 *lat;
+	int n = nr_writers * writes;
+	int started = 0;
+	int ret = 0;
+	int i;
+
+	filp = filp_open(log_path, O_WRONLY, 0);
+	if (IS_ERR(filp)) {
+		printk(KERN_ERR "logger_bench: cannot open %s (%ld)\n",
+		       log_path, PTR_ERR(filp));
+		return PTR_ERR(filp);
+	}
+
+	w = kcalloc(nr_writers, sizeof(*w), GFP_KERNEL);
+	lat = vmalloc(n * sizeof(*lat));
+	if (!w || !lat) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	INIT_COMPLETION(bench_start);
+	for (i = 0; i < nr_writers; i++) {
+		struct task_struct *task;
+
+		w[i].filp = filp;
+		w[i].lat = lat + i * writes;
+		init_completion(&w[i].done);
+		task = kthread_run(bench_thread, &w[i], "logger_bench/%d", i);
+		if (IS_ERR(task)) {
+			ret = PTR_ERR(task);
+			break;
+		}
+		started++;
+	}
+
+	complete_all(&bench_start);
+	for (i = 0; i < started; i++) {
+		wait_for_completion(&w[i].done);
+		if (!ret && w[i].err) {
+			printk(KERN_ERR "logger_bench: writer %d failed (%d)\n",
+			       i, w[i].err);
+			ret = w[i].err;
+		}
+	}
+	if (ret)
+		goto out;
+
+	sort(lat, n, sizeof(*lat), cmp_u32, NULL);
+	printk(KERN_INFO "logger_bench: %d writer(s), %d x %d bytes: "
+	       "p50 %u p90 %u p99 %u p99.9 %u max %u ns\n",
+	       nr_writers, writes, payload,
+	       percentile(lat, n, 500), percentile(lat, n, 900),
+	       percentile(lat, n, 990), percentile(lat, n, 999),
+	       lat[n - 1]);
+
+out:
+	vfree(lat);
+	kfree(w);
+	filp_close(filp, NULL);
+	return ret;
+}
+
+static int __init logger_bench_init(void)
+{
+	int ret = 0;
+	int i;
+
+	if (max_writers < 1 || writes < 1 ||
+	    payload < sizeof(BENCH_TAG) + 2 ||
+	    payload > LOGGER_ENTRY_MAX_PAYLOAD)
+		return -EINVAL;
+
+	for (i = 1; i <= max_writers && !ret; i++)
+		ret = bench_run(i);
+
+	return ret;
+}
+
+static void __exit logger_bench_exit(void)
+{
+}
+
+module_init(logger_bench_init);
+module_exit(logger_bench_exit);
+
+MODULE_DESCRIPTION("Android log driver write latency benchmark");
+MODULE_LICENSE("GPL");
@@ -16,6 +16,16 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Candidate processes are kept in an index bucketed by oom_adj, maintained
+ * from the fork, free and oom_adj notifiers, so the shrinker only has to
+ * look at the highest populated buckets instead of walking every task.
+ * Scan and kill latency counters are in
+ * /sys/module/lowmemorykiller/parameters/stats.
+ *
+ * The driver also listens for vmpressure levels (low, medium, critical) and,
+ * once free memory is below the largest minfree threshold, kills processes
+ * with an oom_adj of at least vmpressure_adj[level] before reclaim stalls.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -39,6 +49,14 @@
 #include <linux/memory_hotplug.h>
 #include <linux/dcache.h>
 #include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/hash.h>
+#include <linux/bitops.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/vmpressure.h>
 #include <../../../fs/proc/internal.h>
 
 static uint32_t lowmem_debug_level = 2;
@@ -81,6 +99,57 @@ static unsigned long lowmem_deathpending_timeout;
 static unsigned long lowmem_fork_boost_timeout;
 static uint32_t lowmem_fork_boost = 1;
 static int last_min_adj = OOM_ADJUST_MAX + 1;;
+static ktime_t lowmem_deathpending_start;
+static DEFINE_MUTEX(lowmem_scan_mutex);
+
+/* Minimum oom_adj killed at each vmpressure level, > OOM_ADJUST_MAX is off */
+static int lowmem_vmpressure_adj[VMPRESSURE_NUM_LEVELS] = {
+	OOM_ADJUST_MAX + 1,	/* low */
+	12,			/* medium */
+	9,			/* critical */
+};
+static int lowmem_vmpressure_adj_size = VMPRESSURE_NUM_LEVELS;
+
+/*
+ * Candidate index.  Every user process (thread group leader) has an entry
+ * in lmk_task_hash, keyed by its task_struct, and on the list of the bucket
+ * for its current oom_adj.  lmk_bucket_map has a bit set for each non-empty
+ * bucket.  All of it is protected by lmk_index_lock, which is taken from the
+ * task free notifier and so may be taken in softirq context.
+ *
+ * An entry may get lost if it could not be allocated from a notifier, or
+ * when a non-leader thread execs and takes over as group leader; both mark
+ * the index stale and the next scan rebuilds it from the task list.
+ */
+#define LMK_BUCKETS		(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+#define LMK_HASH_BITS		8
+
+struct lmk_task {
+	struct hlist_node hnode;
+	struct list_head node;
+	struct task_struct *task;
+	int bucket;
+};
+
+static DEFINE_SPINLOCK(lmk_index_lock);
+static struct hlist_head lmk_task_hash[1 << LMK_HASH_BITS];
+static struct list_head lmk_buckets[LMK_BUCKETS];
+static DECLARE_BITMAP(lmk_bucket_map, LMK_BUCKETS);
+static struct kmem_cache *lmk_task_cachep;
+static int lmk_index_stale;
+
+static struct lowmem_stats {
+	unsigned long scans;
+	unsigned long scan_us_total;
+	unsigned long scan_us_max;
+	unsigned long tasks_examined;
+	unsigned long kills;
+	unsigned long vmpressure_kills[VMPRESSURE_NUM_LEVELS];
+	unsigned long kill_latency_us_total;
+	unsigned long kill_latency_us_max;
+	unsigned long index_rebuilds;
+	unsigned long index_alloc_failures;
+} lowmem_stats;
 
 #define lowmem_print(level, x...)			\
 	do {						\
@@ -132,6 +201,125 @@ static int shrink_cache_possible(gfp_t gfp_mask) {
 	return ret;
 }
 
+static inline int lmk_adj_to_bucket(int adj)
+{
+	if (adj < OOM_DISABLE)
+		adj = OOM_DISABLE;
+	if (adj > OOM_ADJUST_MAX)
+		adj = OOM_ADJUST_MAX;
+	return adj - OOM_DISABLE;
+}
+
+static struct hlist_head *lmk_hash_head(struct task_struct *task)
+{
+	return &lmk_task_hash[hash_ptr(task, LMK_HASH_BITS)];
+}
+
+/* Call with lmk_index_lock held */
+static struct lmk_task *lmk_find_task(struct task_struct *task)
+{
+	struct lmk_task *e;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(e, n, lmk_hash_head(task), hnode) {
+		if (e->task == task)
+			return e;
+	}
+	return NULL;
+}
+
+/* Call with lmk_index_lock held */
+static void lmk_bucket_del(struct lmk_task *e)
+{
+	list_del(&e->node);
+	if (list_empty(&lmk_buckets[e->bucket]))
+		__clear_bit(e->bucket, lmk_bucket_map);
+}
+
+/* Call with lmk_index_lock held */
+static void lmk_bucket_add(struct lmk_task *e, int bucket)
+{
+	e->bucket = bucket;
+	list_add_tail(&e->node, &lmk_buckets[bucket]);
+	__set_bit(bucket, lmk_bucket_map);
+}
+
+/*
+ * Insert task into the index, or move it to the bucket matching its current
+ * oom_adj if it is already there.  May be called from atomic context.
+ */
+static void lmk_index_update(struct task_struct *task)
+{
+	struct lmk_task *e;
+	unsigned long flags;
+	int bucket;
+
+	if (task->flags & PF_KTHREAD)
+		return;
+
+	bucket = lmk_adj_to_bucket(task->signal->oom_adj);
+
+	spin_lock_irqsave(&lmk_index_lock, flags);
+	e = lmk_find_task(task);
+	if (e) {
+		if (e->bucket != bucket) {
+			lmk_bucket_del(e);
+			lmk_bucket_add(e, bucket);
+		}
+		goto out;
+	}
+
+	e = kmem_cache_alloc(lmk_task_cachep, GFP_ATOMIC);
+	if (!e) {
+		lowmem_stats.index_alloc_failures++;
+		lmk_index_stale = 1;
+		goto out;
+	}
+	e->task = task;
+	hlist_add_head(&e->hnode, lmk_hash_head(task));
+	lmk_bucket_add(e, bucket);
+out:
+	spin_unlock_irqrestore(&lmk_index_lock, flags);
+}
+
+static void lmk_index_remove(struct task_struct *task)
+{
+	struct lmk_task *e;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lmk_index_lock, flags);
+	e = lmk_find_task(task);
+	if (e) {
+		hlist_del(&e->hnode);
+		lmk_bucket_del(e);
+		/*
+		 * A leader that is no longer its own group leader was replaced
+		 * by an exec'ing thread that never went through the fork
+		 * notifier as a process.
+		 */
+		if (task->group_leader != task)
+			lmk_index_stale = 1;
+	}
+	spin_unlock_irqrestore(&lmk_index_lock, flags);
+
+	if (e)
+		kmem_cache_free(lmk_task_cachep, e);
+}
+
+/* Pick up any process the notifiers missed */
+static void lmk_index_rebuild(void)
+{
+	struct task_struct *p;
+
+	lmk_index_stale = 0;
+	lowmem_stats.index_rebuilds++;
+
+	read_lock(&tasklist_lock);
+	for_each_process(p)
+		lmk_index_update(p);
+	read_unlock(&tasklist_lock);
+}
+
 static int
 task_free_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -144,8 +332,17 @@ task_free_notify_func(struct notifier_block *self, unsigned long val, void *data
 {
 	struct task_struct *task = data;
 
-	if (task == lowmem_deathpending)
+	if (task == lowmem_deathpending) {
+		unsigned long us = ktime_us_delta(ktime_get(),
+						  lowmem_deathpending_start);
+
+		lowmem_stats.kill_latency_us_total += us;
+		if (us > lowmem_stats.kill_latency_us_max)
+			lowmem_stats.kill_latency_us_max = us;
 		lowmem_deathpending = NULL;
+	}
+
+	lmk_index_remove(task);
 
 	return NOTIFY_OK;
 }
@@ -160,8 +357,30 @@ static struct notifier_block task_fork_nb = {
 static int
 task_fork_notify_func(struct notifier_block *self, unsigned long val, void *data)
 {
+	struct task_struct *task = data;
+
 	lowmem_fork_boost_timeout = jiffies + (HZ << 1);
 
+	if (thread_group_leader(task))
+		lmk_index_update(task);
+
+	return NOTIFY_OK;
+}
+
+static int
+oom_adj_notify_func(struct notifier_block *self, unsigned long val, void *data);
+
+static struct notifier_block oom_adj_nb = {
+	.notifier_call	= oom_adj_notify_func,
+};
+
+static int
+oom_adj_notify_func(struct notifier_block *self, unsigned long val, void *data)
+{
+	struct task_struct *task = data;
+
+	lmk_index_update(task->group_leader);
+
 	return NOTIFY_OK;
 }
 
@@ -191,32 +410,19 @@ static int lmk_hotplug_callback(struct notifier_block *self,
 
 
 
-static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+static void lowmem_free_pages(int *other_free, int *other_file)
 {
-	struct task_struct *p;
-	struct task_struct *selected = NULL;
-	int rem = 0;
-	int tasksize;
-	int i;
-	int min_adj = OOM_ADJUST_MAX + 1;
-	int selected_tasksize = 0;
-	int selected_oom_adj;
-	int array_size = ARRAY_SIZE(lowmem_adj);
-	int other_free = global_page_state(NR_FREE_PAGES);
-	int other_file = global_page_state(NR_FILE_PAGES) -
-		global_page_state(NR_SHMEM) - global_page_state(NR_MLOCK);
-
-	int fork_boost = 0;
-	int *adj_array;
-	size_t *min_array;
-
 	struct zone *zone;
 
+	*other_free = global_page_state(NR_FREE_PAGES);
+	*other_file = global_page_state(NR_FILE_PAGES) -
+		global_page_state(NR_SHMEM) - global_page_state(NR_MLOCK);
+
 	if (offlining) {
 		/* Discount all free space in the section being offlined */
 		for_each_zone(zone) {
 			 if (zone_idx(zone) == ZONE_MOVABLE) {
-				other_free -= zone_page_state(zone,
+				*other_free -= zone_page_state(zone,
 						NR_FREE_PAGES);
 				lowmem_print(4, "lowmem_shrink discounted "
 					"%lu pages in movable zone\n",
@@ -224,6 +430,140 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			}
 		}
 	}
+}
+
+/*
+ * Pick the task with the highest oom_adj >= min_adj, the largest one among
+ * those, and send it SIGKILL.  Returns the size of the killed task in pages,
+ * or 0 if there was nothing to kill.  Call with lowmem_scan_mutex held.
+ */
+static int lowmem_kill_one(int min_adj, int other_free, int other_file,
+			   int fork_boost)
+{
+	struct task_struct *p;
+	struct task_struct *selected = NULL;
+	int tasksize;
+	int selected_tasksize = 0;
+	int selected_oom_adj = min_adj;
+	struct lmk_task *e;
+	unsigned long flags;
+	int bucket, min_bucket, nr_buckets;
+	int examined = 0;
+	ktime_t scan_start;
+	unsigned long scan_us;
+
+	if (lmk_index_stale)
+		lmk_index_rebuild();
+
+	scan_start = ktime_get();
+	min_bucket = lmk_adj_to_bucket(min_adj);
+	nr_buckets = LMK_BUCKETS;
+
+	read_lock(&tasklist_lock);
+	spin_lock_irqsave(&lmk_index_lock, flags);
+	/*
+	 * Walk the populated buckets from the highest oom_adj down and stop
+	 * at the first one holding a killable task; within that bucket the
+	 * largest task is picked, as before.
+	 */
+	while (!selected && nr_buckets > 0) {
+		bucket = find_last_bit(lmk_bucket_map, nr_buckets);
+		if (bucket >= nr_buckets || bucket < min_bucket)
+			break;
+		nr_buckets = bucket;
+
+		list_for_each_entry(e, &lmk_buckets[bucket], node) {
+			struct mm_struct *mm;
+			struct signal_struct *sig;
+			int oom_adj;
+
+			p = e->task;
+			examined++;
+			task_lock(p);
+			mm = p->mm;
+			sig = p->signal;
+			if (!mm || !sig) {
+				task_unlock(p);
+				continue;
+			}
+			oom_adj = sig->oom_adj;
+
+			if (oom_adj < min_adj) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(mm);
+			task_unlock(p);
+			if (tasksize <= 0)
+				continue;
+			if (selected) {
+				if (oom_adj < selected_oom_adj)
+					continue;
+				if (oom_adj == selected_oom_adj &&
+				    tasksize <= selected_tasksize)
+					continue;
+			}
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = oom_adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+				     p->pid, p->comm, oom_adj, tasksize);
+		}
+	}
+	spin_unlock_irqrestore(&lmk_index_lock, flags);
+
+	scan_us = ktime_us_delta(ktime_get(), scan_start);
+	lowmem_stats.scans++;
+	lowmem_stats.scan_us_total += scan_us;
+	if (scan_us > lowmem_stats.scan_us_max)
+		lowmem_stats.scan_us_max = scan_us;
+	lowmem_stats.tasks_examined += examined;
+
+	if (selected) {
+		if (last_min_adj > selected_oom_adj &&
+			(selected_oom_adj == 12 || selected_oom_adj == 9 || selected_oom_adj == 7)) {
+			last_min_adj = selected_oom_adj;
+			lowmem_print(1, "lowmem_shrink: monitor memory status at selected_oom_adj=%d\n", selected_oom_adj);
+			show_meminfo();
+			dump_tasks();
+		}
+
+		lowmem_print(1, "[%s] send sigkill to %d (%s), adj %d, size %dK, min_adj=%d,"
+			" free=%dK, file=%dK, fork_boost=%d\n",
+			     current->comm, selected->pid, selected->comm,
+			     selected_oom_adj, selected_tasksize << 2, min_adj,
+			     other_free << 2, other_file << 2, fork_boost << 2);
+		lowmem_deathpending = selected;
+		lowmem_deathpending_timeout = jiffies + HZ;
+		lowmem_deathpending_start = ktime_get();
+		lowmem_stats.kills++;
+		if (selected_oom_adj < 7)
+		{
+			show_meminfo();
+			dump_tasks();
+		}
+		force_sig(SIGKILL, selected);
+	}
+	read_unlock(&tasklist_lock);
+
+	return selected_tasksize;
+}
+
+static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	int rem = 0;
+	int i;
+	int min_adj = OOM_ADJUST_MAX + 1;
+	int array_size = ARRAY_SIZE(lowmem_adj);
+	int other_free;
+	int other_file;
+
+	int fork_boost = 0;
+	int *adj_array;
+	size_t *min_array;
+
+	lowmem_free_pages(&other_free, &other_file);
+
 	/*
 	 * If we already have a death outstanding, then
 	 * bail out right away; indicating to vmscan
@@ -275,85 +615,121 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     sc->nr_to_scan, sc->gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
-
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
-	}
 
-	if (selected) {
-		if (last_min_adj > selected_oom_adj &&
-			(selected_oom_adj == 12 || selected_oom_adj == 9 || selected_oom_adj == 7)) {
-			last_min_adj = selected_oom_adj;
-			lowmem_print(1, "lowmem_shrink: monitor memory status at selected_oom_adj=%d\n", selected_oom_adj);
-			show_meminfo();
-			dump_tasks();
-		}
+	/* A vmpressure kill is already being chosen; it will do */
+	if (!mutex_trylock(&lowmem_scan_mutex))
+		return 0;
+	rem -= lowmem_kill_one(min_adj, other_free, other_file, fork_boost);
+	mutex_unlock(&lowmem_scan_mutex);
 
-		lowmem_print(1, "[%s] send sigkill to %d (%s), adj %d, size %dK, min_adj=%d,"
-			" free=%dK, file=%dK, fork_boost=%d\n",
-			     current->comm, selected->pid, selected->comm,
-			     selected_oom_adj, selected_tasksize << 2, min_adj,
-			     other_free << 2, other_file << 2, fork_boost << 2);
-		lowmem_deathpending = selected;
-		lowmem_deathpending_timeout = jiffies + HZ;
-		if (selected_oom_adj < 7)
-		{
-			show_meminfo();
-			dump_tasks();
-		}
-		force_sig(SIGKILL, selected);
-		rem -= selected_tasksize;
-	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
+/*
+ * Proactive kills driven by reclaim efficiency.  When vmscan reports
+ * medium or critical pressure and free memory is already below the largest
+ * minfree threshold, kill from vmpressure_adj[level] up instead of waiting
+ * for the shrinker to see file pages drop too; at those levels the file
+ * pages counted as free are the ones reclaim is failing to get back.
+ */
+static int
+lowmem_vmpressure_notify(struct notifier_block *self, unsigned long level,
+			 void *data);
+
+static struct notifier_block lowmem_vmpressure_nb = {
+	.notifier_call	= lowmem_vmpressure_notify,
+};
+
+static int
+lowmem_vmpressure_notify(struct notifier_block *self, unsigned long level,
+			 void *data)
+{
+	unsigned long pressure = *(unsigned long *)data;
+	int other_free, other_file;
+	int min_adj, minfree_size;
+
+	if (level >= VMPRESSURE_NUM_LEVELS)
+		return NOTIFY_DONE;
+
+	min_adj = lowmem_vmpressure_adj[level];
+	if (min_adj > OOM_ADJUST_MAX)
+		return NOTIFY_DONE;
+
+	if (lowmem_deathpending &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout))
+		return NOTIFY_DONE;
+
+	minfree_size = min(lowmem_minfree_size, lowmem_adj_size);
+	if (minfree_size <= 0)
+		return NOTIFY_DONE;
+
+	lowmem_free_pages(&other_free, &other_file);
+	if (other_free >= lowmem_minfree[minfree_size - 1])
+		return NOTIFY_DONE;
+
+	if (!mutex_trylock(&lowmem_scan_mutex))
+		return NOTIFY_DONE;
+	lowmem_print(3, "vmpressure level %lu (%lu%%), ofree %d %d, ma %d\n",
+		     level, pressure, other_free, other_file, min_adj);
+	if (lowmem_kill_one(min_adj, other_free, other_file, 0))
+		lowmem_stats.vmpressure_kills[level]++;
+	mutex_unlock(&lowmem_scan_mutex);
+
+	return NOTIFY_OK;
+}
+
 static struct shrinker lowmem_shrinker = {
 	.shrink = lowmem_shrink,
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+static int lowmem_stats_get(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer,
+		"scans: %lu\n"
+		"scan_us_total: %lu\n"
+		"scan_us_max: %lu\n"
+		"tasks_examined: %lu\n"
+		"kills: %lu\n"
+		"vmpressure_kills: %lu %lu %lu\n"
+		"kill_latency_us_total: %lu\n"
+		"kill_latency_us_max: %lu\n"
+		"index_rebuilds: %lu\n"
+		"index_alloc_failures: %lu\n",
+		lowmem_stats.scans, lowmem_stats.scan_us_total,
+		lowmem_stats.scan_us_max, lowmem_stats.tasks_examined,
+		lowmem_stats.kills,
+		lowmem_stats.vmpressure_kills[VMPRESSURE_LOW],
+		lowmem_stats.vmpressure_kills[VMPRESSURE_MEDIUM],
+		lowmem_stats.vmpressure_kills[VMPRESSURE_CRITICAL],
+		lowmem_stats.kill_latency_us_total,
+		lowmem_stats.kill_latency_us_max, lowmem_stats.index_rebuilds,
+		lowmem_stats.index_alloc_failures);
+}
+
+static struct kernel_param_ops lowmem_stats_ops = {
+	.get = lowmem_stats_get,
+};
+
 static int __init lowmem_init(void)
 {
+	int i;
+
+	lmk_task_cachep = KMEM_CACHE(lmk_task, 0);
+	if (!lmk_task_cachep)
+		return -ENOMEM;
+	for (i = 0; i < LMK_BUCKETS; i++)
+		INIT_LIST_HEAD(&lmk_buckets[i]);
+
 	task_free_register(&task_free_nb);
 	task_fork_register(&task_fork_nb);
+	register_oom_adj_notifier(&oom_adj_nb);
+	/* Index whatever was forked before the notifiers were registered */
+	lmk_index_rebuild();
 	register_shrinker(&lowmem_shrinker);
+	vmpressure_register_notifier(&lowmem_vmpressure_nb);
 #ifdef CONFIG_MEMORY_HOTPLUG
 	hotplug_memory_notifier(lmk_hotplug_callback, 0);
 #endif
@@ -362,9 +738,20 @@ static int __init lowmem_init(void)
 
 static void __exit lowmem_exit(void)
 {
+	struct lmk_task *e, *tmp;
+	int i;
+
+	vmpressure_unregister_notifier(&lowmem_vmpressure_nb);
 	unregister_shrinker(&lowmem_shrinker);
+	unregister_oom_adj_notifier(&oom_adj_nb);
 	task_fork_unregister(&task_fork_nb);
 	task_free_unregister(&task_free_nb);
+
+	for (i = 0; i < LMK_BUCKETS; i++) {
+		list_for_each_entry_safe(e, tmp, &lmk_buckets[i], node)
+			kmem_cache_free(lmk_task_cachep, e);
+	}
+	kmem_cache_destroy(lmk_task_cachep);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -374,6 +761,9 @@ module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
 module_param_named(fork_boost, lowmem_fork_boost, uint, S_IRUGO | S_IWUSR);
+module_param_array_named(vmpressure_adj, lowmem_vmpressure_adj, int,
+			 &lowmem_vmpressure_adj_size, S_IRUGO | S_IWUSR);
+module_param_cb(stats, &lowmem_stats_ops, NULL, S_IRUGO);
 module_param_array_named(fork_boost_minfree, lowmem_fork_boost_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 
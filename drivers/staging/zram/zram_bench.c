@@ -0,0 +1,233 @@
+/*
+ * Compressed RAM block device
+ *
+ * Throughput benchmark: on load, runs 1..max_threads kernel threads that
+ * each write and then read back 'pages' pages of partly compressible data
+ * in their own region of 'dev_path', one page per bio as swap does, and
+ * reports the aggregate MB/s of every run.  The device must be initialized
+ * (disksize set) and not in use; its contents are overwritten.
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#define KMSG_COMPONENT "zram_bench"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/completion.h>
+#include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/highmem.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+
+#include "zram_drv.h"
+
+static char *dev_path = "/dev/zram0";
+module_param(dev_path, charp, S_IRUGO);
+
+static int max_threads = 4;
+module_param(max_threads, int, S_IRUGO);
+
+static int pages = 4096;
+module_param(pages, int, S_IRUGO);
+
+struct bench_thread {
+	struct block_device	*bdev;
+	sector_t		start;
+	struct page		*page;
+	int			err;
+	struct completion	done;
+};
+
+static DECLARE_COMPLETION(bench_start);
+static DECLARE_COMPLETION(bench_reads);
+
+static void bench_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+static int bench_rw(struct bench_thread *t, int rw, sector_t sector)
+{
+	DECLARE_COMPLETION_ONSTACK(wait);
+	struct bio *bio;
+	int err;
+
+	bio = bio_alloc(GFP_KERNEL, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = t->bdev;
+	bio->bi_sector = sector;
+	bio->bi_end_io = bench_end_io;
+	bio->bi_private = &wait;
+	bio_add_page(bio, t->page, PAGE_SIZE, 0);
+
+	submit_bio(rw, bio);
+	wait_for_completion(&wait);
+
+	err = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+	return err;
+}
+
+/* A quarter of random bytes and text for the rest, roughly 2:1 for lzo */
+static void bench_fill_page(struct page *page, int n)
+{
+	u32 *p = kmap(page);
+	char *c = (char *)p;
+	int i;
+
+	for (i = 0; i < PAGE_SIZE / 4 / sizeof(*p); i++)
+		p[i] = random32();
+	for (i = PAGE_SIZE / 4; i < PAGE_SIZE; i++)
+		c[i] = "zram benchmark page "[(i + n) % 20];
+	kunmap(page);
+}
+
+static int bench_thread_fn(void *data)
+{
+	struct bench_thread *t = data;
+	int i;
+
+	wait_for_completion(&bench_start);
+	for (i = 0; i < pages && !t->err; i++) {
+		bench_fill_page(t->page, i);
+		t->err = bench_rw(t, WRITE,
+				t->start + ((sector_t)i << SECTORS_PER_PAGE_SHIFT));
+	}
+	complete(&t->done);
+
+	wait_for_completion(&bench_reads);
+	for (i = 0; i < pages && !t->err; i++)
+		t->err = bench_rw(t, READ,
+				t->start + ((sector_t)i << SECTORS_PER_PAGE_SHIFT));
+	complete(&t->done);
+
+	return 0;
+}
+
+static unsigned long bench_mbps(int nr_pages, s64 ns)
+{
+	u64 bytes = (u64)nr_pages << PAGE_SHIFT;
+
+	if (ns <= 0)
+		return 0;
+	/* bytes / ns * 1e9 / 1M, without overflowing for a few GB */
+	return div64_u64(bytes * 1000, ns) * 1000000 >> 20;
+}
+
+static int bench_run(struct block_device *bdev, int nr_threads)
+{
+	struct bench_thread *t;
+	ktime_t start;
+	s64 write_ns, read_ns;
+	int started = 0;
+	int ret = 0;
+	int i;
+
+	t = kcalloc(nr_threads, sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	INIT_COMPLETION(bench_start);
+	INIT_COMPLETION(bench_reads);
+	for (i = 0; i < nr_threads; i++) {
+		struct task_struct *task;
+
+		t[i].bdev = bdev;
+		t[i].start = (sector_t)i * pages << SECTORS_PER_PAGE_SHIFT;
+		init_completion(&t[i].done);
+		t[i].page = alloc_page(GFP_KERNEL);
+		if (!t[i].page) {
+			ret = -ENOMEM;
+			break;
+		}
+		task = kthread_run(bench_thread_fn, &t[i], "zram_bench/%d", i);
+		if (IS_ERR(task)) {
+			__free_page(t[i].page);
+			ret = PTR_ERR(task);
+			break;
+		}
+		started++;
+	}
+
+	start = ktime_get();
+	complete_all(&bench_start);
+	for (i = 0; i < started; i++)
+		wait_for_completion(&t[i].done);
+	write_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	complete_all(&bench_reads);
+	for (i = 0; i < started; i++)
+		wait_for_completion(&t[i].done);
+	read_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	for (i = 0; i < started; i++) {
+		if (t[i].err && !ret)
+			ret = t[i].err;
+		__free_page(t[i].page);
+	}
+
+	if (!ret)
+		pr_info("%d thread(s), %d pages each: write %lu MB/s, "
+			"read %lu MB/s\n", nr_threads, pages,
+			bench_mbps(nr_threads * pages, write_ns),
+			bench_mbps(nr_threads * pages, read_ns));
+
+	kfree(t);
+	return ret;
+}
+
+static int __init zram_bench_init(void)
+{
+	struct block_device *bdev;
+	u64 needed;
+	int ret = 0;
+	int i;
+
+	if (max_threads < 1 || pages < 1)
+		return -EINVAL;
+
+	bdev = blkdev_get_by_path(dev_path,
+			FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram_bench_init);
+	if (IS_ERR(bdev)) {
+		pr_err("cannot open %s (%ld)\n", dev_path, PTR_ERR(bdev));
+		return PTR_ERR(bdev);
+	}
+
+	needed = (u64)max_threads * pages << PAGE_SHIFT;
+	if (i_size_read(bdev->bd_inode) < needed) {
+		pr_err("%s is smaller than %llu bytes\n", dev_path, needed);
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	for (i = 1; i <= max_threads && !ret; i++)
+		ret = bench_run(bdev, i);
+
+out:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	return ret;
+}
+
+static void __exit zram_bench_exit(void)
+{
+}
+
+module_init(zram_bench_init);
+module_exit(zram_bench_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Compressed RAM Block Device throughput benchmark");
@@ -26,18 +26,25 @@
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/device.h>
+#include <linux/file.h>
+#include <linux/fs.h>
 #include <linux/genhd.h>
+#include <linux/hash.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/cpumask.h>
+#include <linux/ktime.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
 /* Globals */
 static int zram_major;
 struct zram *devices;
+static struct kmem_cache *zram_entry_cache;
 
 /* Module params (documentation at end) */
 unsigned int num_devices;
@@ -71,6 +78,17 @@ static void zram_stat64_inc(struct zram *zram, u64 *v)
 	zram_stat64_add(zram, v, 1);
 }
 
+static void zram_comp_stat_add(struct zram *zram, u64 *pages, u64 *ns,
+			ktime_t start)
+{
+	s64 delta = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	spin_lock(&zram->stat64_lock);
+	*pages = *pages + 1;
+	*ns = *ns + delta;
+	spin_unlock(&zram->stat64_lock);
+}
+
 static int zram_test_flag(struct zram *zram, u32 index,
 			enum zram_pageflags flag)
 {
@@ -89,18 +107,19 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
@@ -133,56 +152,310 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
-static void zram_free_page(struct zram *zram, size_t index)
+static struct hlist_head *zram_dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->dedup_hash[hash_32(checksum, zram->dedup_hash_bits)];
+}
+
+/*
+ * Look for a stored object with the same compressed contents as mem and
+ * take a reference to it.  The checksum only picks the candidates, the
+ * contents are always compared.
+ */
+static struct zram_entry *zram_dedup_find(struct zram *zram,
+			const void *mem, size_t len, u32 checksum)
 {
-	u32 clen;
-	void *obj;
+	struct zram_entry *entry;
+	struct hlist_node *pos;
+	void *cmem;
+	int match;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_for_each_entry(entry, pos, zram_dedup_bucket(zram, checksum),
+			node) {
+		if (entry->checksum != checksum || entry->len != len)
+			continue;
+
+		cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+		match = !memcmp(cmem, mem, len);
+		zs_unmap_object(zram->mem_pool, entry->handle);
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+		if (match) {
+			entry->refcount++;
+			spin_unlock(&zram->dedup_lock);
+			return entry;
+		}
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return NULL;
+}
+
+static void zram_dedup_insert(struct zram *zram, struct zram_entry *entry)
+{
+	spin_lock(&zram->dedup_lock);
+	hlist_add_head(&entry->node, zram_dedup_bucket(zram, entry->checksum));
+	spin_unlock(&zram->dedup_lock);
+}
+
+static struct zram_entry *zram_entry_alloc(struct zram *zram, size_t len,
+			u32 checksum)
+{
+	struct zram_entry *entry;
+
+	entry = kmem_cache_alloc(zram_entry_cache, GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = zs_malloc(zram->mem_pool, len);
+	if (!entry->handle) {
+		kmem_cache_free(zram_entry_cache, entry);
+		return NULL;
+	}
+
+	INIT_HLIST_NODE(&entry->node);
+	entry->checksum = checksum;
+	entry->len = len;
+	entry->refcount = 1;
+
+	return entry;
+}
+
+/* Drop a reference to entry, returns 1 if that freed the object */
+static int zram_entry_put(struct zram *zram, struct zram_entry *entry)
+{
+	spin_lock(&zram->dedup_lock);
+	if (--entry->refcount) {
+		spin_unlock(&zram->dedup_lock);
+		return 0;
+	}
+	if (!hlist_unhashed(&entry->node))
+		hlist_del(&entry->node);
+	spin_unlock(&zram->dedup_lock);
+
+	zs_free(zram->mem_pool, entry->handle);
+	kmem_cache_free(zram_entry_cache, entry);
+	return 1;
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static int zram_bd_alloc_block(struct zram *zram, unsigned long *blk)
+{
+	unsigned long b = 0;
+
+	do {
+		b = find_next_zero_bit(zram->bitmap, zram->nr_blocks, b);
+		if (b >= zram->nr_blocks)
+			return -ENOSPC;
+	} while (test_and_set_bit(b, zram->bitmap));
+
+	*blk = b;
+	return 0;
+}
+
+/*
+ * A block freed while reads from the backing device are in flight may be
+ * one of those being read.  It stays allocated until the last read is
+ * done, so writeback can not fill it with another page meanwhile.
+ */
+static void zram_bd_free_block(struct zram *zram, unsigned long blk)
+{
+	spin_lock(&zram->bd_lock);
+	if (zram->bd_readers) {
+		if (!test_and_set_bit(blk, zram->bd_pending))
+			zram->nr_bd_pending++;
+	} else {
+		WARN_ON(!test_and_clear_bit(blk, zram->bitmap));
+	}
+	spin_unlock(&zram->bd_lock);
+}
+
+/* Call with tb_lock held, before the slot read from can be freed */
+static void zram_bd_pin(struct zram *zram)
+{
+	spin_lock(&zram->bd_lock);
+	zram->bd_readers++;
+	spin_unlock(&zram->bd_lock);
+}
+
+static void zram_bd_unpin(struct zram *zram)
+{
+	unsigned long b;
+
+	spin_lock(&zram->bd_lock);
+	if (!--zram->bd_readers && zram->nr_bd_pending) {
+		for_each_set_bit(b, zram->bd_pending, zram->nr_blocks)
+			WARN_ON(!test_and_clear_bit(b, zram->bitmap));
+		bitmap_zero(zram->bd_pending, zram->nr_blocks);
+		zram->nr_bd_pending = 0;
+	}
+	spin_unlock(&zram->bd_lock);
+}
+
+static void zram_bd_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+static int zram_bd_rw_page(struct zram *zram, unsigned long blk,
+			struct page *page, int rw)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct bio *bio;
+	int ret = 0;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bd_end_io;
+	bio->bi_private = &done;
+	if (bio_add_page(bio, page, PAGE_SIZE, 0) != PAGE_SIZE) {
+		ret = -EIO;
+		goto out;
+	}
+
+	submit_bio(rw | REQ_SYNC, bio);
+	wait_for_completion(&done);
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		ret = -EIO;
+out:
+	bio_put(bio);
+	return ret;
+}
 
-	if (unlikely(!page)) {
+struct zram_bd_work {
+	struct work_struct work;
+	struct zram *zram;
+	unsigned long blk;
+	struct page *page;
+	int ret;
+};
+
+static void zram_bd_read_work(struct work_struct *work)
+{
+	struct zram_bd_work *w = container_of(work, struct zram_bd_work, work);
+
+	w->ret = zram_bd_rw_page(w->zram, w->blk, w->page, READ);
+}
+
+/*
+ * Called from zram_make_request, where a bio we submit is only issued
+ * after we return.  Hand the read to a worker and wait for it there.
+ */
+static int zram_bd_read(struct zram *zram, unsigned long blk,
+			struct page *page)
+{
+	struct zram_bd_work w;
+	ktime_t start = ktime_get();
+	s64 delta;
+
+	w.zram = zram;
+	w.blk = blk;
+	w.page = page;
+	INIT_WORK_ONSTACK(&w.work, zram_bd_read_work);
+	queue_work(system_unbound_wq, &w.work);
+	flush_work(&w.work);
+	destroy_work_on_stack(&w.work);
+
+	if (w.ret)
+		return w.ret;
+
+	delta = ktime_to_ns(ktime_sub(ktime_get(), start));
+	spin_lock(&zram->stat64_lock);
+	zram->stats.bd_reads++;
+	zram->stats.bd_read_ns += delta;
+	if (delta > zram->stats.bd_read_max_ns)
+		zram->stats.bd_read_max_ns = delta;
+	spin_unlock(&zram->stat64_lock);
+
+	return 0;
+}
+#endif
+
+static int zram_slot_used(struct zram *zram, u32 index)
+{
+	return zram->table[index].entry ||
+		zram_test_flag(zram, index, ZRAM_SAME) ||
+		zram_test_flag(zram, index, ZRAM_WB);
+}
+
+/* Call with tb_lock held for writing */
+static void zram_free_page(struct zram *zram, size_t index)
+{
+	struct table *t = &zram->table[index];
+	u16 clen;
+
+	t->age = 0;
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_bd_free_block(zram, t->element);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_stat_dec(&zram->stats.pages_wb);
+		zram_stat_dec(&zram->stats.pages_stored);
+		t->element = 0;
+		return;
+	}
+#endif
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
 		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
+		 * No memory is allocated for same filled pages.
+		 * Simply clear same page flag.
 		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
+		if (!t->element)
 			zram_stat_dec(&zram->stats.pages_zero);
-		}
+		zram_stat_dec(&zram->stats.pages_same);
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		t->element = 0;
 		return;
 	}
 
+	if (unlikely(!t->entry))
+		return;
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page(t->page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
+		zram_stat64_sub(zram, &zram->stats.compr_size, PAGE_SIZE);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
+	clen = t->entry->len;
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
+	if (zram_entry_put(zram, t->entry)) {
+		zram_stat64_sub(zram, &zram->stats.compr_size, clen);
+	} else {
+		zram_stat_dec(&zram->stats.pages_dedup);
+		zram_stat64_sub(zram, &zram->stats.dedup_saved, clen);
+	}
+
 out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
 	zram_stat_dec(&zram->stats.pages_stored);
-
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	t->entry = NULL;
 }
 
-static void handle_zero_page(struct page *page)
+static void handle_same_page(struct page *page, unsigned long element)
 {
 	void *user_mem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem, 0, PAGE_SIZE);
+	if (!element) {
+		memset(user_mem, 0, PAGE_SIZE);
+	} else {
+		unsigned long *p = user_mem;
+		unsigned int pos;
+
+		for (pos = 0; pos != PAGE_SIZE / sizeof(*p); pos++)
+			p[pos] = element;
+	}
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
@@ -194,12 +467,11 @@ static void handle_uncompressed_page(struct zram *zram,
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = kmap_atomic(zram->table[index].page, KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
-	kunmap_atomic(user_mem, KM_USER0);
 	kunmap_atomic(cmem, KM_USER1);
+	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
 }
@@ -210,75 +482,138 @@ static void zram_read(struct zram *zram, struct bio *bio)
 	int i;
 	u32 index;
 	struct bio_vec *bvec;
+	struct zcomp_strm *zstrm = NULL;
 
 	zram_stat64_inc(zram, &zram->stats.num_reads);
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		size_t clen;
 		struct page *page;
-		struct zobj_header *zheader;
+		struct zram_entry *entry;
 		unsigned char *user_mem, *cmem;
+		ktime_t start;
 
 		page = bvec->bv_page;
+again:
+		read_lock(&zram->tb_lock);
+
+		if (zram_test_flag(zram, index, ZRAM_SAME)) {
+			unsigned long element = zram->table[index].element;
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
+			read_unlock(&zram->tb_lock);
+			handle_same_page(page, element);
 			index++;
 			continue;
 		}
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+		if (zram_test_flag(zram, index, ZRAM_WB)) {
+			unsigned long blk = zram->table[index].element;
+
+			zram->table[index].age = 0;
+			zram_bd_pin(zram);
+			read_unlock(&zram->tb_lock);
+
+			/* Do not keep other zram I/O waiting on the stream */
+			if (zstrm) {
+				zcomp_strm_release(zram->comp, zstrm);
+				zstrm = NULL;
+			}
+			ret = zram_bd_read(zram, blk, page);
+			zram_bd_unpin(zram);
+			if (unlikely(ret)) {
+				pr_err("Backing device read failed! err=%d, "
+					"page=%u\n", ret, index);
+				zram_stat64_inc(zram, &zram->stats.failed_reads);
+				goto out;
+			}
+			flush_dcache_page(page);
+			index++;
+			continue;
+		}
+#endif
+
 		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
+		entry = zram->table[index].entry;
+		if (unlikely(!entry)) {
+			read_unlock(&zram->tb_lock);
 			pr_debug("Read before write: sector=%lu, size=%u",
 				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
+			handle_same_page(page, 0);
 			index++;
 			continue;
 		}
 
+		/*
+		 * Readers only ever store zero here, so racing with each
+		 * other under the read lock is harmless.
+		 */
+		zram->table[index].age = 0;
+
 		/* Page is stored uncompressed since it's incompressible */
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 			handle_uncompressed_page(zram, page, index);
+			read_unlock(&zram->tb_lock);
 			index++;
 			continue;
 		}
 
+		/*
+		 * Finding a stream may sleep, tb_lock may not: drop the lock
+		 * to get one and look at the slot again.
+		 */
+		if (!zstrm) {
+			read_unlock(&zram->tb_lock);
+			zstrm = zcomp_strm_find(zram->comp);
+			goto again;
+		}
+
 		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+		start = ktime_get();
+		ret = zcomp_decompress(zram->comp, zstrm, cmem, entry->len,
+			user_mem);
 
+		zs_unmap_object(zram->mem_pool, entry->handle);
 		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+		read_unlock(&zram->tb_lock);
 
 		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
+		if (unlikely(ret)) {
 			pr_err("Decompression failed! err=%d, page=%u\n",
 				ret, index);
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
 			goto out;
 		}
+		zram_comp_stat_add(zram,
+			&zram->cur_comp_stats->pages_decompressed,
+			&zram->cur_comp_stats->decompress_ns, start);
 
 		flush_dcache_page(page);
 		index++;
 	}
 
+	if (zstrm)
+		zcomp_strm_release(zram->comp, zstrm);
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return;
 
 out:
+	if (zstrm)
+		zcomp_strm_release(zram->comp, zstrm);
 	bio_io_error(bio);
 }
 
+/*
+ * Pages are compressed with one of the device's compression streams and
+ * stored without holding any device-wide lock, so writers on different
+ * CPUs run in parallel.  tb_lock is only taken to swap the new object into
+ * the table.
+ */
 static void zram_write(struct zram *zram, struct bio *bio)
 {
 	int i;
@@ -290,46 +625,58 @@ static void zram_write(struct zram *zram, struct bio *bio)
 
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		u32 offset;
 		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+		u32 checksum = 0;
+		unsigned long element;
+		struct zram_entry *entry = NULL;
+		struct zcomp_strm *zstrm;
+		struct page *page, *page_store = NULL;
+		unsigned char *user_mem, *cmem;
+		int same, dedup = 0;
+		ktime_t start;
 
 		page = bvec->bv_page;
-		src = zram->compress_buffer;
-
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
-
-		mutex_lock(&zram->lock);
 
 		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
+		same = page_same_filled(user_mem, &element);
+		kunmap_atomic(user_mem, KM_USER0);
+
+		if (same) {
+			write_lock(&zram->tb_lock);
+			/*
+			 * System overwrites unused sectors. Free memory
+			 * associated with this sector now.
+			 */
+			if (zram_slot_used(zram, index))
+				zram_free_page(zram, index);
+			if (!element)
+				zram_stat_inc(&zram->stats.pages_zero);
+			zram_stat_inc(&zram->stats.pages_same);
+			zram_set_flag(zram, index, ZRAM_SAME);
+			zram->table[index].element = element;
+			write_unlock(&zram->tb_lock);
 			index++;
 			continue;
 		}
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		zstrm = zcomp_strm_find(zram->comp);
 
+		start = ktime_get();
+		user_mem = kmap_atomic(page, KM_USER0);
+		ret = zcomp_compress(zram->comp, zstrm, user_mem, &clen);
 		kunmap_atomic(user_mem, KM_USER0);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
+		if (unlikely(ret)) {
+			zcomp_strm_release(zram->comp, zstrm);
 			pr_err("Compression failed! err=%d\n", ret);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
 		}
+		zram_comp_stat_add(zram,
+			&zram->cur_comp_stats->pages_compressed,
+			&zram->cur_comp_stats->compress_ns, start);
+		zram_stat64_add(zram, &zram->cur_comp_stats->compressed_bytes,
+			clen);
 
 		/*
 		 * Page is incompressible. Store it as-is (uncompressed)
@@ -337,10 +684,11 @@ static void zram_write(struct zram *zram, struct bio *bio)
 		 * errors which has side effect of hanging the system.
 		 */
 		if (unlikely(clen > max_zpage_size)) {
+			zcomp_strm_release(zram->comp, zstrm);
+
 			clen = PAGE_SIZE;
 			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
 				pr_info("Error allocating memory for "
 					"incompressible page: %u\n", index);
 				zram_stat64_inc(zram,
@@ -348,52 +696,76 @@ static void zram_write(struct zram *zram, struct bio *bio)
 				goto out;
 			}
 
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
+			user_mem = kmap_atomic(page, KM_USER0);
+			cmem = kmap_atomic(page_store, KM_USER1);
+			memcpy(cmem, user_mem, PAGE_SIZE);
+			kunmap_atomic(cmem, KM_USER1);
+			kunmap_atomic(user_mem, KM_USER0);
+
+			zram_stat64_add(zram, &zram->stats.compr_size, clen);
+			goto install;
 		}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
+		if (zram->use_dedup) {
+			checksum = jhash(zstrm->buffer, clen, 0);
+			entry = zram_dedup_find(zram, zstrm->buffer, clen,
+					checksum);
+		}
+		if (entry) {
+			zcomp_strm_release(zram->comp, zstrm);
+			dedup = 1;
+			zram_stat64_inc(zram, &zram->stats.dedup_hits);
+			zram_stat64_add(zram, &zram->stats.dedup_saved, clen);
+			goto install;
+		}
+
+		entry = zram_entry_alloc(zram, clen, checksum);
+		if (!entry) {
+			zcomp_strm_release(zram->comp, zstrm);
 			pr_info("Error allocating memory for compressed "
 				"page: %u, size=%zu\n", index, clen);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
 		}
 
-memstore:
-		zram->table[index].offset = offset;
-
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_WO);
+		memcpy(cmem, zstrm->buffer, clen);
+		zs_unmap_object(zram->mem_pool, entry->handle);
+		zcomp_strm_release(zram->comp, zstrm);
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
+		if (zram->use_dedup) {
+			zram_dedup_insert(zram, entry);
+			zram_stat64_inc(zram, &zram->stats.dedup_misses);
 		}
-#endif
-
-		memcpy(cmem, src, clen);
+		zram_stat64_add(zram, &zram->stats.compr_size, clen);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+install:
+		write_lock(&zram->tb_lock);
 
 		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
+		if (unlikely(page_store))
+			zram_stat_inc(&zram->stats.pages_expand);
+		else if (clen <= PAGE_SIZE / 2)
 			zram_stat_inc(&zram->stats.good_compress);
+		if (dedup)
+			zram_stat_inc(&zram->stats.pages_dedup);
+		zram_stat_inc(&zram->stats.pages_stored);
+
+		/*
+		 * System overwrites unused sectors. Free memory associated
+		 * with this sector now.
+		 */
+		if (zram_slot_used(zram, index))
+			zram_free_page(zram, index);
+
+		if (unlikely(page_store)) {
+			zram->table[index].page = page_store;
+			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		} else {
+			zram->table[index].entry = entry;
+		}
+		write_unlock(&zram->tb_lock);
 
-		mutex_unlock(&zram->lock);
 		index++;
 	}
 
@@ -405,6 +777,229 @@ out:
 	bio_io_error(bio);
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static void zram_reset_backing_dev(struct zram *zram)
+{
+	if (!zram->backing_dev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	filp_close(zram->backing_dev, NULL);
+	vfree(zram->bitmap);
+
+	zram->backing_dev = NULL;
+	zram->bdev = NULL;
+	zram->bitmap = NULL;
+	zram->bd_pending = NULL;
+	zram->nr_bd_pending = 0;
+	zram->nr_blocks = 0;
+}
+
+/* Call with init_lock held, before the device is initialized */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	struct file *backing_dev;
+	struct block_device *bdev;
+	struct inode *inode;
+	unsigned long *bitmap;
+	unsigned long nr_blocks;
+	int ret;
+
+	backing_dev = filp_open(path, O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(backing_dev))
+		return PTR_ERR(backing_dev);
+
+	inode = backing_dev->f_mapping->host;
+	if (!S_ISBLK(inode->i_mode)) {
+		ret = -ENOTBLK;
+		goto out_close;
+	}
+
+	bdev = blkdev_get_by_dev(inode->i_rdev,
+			FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram);
+	if (IS_ERR(bdev)) {
+		ret = PTR_ERR(bdev);
+		goto out_close;
+	}
+
+	nr_blocks = i_size_read(inode) >> PAGE_SHIFT;
+	if (!nr_blocks) {
+		ret = -EINVAL;
+		goto out_put;
+	}
+
+	/* the second half holds bd_pending */
+	bitmap = vzalloc(2 * BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (!bitmap) {
+		ret = -ENOMEM;
+		goto out_put;
+	}
+
+	ret = set_blocksize(bdev, PAGE_SIZE);
+	if (ret)
+		goto out_free;
+
+	zram_reset_backing_dev(zram);
+	zram->backing_dev = backing_dev;
+	zram->bdev = bdev;
+	zram->bitmap = bitmap;
+	zram->bd_pending = bitmap + BITS_TO_LONGS(nr_blocks);
+	zram->nr_blocks = nr_blocks;
+
+	pr_info("setup backing device %s, %lu pages\n", path, nr_blocks);
+	return 0;
+
+out_free:
+	vfree(bitmap);
+out_put:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+out_close:
+	filp_close(backing_dev, NULL);
+	return ret;
+}
+
+/*
+ * Age every page held in memory by one.  Accessing a page resets its
+ * age, so after N calls pages of age N have not been touched since the
+ * first of them.  Call with init_lock held.
+ */
+void zram_mark_idle(struct zram *zram)
+{
+	size_t index;
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		write_lock(&zram->tb_lock);
+		if (zram->table[index].entry &&
+				!zram_test_flag(zram, index, ZRAM_SAME) &&
+				!zram_test_flag(zram, index, ZRAM_WB) &&
+				zram->table[index].age != (u8)~0)
+			zram->table[index].age++;
+		write_unlock(&zram->tb_lock);
+	}
+}
+
+/* Call with tb_lock held for writing */
+static int zram_wb_candidate(struct zram *zram, size_t index, int huge)
+{
+	if (!zram->table[index].entry ||
+			zram_test_flag(zram, index, ZRAM_SAME) ||
+			zram_test_flag(zram, index, ZRAM_WB) ||
+			zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		return 0;
+
+	if (huge)
+		return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+	return zram->table[index].age >= zram->wb_min_age;
+}
+
+/* Call with tb_lock held; the page must be stored in memory */
+static int zram_copy_slot(struct zram *zram, size_t index,
+			struct zcomp_strm *zstrm, struct page *page)
+{
+	struct zram_entry *entry = zram->table[index].entry;
+	unsigned char *mem, *cmem;
+	int ret = 0;
+
+	mem = kmap_atomic(page, KM_USER0);
+	if (zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+		cmem = kmap_atomic(zram->table[index].page, KM_USER1);
+		memcpy(mem, cmem, PAGE_SIZE);
+		kunmap_atomic(cmem, KM_USER1);
+	} else {
+		cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+		ret = zcomp_decompress(zram->comp, zstrm, cmem, entry->len,
+				mem);
+		zs_unmap_object(zram->mem_pool, entry->handle);
+	}
+	kunmap_atomic(mem, KM_USER0);
+
+	return ret;
+}
+
+/*
+ * Move idle pages, or with huge set incompressible ones, to the backing
+ * device.  A page freed or rewritten while its copy is in flight keeps
+ * its new contents and the block is released again.  Returns the number
+ * of pages written back, or -errno if none could be.  Call with
+ * init_lock held.
+ */
+int zram_writeback(struct zram *zram, int huge)
+{
+	size_t index, nr_pages = zram->disksize >> PAGE_SHIFT;
+	struct zcomp_strm *zstrm;
+	struct page *page;
+	unsigned long blk;
+	int ret = 0, count = 0;
+
+	if (!zram->init_done || !zram->backing_dev)
+		return -EINVAL;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	for (index = 0; index < nr_pages; index++) {
+		write_lock(&zram->tb_lock);
+		if (!zram_wb_candidate(zram, index, huge)) {
+			write_unlock(&zram->tb_lock);
+			continue;
+		}
+		write_unlock(&zram->tb_lock);
+
+		/*
+		 * Hold the stream only for the copy: zram I/O waits for it,
+		 * and the write below may need reclaim that swaps to zram.
+		 */
+		zstrm = zcomp_strm_find(zram->comp);
+		write_lock(&zram->tb_lock);
+		if (!zram_wb_candidate(zram, index, huge)) {
+			write_unlock(&zram->tb_lock);
+			zcomp_strm_release(zram->comp, zstrm);
+			continue;
+		}
+		ret = zram_copy_slot(zram, index, zstrm, page);
+		if (!ret)
+			zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		write_unlock(&zram->tb_lock);
+		zcomp_strm_release(zram->comp, zstrm);
+		if (ret)
+			break;
+
+		ret = zram_bd_alloc_block(zram, &blk);
+		if (!ret) {
+			ret = zram_bd_rw_page(zram, blk, page, WRITE);
+			if (ret)
+				zram_bd_free_block(zram, blk);
+		}
+
+		write_lock(&zram->tb_lock);
+		if (ret || !zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			write_unlock(&zram->tb_lock);
+			if (ret)
+				break;
+			zram_bd_free_block(zram, blk);
+			continue;
+		}
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram->table[index].element = blk;
+		zram_stat_inc(&zram->stats.pages_wb);
+		zram_stat_inc(&zram->stats.pages_stored);
+		write_unlock(&zram->tb_lock);
+
+		zram_stat64_inc(zram, &zram->stats.bd_writes);
+		count++;
+	}
+
+	__free_page(page);
+
+	if (ret && !count)
+		return ret;
+	return count;
+}
+#endif
+
 /*
  * Check if request is within bounds and page aligned.
  */
@@ -461,33 +1056,36 @@ void zram_reset_device(struct zram *zram)
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	if (zram->comp)
+		zcomp_destroy(zram->comp);
+	zram->comp = NULL;
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
+		struct table *t = &zram->table[index];
 
-		if (!page)
+		if (zram_test_flag(zram, index, ZRAM_SAME) ||
+				zram_test_flag(zram, index, ZRAM_WB) || !t->entry)
 			continue;
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
+			__free_page(t->page);
 		else
-			xv_free(zram->mem_pool, page, offset);
+			zram_entry_put(zram, t->entry);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	vfree(zram->dedup_hash);
+	zram->dedup_hash = NULL;
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram_reset_backing_dev(zram);
+#endif
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -497,6 +1095,33 @@ void zram_reset_device(struct zram *zram)
 	mutex_unlock(&zram->init_lock);
 }
 
+/*
+ * Find the stats slot for algorithm name, claiming a free one if needed.
+ * Once all slots are used the last one is recycled.
+ */
+static struct zram_comp_stats *zram_find_comp_stats(struct zram *zram,
+			const char *name)
+{
+	struct zram_comp_stats *cs;
+	int i;
+
+	for (i = 0; i < ZRAM_MAX_COMP_ALGS; i++) {
+		cs = &zram->comp_stats[i];
+		if (!cs->name[0] || !strcmp(cs->name, name))
+			break;
+	}
+	if (i == ZRAM_MAX_COMP_ALGS)
+		cs = &zram->comp_stats[ZRAM_MAX_COMP_ALGS - 1];
+
+	if (strcmp(cs->name, name)) {
+		spin_lock(&zram->stat64_lock);
+		memset(cs, 0, sizeof(*cs));
+		strlcpy(cs->name, name, sizeof(cs->name));
+		spin_unlock(&zram->stat64_lock);
+	}
+	return cs;
+}
+
 int zram_init_device(struct zram *zram)
 {
 	int ret;
@@ -511,19 +1136,14 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
+	zram->comp = zcomp_create(zram->compressor, zram->max_comp_streams);
+	if (!zram->comp) {
+		pr_err("Error allocating %s compression streams\n",
+			zram->compressor);
 		ret = -ENOMEM;
 		goto fail;
 	}
+	zram->cur_comp_stats = zram_find_comp_stats(zram, zram->compressor);
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
 	zram->table = vzalloc(num_pages * sizeof(*zram->table));
@@ -535,12 +1155,21 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	zram->dedup_hash_bits = ilog2(max_t(size_t, num_pages >> 2, 64));
+	zram->dedup_hash = vzalloc(sizeof(*zram->dedup_hash) <<
+				zram->dedup_hash_bits);
+	if (!zram->dedup_hash) {
+		pr_err("Error allocating dedup hash table\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool("zram", GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -566,7 +1195,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->tb_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->tb_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,9 +1210,20 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
+	rwlock_init(&zram->tb_lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	spin_lock_init(&zram->dedup_lock);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spin_lock_init(&zram->bd_lock);
+#endif
+	zram->use_dedup = 1;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram->wb_min_age = 1;
+#endif
+	zram->max_comp_streams = num_online_cpus();
+	strlcpy(zram->compressor, default_compressor,
+		sizeof(zram->compressor));
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -664,11 +1306,17 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	zram_entry_cache = KMEM_CACHE(zram_entry, 0);
+	if (!zram_entry_cache) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto free_cache;
 	}
 
 	if (!num_devices) {
@@ -698,6 +1346,8 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+free_cache:
+	kmem_cache_destroy(zram_entry_cache);
 out:
 	return ret;
 }
@@ -718,6 +1368,7 @@ static void __exit zram_exit(void)
 	unregister_blkdev(zram_major, "zram");
 
 	kfree(devices);
+	kmem_cache_destroy(zram_entry_cache);
 	pr_debug("Cleanup done!\n");
 }
 
@@ -17,8 +17,10 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/list.h>
 
-#include "xvmalloc.h"
+#include "../zsmalloc/zsmalloc.h"
+#include "zcomp.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,18 +28,6 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
@@ -50,11 +40,16 @@ static const unsigned default_disksize_perc_ram = 25;
 static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
- * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ * NOTE: max_zpage_size must be less than or equal to the largest
+ * zsmalloc size class, otherwise zs_malloc() would always fail.
  */
 
+/* Compressor used unless one is selected through comp_algorithm */
+static const char default_compressor[] = "lzo";
+
+/* Number of algorithms a device keeps compression stats for */
+#define ZRAM_MAX_COMP_ALGS	4
+
 /*-- End of configurable params */
 
 #define SECTOR_SHIFT		9
@@ -68,19 +63,41 @@ enum zram_pageflags {
 	/* Page is stored uncompressed */
 	ZRAM_UNCOMPRESSED,
 
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/* Page is one word repeated, kept in table[page_no].element */
+	ZRAM_SAME,
+
+	/* Page is on the backing device, at block table[page_no].element */
+	ZRAM_WB,
+
+	/* Page is being written back; cleared if the page is freed */
+	ZRAM_UNDER_WB,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
+/*
+ * A compressed object in the zsmalloc pool.  Disk pages whose compressed
+ * contents are identical share one entry, found through the device's
+ * dedup hash.  refcount and the hash chain are protected by dedup_lock.
+ */
+struct zram_entry {
+	struct hlist_node node;
+	unsigned long handle;
+	u32 checksum;		/* jhash of the compressed data */
+	u16 len;		/* object size, as passed to zs_malloc() */
+	unsigned int refcount;
+};
+
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
+	union {
+		struct zram_entry *entry;
+		struct page *page;	/* ZRAM_UNCOMPRESSED */
+		unsigned long element;	/* ZRAM_SAME, ZRAM_WB */
+	};
+	u8 age;		/* idle marks since the page was last accessed */
 	u8 flags;
 } __attribute__((aligned(4)));
 
@@ -92,20 +109,46 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 dedup_hits;		/* writes that reused a stored object */
+	u64 dedup_misses;	/* writes that stored a new object */
+	u64 dedup_saved;	/* compressed bytes not stored twice */
+	u64 bd_writes;		/* pages written to the backing device */
+	u64 bd_reads;		/* pages read back from it */
+	u64 bd_read_ns;		/* total time spent reading them back */
+	u64 bd_read_max_ns;	/* slowest read back */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_same;		/* no. of same filled pages, incl. zero */
+	u32 pages_dedup;	/* no. of pages sharing another's object */
+	u32 pages_wb;		/* no. of pages on the backing device */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
 };
 
+/*
+ * Per-algorithm compression stats.  These survive a device reset so that
+ * algorithms can be compared on the same workload.
+ */
+struct zram_comp_stats {
+	char name[CRYPTO_MAX_ALG_NAME];
+	u64 pages_compressed;
+	u64 compressed_bytes;	/* compressor output, before max_zpage_size */
+	u64 compress_ns;
+	u64 pages_decompressed;
+	u64 decompress_ns;
+};
+
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct zcomp *comp;
 	struct table *table;
+	struct hlist_head *dedup_hash;
+	unsigned int dedup_hash_bits;
+	spinlock_t dedup_lock;	/* protect dedup_hash and entry refcounts */
+	int use_dedup;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	rwlock_t tb_lock;	/* protect table entries and the 32-bit
+				 * stats updated along with them */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -116,6 +159,23 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	int max_comp_streams;
+	char compressor[CRYPTO_MAX_ALG_NAME];
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned long *bitmap;	/* backing device blocks in use */
+	unsigned long nr_blocks;
+	spinlock_t bd_lock;	/* protect bd_readers and bd_pending */
+	unsigned int bd_readers;	/* backing device reads in flight */
+	unsigned long *bd_pending;	/* blocks freed during those reads */
+	unsigned long nr_bd_pending;
+	int wb_min_age;		/* age at which pages count as idle */
+#endif
+
+	struct zram_comp_stats comp_stats[ZRAM_MAX_COMP_ALGS];
+	struct zram_comp_stats *cur_comp_stats;
 
 	struct zram_stats stats;
 };
@@ -128,5 +188,10 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern void zram_mark_idle(struct zram *zram);
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern int zram_writeback(struct zram *zram, int huge);
+#endif
 
 #endif
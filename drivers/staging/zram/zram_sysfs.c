@@ -13,8 +13,11 @@
  */
 
 #include <linux/device.h>
+#include <linux/fs.h>
 #include <linux/genhd.h>
 #include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/math64.h>
 
 #include "zram_drv.h"
 
@@ -156,6 +159,72 @@ static ssize_t zero_pages_show(struct device *dev,
 	return sprintf(buf, "%u\n", zram->stats.pages_zero);
 }
 
+static ssize_t same_pages_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->stats.pages_same);
+}
+
+static ssize_t dedup_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->use_dedup);
+}
+
+static ssize_t dedup_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long val;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	zram->use_dedup = !!val;
+	return len;
+}
+
+static ssize_t dedup_hits_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.dedup_hits));
+}
+
+static ssize_t dedup_misses_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.dedup_misses));
+}
+
+static ssize_t dedup_pages_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->stats.pages_dedup);
+}
+
+static ssize_t dedup_saved_bytes_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.dedup_saved));
+}
+
 static ssize_t orig_data_size_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -181,13 +250,377 @@ static ssize_t mem_used_total_show(struct device *dev,
 	struct zram *zram = dev_to_zram(dev);
 
 	if (zram->init_done) {
-		val = xv_get_total_size_bytes(zram->mem_pool) +
+		val = zs_get_total_size_bytes(zram->mem_pool) +
 			((u64)(zram->stats.pages_expand) << PAGE_SHIFT);
 	}
 
 	return sprintf(buf, "%llu\n", val);
 }
 
+static ssize_t max_comp_streams_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->max_comp_streams);
+}
+
+static ssize_t max_comp_streams_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long num;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &num);
+	if (ret)
+		return ret;
+	if (num < 1 || num > INT_MAX)
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		zcomp_set_max_streams(zram->comp, num);
+	zram->max_comp_streams = num;
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+/* Listed by comp_algorithm when the crypto API has them */
+static const char * const zram_known_compressors[] = {
+	"lzo",
+	"deflate",
+	NULL
+};
+
+static ssize_t comp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	const char * const *name;
+	bool listed = false;
+	ssize_t sz = 0;
+
+	mutex_lock(&zram->init_lock);
+	for (name = zram_known_compressors; *name; name++) {
+		if (!strcmp(*name, zram->compressor)) {
+			sz += sprintf(buf + sz, "[%s] ", *name);
+			listed = true;
+		} else if (zcomp_available_algorithm(*name)) {
+			sz += sprintf(buf + sz, "%s ", *name);
+		}
+	}
+	if (!listed)
+		sz += sprintf(buf + sz, "[%s] ", zram->compressor);
+	mutex_unlock(&zram->init_lock);
+
+	buf[sz - 1] = '\n';
+	return sz;
+}
+
+static ssize_t comp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	char name[CRYPTO_MAX_ALG_NAME];
+	ssize_t ret = len;
+
+	strlcpy(name, buf, sizeof(name));
+	strim(name);
+
+	if (!zcomp_available_algorithm(name))
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		pr_info("Cannot change compressor for initialized device\n");
+		ret = -EBUSY;
+	} else {
+		strlcpy(zram->compressor, name, sizeof(zram->compressor));
+	}
+	mutex_unlock(&zram->init_lock);
+
+	return ret;
+}
+
+static ssize_t comp_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zram_comp_stats cs;
+	ssize_t sz = 0;
+	int i;
+
+	sz += sprintf(buf, "%-10s %12s %8s %12s %12s\n", "algorithm",
+		"pages", "ratio%", "comp_ns", "decomp_ns");
+	for (i = 0; i < ZRAM_MAX_COMP_ALGS; i++) {
+		u64 in, ratio = 0, comp_ns = 0, decomp_ns = 0;
+
+		spin_lock(&zram->stat64_lock);
+		cs = zram->comp_stats[i];
+		spin_unlock(&zram->stat64_lock);
+		if (!cs.name[0])
+			break;
+
+		/* ratio is output size as a percentage of input size */
+		in = cs.pages_compressed << PAGE_SHIFT;
+		if (in)
+			ratio = div64_u64(cs.compressed_bytes * 100, in);
+		if (cs.pages_compressed)
+			comp_ns = div64_u64(cs.compress_ns,
+					cs.pages_compressed);
+		if (cs.pages_decompressed)
+			decomp_ns = div64_u64(cs.decompress_ns,
+					cs.pages_decompressed);
+
+		sz += sprintf(buf + sz, "%-10s %12llu %8llu %12llu %12llu\n",
+			cs.name, cs.pages_compressed, ratio, comp_ns,
+			decomp_ns);
+	}
+
+	return sz;
+}
+
+static ssize_t comp_stream_waits_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	unsigned long val = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (zram->init_done)
+		val = zram->comp->strm_waits;
+
+	return sprintf(buf, "%lu\n", val);
+}
+
+static ssize_t compact_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		zs_compact(zram->mem_pool);
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t compacted_pages_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	u64 val = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		val = zs_get_compacted_pages(zram->mem_pool);
+	mutex_unlock(&zram->init_lock);
+
+	return sprintf(buf, "%llu\n", val);
+}
+
+/*
+ * One line per size class in use: how full its zspages are and how many
+ * bytes they hold that are not backing any object.
+ */
+static ssize_t zs_classes_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zs_class_stats st;
+	ssize_t sz;
+	int i;
+
+	sz = scnprintf(buf, PAGE_SIZE, "%5s %5s %8s %9s %5s %10s\n",
+		"size", "pages", "zspages", "objs", "fill%", "wasted");
+
+	mutex_lock(&zram->init_lock);
+	for (i = 0; zram->init_done && i < zs_get_num_classes(); i++) {
+		u64 capacity, fill, wasted;
+
+		if (zs_get_class_stats(zram->mem_pool, i, &st) || !st.zspages)
+			continue;
+
+		capacity = (u64)st.zspages * st.objs_per_zspage;
+		fill = div64_u64((u64)st.objs_inuse * 100, capacity);
+		wasted = ((u64)st.zspages * st.pages_per_zspage << PAGE_SHIFT) -
+			st.bytes_inuse;
+
+		sz += scnprintf(buf + sz, PAGE_SIZE - sz,
+			"%5d %5d %8lu %9lu %5llu %10llu\n",
+			st.size, st.pages_per_zspage, st.zspages,
+			st.objs_inuse, fill, wasted);
+	}
+	mutex_unlock(&zram->init_lock);
+
+	return sz;
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static ssize_t backing_dev_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	char *p;
+	ssize_t ret;
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->backing_dev) {
+		ret = sprintf(buf, "none\n");
+		goto out;
+	}
+
+	p = d_path(&zram->backing_dev->f_path, buf, PAGE_SIZE - 1);
+	if (IS_ERR(p)) {
+		ret = PTR_ERR(p);
+		goto out;
+	}
+	ret = strlen(p);
+	memmove(buf, p, ret);
+	buf[ret++] = '\n';
+out:
+	mutex_unlock(&zram->init_lock);
+	return ret;
+}
+
+static ssize_t backing_dev_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	char *path;
+	ssize_t ret = len;
+
+	path = kstrndup(buf, PATH_MAX, GFP_KERNEL);
+	if (!path)
+		return -ENOMEM;
+	strim(path);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		pr_info("Cannot change backing device for initialized "
+			"device\n");
+		ret = -EBUSY;
+	} else {
+		ret = zram_set_backing_dev(zram, path);
+		if (!ret)
+			ret = len;
+	}
+	mutex_unlock(&zram->init_lock);
+
+	kfree(path);
+	return ret;
+}
+
+static ssize_t idle_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	if (!sysfs_streq(buf, "all"))
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		zram_mark_idle(zram);
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	int huge, ret;
+
+	if (sysfs_streq(buf, "idle"))
+		huge = 0;
+	else if (sysfs_streq(buf, "huge"))
+		huge = 1;
+	else
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	ret = zram_writeback(zram, huge);
+	mutex_unlock(&zram->init_lock);
+
+	return ret < 0 ? ret : len;
+}
+
+static ssize_t writeback_min_age_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->wb_min_age);
+}
+
+static ssize_t writeback_min_age_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long val;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+	if (val < 1 || val > (u8)~0)
+		return -EINVAL;
+
+	zram->wb_min_age = val;
+	return len;
+}
+
+static ssize_t bd_pages_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->stats.pages_wb);
+}
+
+static ssize_t bd_written_bytes_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.bd_writes) << PAGE_SHIFT);
+}
+
+static ssize_t bd_reads_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.bd_reads));
+}
+
+static ssize_t bd_read_latency_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	u64 reads, ns, max_ns, avg_ns = 0;
+
+	spin_lock(&zram->stat64_lock);
+	reads = zram->stats.bd_reads;
+	ns = zram->stats.bd_read_ns;
+	max_ns = zram->stats.bd_read_max_ns;
+	spin_unlock(&zram->stat64_lock);
+
+	if (reads)
+		avg_ns = div64_u64(ns, reads);
+
+	return sprintf(buf, "avg_us %llu\nmax_us %llu\n",
+		div64_u64(avg_ns, NSEC_PER_USEC),
+		div64_u64(max_ns, NSEC_PER_USEC));
+}
+#endif
+
 static DEVICE_ATTR(disksize, S_IRUGO | S_IWUSR,
 		disksize_show, disksize_store);
 static DEVICE_ATTR(initstate, S_IRUGO, initstate_show, NULL);
@@ -197,9 +630,36 @@ static DEVICE_ATTR(num_writes, S_IRUGO, num_writes_show, NULL);
 static DEVICE_ATTR(invalid_io, S_IRUGO, invalid_io_show, NULL);
 static DEVICE_ATTR(notify_free, S_IRUGO, notify_free_show, NULL);
 static DEVICE_ATTR(zero_pages, S_IRUGO, zero_pages_show, NULL);
+static DEVICE_ATTR(same_pages, S_IRUGO, same_pages_show, NULL);
+static DEVICE_ATTR(dedup, S_IRUGO | S_IWUSR, dedup_show, dedup_store);
+static DEVICE_ATTR(dedup_hits, S_IRUGO, dedup_hits_show, NULL);
+static DEVICE_ATTR(dedup_misses, S_IRUGO, dedup_misses_show, NULL);
+static DEVICE_ATTR(dedup_pages, S_IRUGO, dedup_pages_show, NULL);
+static DEVICE_ATTR(dedup_saved_bytes, S_IRUGO, dedup_saved_bytes_show, NULL);
 static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
 static DEVICE_ATTR(compr_data_size, S_IRUGO, compr_data_size_show, NULL);
 static DEVICE_ATTR(mem_used_total, S_IRUGO, mem_used_total_show, NULL);
+static DEVICE_ATTR(max_comp_streams, S_IRUGO | S_IWUSR,
+		max_comp_streams_show, max_comp_streams_store);
+static DEVICE_ATTR(comp_stream_waits, S_IRUGO, comp_stream_waits_show, NULL);
+static DEVICE_ATTR(comp_algorithm, S_IRUGO | S_IWUSR,
+		comp_algorithm_show, comp_algorithm_store);
+static DEVICE_ATTR(comp_stats, S_IRUGO, comp_stats_show, NULL);
+static DEVICE_ATTR(compact, S_IWUSR, NULL, compact_store);
+static DEVICE_ATTR(compacted_pages, S_IRUGO, compacted_pages_show, NULL);
+static DEVICE_ATTR(zs_classes, S_IRUGO, zs_classes_show, NULL);
+#ifdef CONFIG_ZRAM_WRITEBACK
+static DEVICE_ATTR(backing_dev, S_IRUGO | S_IWUSR,
+		backing_dev_show, backing_dev_store);
+static DEVICE_ATTR(idle, S_IWUSR, NULL, idle_store);
+static DEVICE_ATTR(writeback, S_IWUSR, NULL, writeback_store);
+static DEVICE_ATTR(writeback_min_age, S_IRUGO | S_IWUSR,
+		writeback_min_age_show, writeback_min_age_store);
+static DEVICE_ATTR(bd_pages, S_IRUGO, bd_pages_show, NULL);
+static DEVICE_ATTR(bd_written_bytes, S_IRUGO, bd_written_bytes_show, NULL);
+static DEVICE_ATTR(bd_reads, S_IRUGO, bd_reads_show, NULL);
+static DEVICE_ATTR(bd_read_latency, S_IRUGO, bd_read_latency_show, NULL);
+#endif
 
 static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_disksize.attr,
@@ -210,9 +670,32 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_invalid_io.attr,
 	&dev_attr_notify_free.attr,
 	&dev_attr_zero_pages.attr,
+	&dev_attr_same_pages.attr,
+	&dev_attr_dedup.attr,
+	&dev_attr_dedup_hits.attr,
+	&dev_attr_dedup_misses.attr,
+	&dev_attr_dedup_pages.attr,
+	&dev_attr_dedup_saved_bytes.attr,
 	&dev_attr_orig_data_size.attr,
 	&dev_attr_compr_data_size.attr,
 	&dev_attr_mem_used_total.attr,
+	&dev_attr_max_comp_streams.attr,
+	&dev_attr_comp_stream_waits.attr,
+	&dev_attr_comp_algorithm.attr,
+	&dev_attr_comp_stats.attr,
+	&dev_attr_compact.attr,
+	&dev_attr_compacted_pages.attr,
+	&dev_attr_zs_classes.attr,
+#ifdef CONFIG_ZRAM_WRITEBACK
+	&dev_attr_backing_dev.attr,
+	&dev_attr_idle.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_writeback_min_age.attr,
+	&dev_attr_bd_pages.attr,
+	&dev_attr_bd_written_bytes.attr,
+	&dev_attr_bd_reads.attr,
+	&dev_attr_bd_read_latency.attr,
+#endif
 	NULL,
 };
 
@@ -0,0 +1,806 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the license that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * zsmalloc is a size-class allocator for compressed pages.  Objects of
+ * similar size (within ZS_SIZE_CLASS_DELTA bytes) share a class, and each
+ * class carves its objects out of "zspages": groups of up to
+ * ZS_MAX_PAGES_PER_ZSPAGE 0-order pages treated as one linear area.  The
+ * number of pages per zspage is picked per class to minimize the space
+ * left over at the end, and objects may straddle the boundary between two
+ * pages, so e.g. a 2.5K object does not waste 1.5K of every page the way
+ * a page-local allocator has to.
+ *
+ * Users get an opaque handle which must be mapped with zs_map_object()
+ * to get at the data and unmapped again with zs_unmap_object() before
+ * anything that may sleep.  Objects that span two pages are copied
+ * through a per-cpu buffer; at most one object may be mapped at a time
+ * per cpu.
+ *
+ * Since handles point to a small descriptor rather than to the object
+ * itself, zs_compact() can move objects out of sparsely used zspages into
+ * fuller ones of the same class and free the emptied zspages.  It is also
+ * run from a shrinker under memory pressure.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+/* Per-cpu state of the object currently mapped on that cpu */
+struct mapping_area {
+	char *buf;		/* copy of an object spanning two pages */
+	void *vm_addr;		/* kmap_atomic() address otherwise */
+	enum zs_mapmode mm;
+};
+
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+static struct kmem_cache *zs_handle_cachep;
+static struct kmem_cache *zspage_cachep;
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Number of 0-order pages per zspage that leaves the least space unused
+ * at the end of the zspage for objects of class_size.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	/* zspage order which gives maximum used size per KB */
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size;
+		int waste, usedpc;
+
+		zspage_size = i * PAGE_SIZE;
+		waste = zspage_size % class_size;
+		usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static struct size_class *handle_class(struct zs_pool *pool,
+			struct zs_handle *handle)
+{
+	return &pool->size_class[get_size_class_index(handle->size +
+							ZS_HDR_SIZE)];
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+			struct zspage *zspage)
+{
+	int inuse = zspage->inuse, max_objects = class->objs_per_zspage;
+
+	if (inuse == 0)
+		return ZS_EMPTY;
+	else if (inuse == max_objects)
+		return ZS_FULL;
+	else if (inuse <= max_objects / fullness_threshold_frac)
+		return ZS_ALMOST_EMPTY;
+	return ZS_ALMOST_FULL;
+}
+
+/*
+ * Move zspage to the list matching how many objects it holds.  Returns the
+ * new fullness group; a zspage that became empty is left on no list and
+ * should be freed by the caller.  Call with class->lock held.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+			struct zspage *zspage)
+{
+	enum fullness_group newfg = get_fullness_group(class, zspage);
+
+	if (newfg == zspage->fullness)
+		return newfg;
+
+	if (zspage->fullness < _ZS_NR_FULLNESS_GROUPS)
+		list_del(&zspage->list);
+	if (newfg < _ZS_NR_FULLNESS_GROUPS)
+		list_add(&zspage->list, &class->fullness_list[newfg]);
+	zspage->fullness = newfg;
+
+	return newfg;
+}
+
+/* Page and in-page offset of byte off of a zspage */
+static struct page *zspage_page(struct zspage *zspage, unsigned long off,
+			unsigned long *page_off)
+{
+	*page_off = off & ~PAGE_MASK;
+	return zspage->pages[off >> PAGE_SHIFT];
+}
+
+static unsigned long obj_read_hdr(struct size_class *class,
+			struct zspage *zspage, int obj_idx)
+{
+	unsigned long off, hdr;
+	struct page *page;
+	void *addr;
+
+	page = zspage_page(zspage, (unsigned long)obj_idx * class->size, &off);
+	addr = kmap_atomic(page, KM_USER0);
+	hdr = *(unsigned long *)(addr + off);
+	kunmap_atomic(addr, KM_USER0);
+
+	return hdr;
+}
+
+static void obj_write_hdr(struct size_class *class, struct zspage *zspage,
+			int obj_idx, unsigned long hdr)
+{
+	unsigned long off;
+	struct page *page;
+	void *addr;
+
+	page = zspage_page(zspage, (unsigned long)obj_idx * class->size, &off);
+	addr = kmap_atomic(page, KM_USER0);
+	*(unsigned long *)(addr + off) = hdr;
+	kunmap_atomic(addr, KM_USER0);
+}
+
+/* Take a free object from zspage for handle.  Call with class->lock held */
+static int obj_malloc(struct size_class *class, struct zspage *zspage,
+			struct zs_handle *handle)
+{
+	int obj_idx = zspage->freeobj;
+	unsigned long hdr;
+
+	BUG_ON(obj_idx < 0);
+
+	hdr = obj_read_hdr(class, zspage, obj_idx);
+	zspage->freeobj = (int)(hdr >> 1) - 1;
+	obj_write_hdr(class, zspage, obj_idx,
+			(unsigned long)handle | OBJ_ALLOCATED);
+	zspage->inuse++;
+
+	return obj_idx;
+}
+
+/* Put an object back on zspage's free list.  Call with class->lock held */
+static void obj_free(struct size_class *class, struct zspage *zspage,
+			int obj_idx)
+{
+	obj_write_hdr(class, zspage, obj_idx,
+			(unsigned long)(zspage->freeobj + 1) << 1);
+	zspage->freeobj = obj_idx;
+	zspage->inuse--;
+}
+
+static void free_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+	kmem_cache_free(zspage_cachep, zspage);
+
+	atomic_long_sub(class->pages_per_zspage, &pool->pages_allocated);
+}
+
+/* Allocate a zspage for class with all objects on its free list */
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+			struct size_class *class)
+{
+	struct zspage *zspage;
+	int i;
+
+	zspage = kmem_cache_zalloc(zspage_cachep,
+			pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(pool->flags);
+		if (!zspage->pages[i])
+			goto fail;
+	}
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class_idx = class->index;
+	zspage->fullness = ZS_EMPTY;
+	zspage->freeobj = 0;
+	for (i = 0; i < class->objs_per_zspage; i++) {
+		unsigned long next = 0;
+
+		if (i + 1 < class->objs_per_zspage)
+			next = (unsigned long)(i + 2) << 1;
+		obj_write_hdr(class, zspage, i, next);
+	}
+
+	atomic_long_add(class->pages_per_zspage, &pool->pages_allocated);
+	return zspage;
+
+fail:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kmem_cache_free(zspage_cachep, zspage);
+	return NULL;
+}
+
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	int i;
+
+	for (i = 0; i < ZS_FULL; i++) {
+		if (!list_empty(&class->fullness_list[i]))
+			return list_first_entry(&class->fullness_list[i],
+					struct zspage, list);
+	}
+
+	return NULL;
+}
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * On success, handle to the allocated object is returned,
+ * otherwise 0.
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE - ZS_HDR_SIZE will
+ * fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	struct zs_handle *handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HDR_SIZE))
+		return 0;
+
+	handle = kmem_cache_alloc(zs_handle_cachep,
+			pool->flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+	handle->size = size;
+	class = handle_class(pool, handle);
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cachep, handle);
+			return 0;
+		}
+
+		spin_lock(&class->lock);
+		class->zspages++;
+	}
+
+	handle->obj_idx = obj_malloc(class, zspage, handle);
+	handle->zspage = zspage;
+	class->objs_inuse++;
+	class->bytes_inuse += size;
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long h)
+{
+	struct zs_handle *handle = (struct zs_handle *)h;
+	struct size_class *class;
+	struct zspage *zspage;
+	enum fullness_group fullness;
+
+	if (unlikely(!handle))
+		return;
+
+	/* The class never changes, the zspage may until we hold its lock */
+	class = handle_class(pool, handle);
+
+	spin_lock(&class->lock);
+	zspage = handle->zspage;
+	obj_free(class, zspage, handle->obj_idx);
+	class->objs_inuse--;
+	class->bytes_inuse -= handle->size;
+	fullness = fix_fullness_group(class, zspage);
+	if (fullness == ZS_EMPTY)
+		class->zspages--;
+	spin_unlock(&class->lock);
+
+	if (fullness == ZS_EMPTY)
+		free_zspage(pool, class, zspage);
+	kmem_cache_free(zs_handle_cachep, handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/* Copy len bytes between two objects' payloads, page piece by page piece */
+static void zs_copy_object(struct size_class *class,
+			struct zspage *d_zspage, int d_idx,
+			struct zspage *s_zspage, int s_idx, int len)
+{
+	unsigned long d_off, s_off;
+
+	d_off = (unsigned long)d_idx * class->size + ZS_HDR_SIZE;
+	s_off = (unsigned long)s_idx * class->size + ZS_HDR_SIZE;
+
+	while (len > 0) {
+		unsigned long d_poff, s_poff;
+		struct page *d_page, *s_page;
+		void *d_addr, *s_addr;
+		int n;
+
+		d_page = zspage_page(d_zspage, d_off, &d_poff);
+		s_page = zspage_page(s_zspage, s_off, &s_poff);
+		n = min_t(int, len, PAGE_SIZE - max(d_poff, s_poff));
+
+		s_addr = kmap_atomic(s_page, KM_USER0);
+		d_addr = kmap_atomic(d_page, KM_USER1);
+		memcpy(d_addr + d_poff, s_addr + s_poff, n);
+		kunmap_atomic(d_addr, KM_USER1);
+		kunmap_atomic(s_addr, KM_USER0);
+
+		d_off += n;
+		s_off += n;
+		len -= n;
+	}
+}
+
+/*
+ * Move objects out of the sparsest zspages of class into its fullest ones
+ * for as long as that frees whole zspages.  Returns the number of pages
+ * freed.
+ */
+static unsigned long zs_compact_class(struct zs_pool *pool,
+			struct size_class *class)
+{
+	unsigned long freed = 0;
+
+	while (1) {
+		struct zspage *src, *dst = NULL;
+		unsigned long free_objs;
+		int i;
+
+		spin_lock(&class->lock);
+
+		free_objs = class->zspages * class->objs_per_zspage -
+				class->objs_inuse;
+		if (free_objs < class->objs_per_zspage ||
+				list_empty(&class->fullness_list[ZS_ALMOST_EMPTY])) {
+			spin_unlock(&class->lock);
+			break;
+		}
+
+		/* The oldest sparse zspage is the source ... */
+		src = list_entry(class->fullness_list[ZS_ALMOST_EMPTY].prev,
+				struct zspage, list);
+		/* ... and its objects go wherever find_get_zspage() looks */
+		list_del_init(&src->list);
+		src->fullness = ZS_EMPTY;
+
+		for (i = 0; i < class->objs_per_zspage && src->inuse; i++) {
+			struct zs_handle *handle;
+			unsigned long hdr;
+			int d_idx;
+
+			hdr = obj_read_hdr(class, src, i);
+			if (!(hdr & OBJ_ALLOCATED))
+				continue;
+			handle = (struct zs_handle *)(hdr & ~OBJ_ALLOCATED);
+
+			if (!dst || dst->freeobj < 0) {
+				if (dst)
+					fix_fullness_group(class, dst);
+				dst = find_get_zspage(class);
+				if (!dst)
+					break;
+			}
+
+			d_idx = obj_malloc(class, dst, handle);
+
+			write_lock(&pool->migrate_lock);
+			zs_copy_object(class, dst, d_idx, src, i, handle->size);
+			handle->zspage = dst;
+			handle->obj_idx = d_idx;
+			write_unlock(&pool->migrate_lock);
+
+			obj_free(class, src, i);
+		}
+		if (dst)
+			fix_fullness_group(class, dst);
+
+		if (fix_fullness_group(class, src) == ZS_EMPTY) {
+			class->zspages--;
+			spin_unlock(&class->lock);
+			free_zspage(pool, class, src);
+			freed += class->pages_per_zspage;
+		} else {
+			/* Ran out of room; the zspage is back on a list */
+			spin_unlock(&class->lock);
+			break;
+		}
+
+		cond_resched();
+	}
+
+	return freed;
+}
+
+/* Call with pool->compact_lock held */
+static unsigned long __zs_compact(struct zs_pool *pool)
+{
+	unsigned long freed = 0;
+	int i;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--)
+		freed += zs_compact_class(pool, &pool->size_class[i]);
+	atomic_long_add(freed, &pool->pages_compacted);
+
+	return freed;
+}
+
+/**
+ * zs_compact - Free zspages by packing objects into fewer of them
+ * @pool: pool to compact
+ *
+ * Returns the number of pages freed.  May sleep.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned long freed;
+
+	mutex_lock(&pool->compact_lock);
+	freed = __zs_compact(pool);
+	mutex_unlock(&pool->compact_lock);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+u64 zs_get_compacted_pages(struct zs_pool *pool)
+{
+	return atomic_long_read(&pool->pages_compacted);
+}
+EXPORT_SYMBOL_GPL(zs_get_compacted_pages);
+
+/* Pages compaction could free if objects were perfectly packed */
+static unsigned long zs_compactable_pages(struct zs_pool *pool)
+{
+	unsigned long pages = 0;
+	int i;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		unsigned long needed;
+
+		needed = DIV_ROUND_UP(class->objs_inuse,
+				class->objs_per_zspage);
+		if (class->zspages > needed)
+			pages += (class->zspages - needed) *
+					class->pages_per_zspage;
+	}
+
+	return pages;
+}
+
+static int zs_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+						shrinker);
+
+	/* Leave it to whoever is already compacting */
+	if (sc->nr_to_scan > 0 && mutex_trylock(&pool->compact_lock)) {
+		__zs_compact(pool);
+		mutex_unlock(&pool->compact_lock);
+	}
+
+	return zs_compactable_pages(pool);
+}
+
+/*
+ * First page of handle's payload and the offset into it; if the payload
+ * continues into the next page, that page is returned in *next.
+ */
+static struct page *zs_obj_pages(struct zs_pool *pool,
+			struct zs_handle *handle, unsigned long *off,
+			struct page **next)
+{
+	struct size_class *class = handle_class(pool, handle);
+	unsigned long obj_off;
+	struct page *page;
+
+	obj_off = (unsigned long)handle->obj_idx * class->size + ZS_HDR_SIZE;
+	page = zspage_page(handle->zspage, obj_off, off);
+	*next = NULL;
+	if (*off + handle->size > PAGE_SIZE)
+		*next = handle->zspage->pages[(obj_off >> PAGE_SHIFT) + 1];
+
+	return page;
+}
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: whether the object is read, written or both while mapped
+ *
+ * Before using an object allocated from zs_malloc, it must be mapped using
+ * this function. When done with the object, it must be unmapped using
+ * zs_unmap_object.  Only one object can be mapped at a time per cpu, and
+ * nothing that may sleep can be done while it is mapped.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long h,
+			enum zs_mapmode mm)
+{
+	struct zs_handle *handle = (struct zs_handle *)h;
+	struct mapping_area *area;
+	struct page *page, *next;
+	unsigned long off;
+	void *addr;
+	int first;
+
+	BUG_ON(!handle);
+
+	read_lock(&pool->migrate_lock);
+
+	page = zs_obj_pages(pool, handle, &off, &next);
+	if (!next) {
+		/* this object is contained entirely within a page */
+		addr = kmap_atomic(page, KM_USER1);
+		__get_cpu_var(zs_map_area).vm_addr = addr;
+		return addr + off;
+	}
+
+	/* this object spans two pages */
+	area = &get_cpu_var(zs_map_area);
+	area->vm_addr = NULL;
+	area->mm = mm;
+	if (mm != ZS_MM_WO) {
+		first = PAGE_SIZE - off;
+		addr = kmap_atomic(page, KM_USER1);
+		memcpy(area->buf, addr + off, first);
+		kunmap_atomic(addr, KM_USER1);
+		addr = kmap_atomic(next, KM_USER1);
+		memcpy(area->buf + first, addr, handle->size - first);
+		kunmap_atomic(addr, KM_USER1);
+	}
+
+	return area->buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long h)
+{
+	struct zs_handle *handle = (struct zs_handle *)h;
+	struct mapping_area *area;
+	struct page *page, *next;
+	unsigned long off;
+	void *addr;
+	int first;
+
+	area = &__get_cpu_var(zs_map_area);
+	if (area->vm_addr) {
+		addr = area->vm_addr;
+		area->vm_addr = NULL;
+		kunmap_atomic(addr, KM_USER1);
+		goto out;
+	}
+
+	if (area->mm != ZS_MM_RO) {
+		page = zs_obj_pages(pool, handle, &off, &next);
+		first = PAGE_SIZE - off;
+		addr = kmap_atomic(page, KM_USER1);
+		memcpy(addr + off, area->buf, first);
+		kunmap_atomic(addr, KM_USER1);
+		addr = kmap_atomic(next, KM_USER1);
+		memcpy(addr, area->buf + first, handle->size - first);
+		kunmap_atomic(addr, KM_USER1);
+	}
+	put_cpu_var(zs_map_area);
+out:
+	read_unlock(&pool->migrate_lock);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+int zs_get_num_classes(void)
+{
+	return ZS_SIZE_CLASSES;
+}
+EXPORT_SYMBOL_GPL(zs_get_num_classes);
+
+int zs_get_class_stats(struct zs_pool *pool, int class_idx,
+			struct zs_class_stats *stats)
+{
+	struct size_class *class;
+
+	if (class_idx < 0 || class_idx >= ZS_SIZE_CLASSES)
+		return -EINVAL;
+
+	class = &pool->size_class[class_idx];
+	spin_lock(&class->lock);
+	stats->size = class->size;
+	stats->pages_per_zspage = class->pages_per_zspage;
+	stats->objs_per_zspage = class->objs_per_zspage;
+	stats->zspages = class->zspages;
+	stats->objs_inuse = class->objs_inuse;
+	stats->bytes_inuse = class->bytes_inuse;
+	spin_unlock(&class->lock);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(zs_get_class_stats);
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool to be created
+ * @flags: allocation flags used when growing pool
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	int i, fg;
+	struct zs_pool *pool;
+
+	if (!name)
+		return NULL;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	pool->size_class = vzalloc(ZS_SIZE_CLASSES * sizeof(struct size_class));
+	if (!pool->size_class) {
+		kfree(pool);
+		return NULL;
+	}
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->index = i;
+		spin_lock_init(&class->lock);
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+						PAGE_SIZE / class->size;
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+	}
+
+	pool->flags = flags;
+	pool->name = name;
+	rwlock_init(&pool->migrate_lock);
+	mutex_init(&pool->compact_lock);
+
+	pool->shrinker.shrink = zs_shrink;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i, fg;
+
+	unregister_shrinker(&pool->shrinker);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			struct zspage *zspage, *tmp;
+
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[fg], list) {
+				pr_info("Freeing non-empty class with size "
+					"%db, fullness group %d\n",
+					class->size, fg);
+				/* the leaked objects' handles stay allocated */
+				list_del(&zspage->list);
+				free_zspage(pool, class, zspage);
+			}
+		}
+	}
+
+	vfree(pool->size_class);
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+static void zs_free_map_areas(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(zs_map_area, cpu).buf);
+		per_cpu(zs_map_area, cpu).buf = NULL;
+	}
+}
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	zs_handle_cachep = KMEM_CACHE(zs_handle, 0);
+	zspage_cachep = KMEM_CACHE(zspage, 0);
+	if (!zs_handle_cachep || !zspage_cachep)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto fail;
+	}
+
+	return 0;
+
+fail:
+	zs_free_map_areas();
+	if (zspage_cachep)
+		kmem_cache_destroy(zspage_cachep);
+	if (zs_handle_cachep)
+		kmem_cache_destroy(zs_handle_cachep);
+	return -ENOMEM;
+}
+
+static void __exit zs_exit(void)
+{
+	zs_free_map_areas();
+	kmem_cache_destroy(zspage_cachep);
+	kmem_cache_destroy(zs_handle_cachep);
+}
+
+module_init(zs_init);
+module_exit(zs_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Size-class memory allocator for compressed pages");
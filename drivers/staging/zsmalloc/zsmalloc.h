@@ -0,0 +1,58 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the license that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_H_
+#define _ZS_MALLOC_H_
+
+#include <linux/types.h>
+
+/*
+ * How an object is going to be accessed while mapped.  Objects spanning
+ * two pages are copied through a per-cpu buffer: in from the pages unless
+ * ZS_MM_WO, and back out unless ZS_MM_RO.
+ */
+enum zs_mapmode {
+	ZS_MM_RW,
+	ZS_MM_RO,
+	ZS_MM_WO
+};
+
+/* Snapshot of one size class, see zs_get_class_stats() */
+struct zs_class_stats {
+	int size;		/* object size, including the handle header */
+	int pages_per_zspage;
+	int objs_per_zspage;
+	unsigned long zspages;
+	unsigned long objs_inuse;
+	u64 bytes_inuse;	/* sum of the sizes passed to zs_malloc() */
+};
+
+struct zs_pool;
+
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags);
+void zs_destroy_pool(struct zs_pool *pool);
+
+unsigned long zs_malloc(struct zs_pool *pool, size_t size);
+void zs_free(struct zs_pool *pool, unsigned long handle);
+
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm);
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool);
+
+unsigned long zs_compact(struct zs_pool *pool);
+u64 zs_get_compacted_pages(struct zs_pool *pool);
+
+int zs_get_num_classes(void);
+int zs_get_class_stats(struct zs_pool *pool, int class_idx,
+			struct zs_class_stats *stats);
+
+#endif
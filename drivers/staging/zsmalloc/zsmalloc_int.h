@@ -0,0 +1,150 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the license that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+
+/*
+ * This must be a power of 2 and at least ZS_HDR_SIZE.  Class sizes are
+ * multiples of it, so an object header never spans two pages.
+ */
+#define ZS_ALIGN		8
+
+/*
+ * A single 'zspage' is composed of up to 2^N discontiguous 0-order (single)
+ * pages. ZS_MAX_ZSPAGE_ORDER defines upper limit on N.
+ */
+#define ZS_MAX_ZSPAGE_ORDER 2
+#define ZS_MAX_PAGES_PER_ZSPAGE (_AC(1, UL) << ZS_MAX_ZSPAGE_ORDER)
+
+/*
+ * Every object starts with a header word.  While the object is allocated
+ * it holds the address of the object's handle with OBJ_ALLOCATED set, so
+ * compaction can find and update the handle of an object it moves; while
+ * the object is free it holds (index + 1) << 1 of the next free object, or
+ * 0 at the end of the free list.
+ */
+#define ZS_HDR_SIZE		sizeof(unsigned long)
+#define OBJ_ALLOCATED		1UL
+
+/* ZS_MIN_ALLOC_SIZE must be multiple of ZS_ALIGN */
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * On systems with 4K page size, this gives 255 size classes, 16 bytes
+ * apart.  More classes mean less internal fragmentation but free space
+ * spread over more zspages; all class sizes must be multiples of ZS_ALIGN.
+ */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+					ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * Empty zspages are freed right away, so they are on no list.  Full ones
+ * are only listed so that a pool can be torn down with objects left.
+ */
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY
+};
+
+/*
+ * We assign a page to ZS_ALMOST_EMPTY fullness group when:
+ *	n <= N / f, where
+ * n = number of allocated objects
+ * N = total number of objects zspage can store
+ * f = 1/fullness_threshold_frac
+ *
+ * Similarly, we assign zspage to:
+ *	ZS_ALMOST_FULL	when n > N / f
+ *	ZS_EMPTY	when n == 0
+ *	ZS_FULL		when n == N
+ *
+ * (see: fix_fullness_group())
+ */
+static const int fullness_threshold_frac = 4;
+
+/*
+ * Where an allocated object lives.  Handles given out by zs_malloc() are
+ * the addresses of these, so an object can be moved by compaction without
+ * its user noticing.
+ */
+struct zs_handle {
+	struct zspage *zspage;
+	unsigned short obj_idx;
+	unsigned short size;	/* as passed to zs_malloc() */
+};
+
+/* A group of 0-order pages holding objects of one size class */
+struct zspage {
+	struct list_head list;		/* in class->fullness_list[] */
+	unsigned int class_idx;
+	unsigned int inuse;		/* allocated objects */
+	int freeobj;			/* first free object, -1 if none */
+	enum fullness_group fullness;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+};
+
+struct size_class {
+	/*
+	 * Size of objects stored in this class. Must be multiple
+	 * of ZS_ALIGN.
+	 */
+	int size;
+	unsigned int index;
+
+	/* Number of PAGE_SIZE sized pages to combine to form a 'zspage' */
+	int pages_per_zspage;
+	int objs_per_zspage;
+
+	spinlock_t lock;
+
+	/* stats */
+	unsigned long zspages;
+	unsigned long objs_inuse;
+	u64 bytes_inuse;
+
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+};
+
+struct zs_pool {
+	struct size_class *size_class;	/* ZS_SIZE_CLASSES of them */
+
+	gfp_t flags;	/* allocation flags used when growing pool */
+	atomic_long_t pages_allocated;
+
+	/*
+	 * Taken shared by zs_map_object() .. zs_unmap_object() and exclusive
+	 * by compaction while it moves an object and updates its handle.
+	 */
+	rwlock_t migrate_lock;
+
+	/* Serializes compaction runs */
+	struct mutex compact_lock;
+	atomic_long_t pages_compacted;
+
+	struct shrinker shrinker;
+
+	const char *name;
+};
+
+#endif
@@ -126,6 +126,7 @@ struct request {
 #ifdef CONFIG_BLK_CGROUP
 	unsigned long long start_time_ns;
 	unsigned long long io_start_time_ns;    /* when passed to hardware */
+	unsigned short blkcg_id;	/* css id of the issuing blkio cgroup */
 #endif
 	/* Number of scatter-gather DMA addr+len pairs after
 	 * physical address coalescing is performed.
@@ -1176,6 +1177,27 @@ static inline uint64_t rq_io_start_time_ns(struct request *req)
 }
 #endif
 
+/*
+ * Reads issued from a foreground blkio cgroup, which are let ahead of
+ * writes already queued.
+ */
+static inline bool rq_is_urgent(struct request *rq)
+{
+	return (rq->cmd_flags & REQ_FG) && rq_data_dir(rq) == READ;
+}
+
+#ifdef CONFIG_BLK_CGROUP
+extern void blkiocg_tag_bio(struct bio *bio);
+extern void blkiocg_page_dirtied(struct address_space *mapping);
+extern void blkiocg_init_request(struct request *rq);
+extern void blkiocg_update_latency(struct request *rq);
+#else
+static inline void blkiocg_tag_bio(struct bio *bio) {}
+static inline void blkiocg_page_dirtied(struct address_space *mapping) {}
+static inline void blkiocg_init_request(struct request *rq) {}
+static inline void blkiocg_update_latency(struct request *rq) {}
+#endif
+
 #ifdef CONFIG_BLK_DEV_THROTTLING
 extern int blk_throtl_init(struct request_queue *q);
 extern void blk_throtl_exit(struct request_queue *q);
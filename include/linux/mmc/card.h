@@ -64,6 +64,9 @@ struct mmc_ext_csd {
 	unsigned long long	enhanced_area_offset;	/* Units: Byte */
 	unsigned int		enhanced_area_size;	/* Units: KB */
 	unsigned int		boot_size;		/* in bytes */
+	unsigned int		max_packed_writes;	/* eMMC 4.5 packed cmds */
+	unsigned int		max_packed_reads;
+	bool			packed_event_en;	/* packed failures reported */
 	u8			raw_partition_support;	/* 160 */
 	u8			raw_erased_mem_count;	/* 181 */
 	u8			raw_ext_csd_structure;	/* 194 */
@@ -79,6 +82,19 @@ struct mmc_ext_csd {
 	u8			raw_sectors[4];		/* 212 - 4 bytes */
 };
 
+/* Largest number of entries in a packed command header of one sector */
+#define MMC_PACKED_MAX_ENTRIES	63
+
+/* Packed write statistics, in debugfs as <card>/packed_stats */
+struct mmc_packed_stats {
+	unsigned long		packed_cmds;	/* packed commands sent */
+	unsigned long		packed_reqs;	/* requests sent in them */
+	unsigned long		single_writes;	/* writes sent on their own */
+	unsigned long		failures;	/* packed commands that failed */
+	unsigned long		retried_reqs;	/* requests reissued after that */
+	unsigned long		pack_size[MMC_PACKED_MAX_ENTRIES + 1];
+};
+
 struct sd_scr {
 	unsigned char		sda_vsn;
 	unsigned char		sda_spec3;
@@ -221,6 +237,7 @@ struct mmc_card {
 	unsigned int		sd_bus_speed;	/* Bus Speed Mode set for the card */
 
 	struct dentry		*debugfs_root;
+	struct mmc_packed_stats	packed_stats;
 	unsigned int		removed;
 	unsigned int		wr_perf; /* write performance in MB/s */
 };
@@ -108,6 +108,16 @@ struct mmc_host_ops {
 	int (*enable)(struct mmc_host *host);
 	int (*disable)(struct mmc_host *host, int lazy);
 	void	(*request)(struct mmc_host *host, struct mmc_request *req);
+	/*
+	 * 'pre_req' prepares a request before it is started, typically by
+	 * mapping its data for DMA, and may be called while another request
+	 * is in progress.  A host that did so sets mrq->data->host_cookie;
+	 * 'post_req' undoes the preparation once the request has completed.
+	 * Both are optional and must not sleep for long.
+	 */
+	void	(*pre_req)(struct mmc_host *host, struct mmc_request *req);
+	void	(*post_req)(struct mmc_host *host, struct mmc_request *req,
+			    int err);
 	/*
 	 * Avoid calling these three functions too often or in a "fast path",
 	 * since underlaying controller might implement them in an expensive
@@ -296,6 +306,17 @@ struct mmc_host {
 
 	struct dentry		*debugfs_root;
 
+	/* Requests prepared while the previous one was on the bus */
+	struct {
+		unsigned long	prepared;	/* prepared ahead of issue */
+		unsigned long	overlapped;	/* ... before the bus went idle */
+		unsigned long	discarded;	/* ... but never issued */
+		unsigned long	inline_prep;	/* prepared at issue time */
+		unsigned long	bumped;		/* put back for an urgent read */
+		u64		prep_ns;	/* time spent preparing ahead */
+		u64		overlap_ns;	/* ... of it hidden by a transfer */
+	} async_stats;
+
 #ifdef CONFIG_MMC_EMBEDDED_SDIO
 	struct {
 		struct sdio_cis			*cis;
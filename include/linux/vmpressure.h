@@ -0,0 +1,28 @@
+#ifndef __LINUX_VMPRESSURE_H
+#define __LINUX_VMPRESSURE_H
+
+#include <linux/types.h>
+#include <linux/gfp.h>
+
+struct notifier_block;
+
+/*
+ * Reclaim pressure levels, from the ratio of pages reclaimed to pages
+ * scanned over a window of reclaim activity.  Notifiers registered with
+ * vmpressure_register_notifier() are called from process context with the
+ * level as the action and a pointer to the pressure (0-100) as data.
+ */
+enum vmpressure_levels {
+	VMPRESSURE_LOW = 0,
+	VMPRESSURE_MEDIUM,
+	VMPRESSURE_CRITICAL,
+	VMPRESSURE_NUM_LEVELS,
+};
+
+extern void vmpressure(gfp_t gfp, unsigned long scanned,
+		       unsigned long reclaimed);
+
+extern int vmpressure_register_notifier(struct notifier_block *nb);
+extern int vmpressure_unregister_notifier(struct notifier_block *nb);
+
+#endif /* __LINUX_VMPRESSURE_H */
@@ -1129,6 +1129,7 @@ void account_page_dirtied(struct page *page, struct address_space *mapping)
 		__inc_bdi_stat(mapping->backing_dev_info, BDI_RECLAIMABLE);
 		task_dirty_inc(current);
 		task_io_account_write(PAGE_CACHE_SIZE);
+		blkiocg_page_dirtied(mapping);
 	}
 }
 EXPORT_SYMBOL(account_page_dirtied);
@@ -0,0 +1,236 @@
+/*
+ * Reclaim pressure levels
+ *
+ * The pages scanned and reclaimed by every global reclaim pass in vmscan
+ * are summed until window_pages have been scanned; then the pressure is
+ * computed as the percentage of scanned pages that could not be reclaimed
+ * and mapped to a level:
+ *
+ *  low      - reclaim is keeping up
+ *  medium   - at least "medium" percent of scanned pages were not reclaimed
+ *  critical - at least "critical" percent were not reclaimed; the system
+ *             is close to thrashing or to the OOM killer
+ *
+ * Levels are handed to in-kernel notifiers (the Android lowmemorykiller
+ * uses them to kill ahead of allocation stalls) and published in
+ * /sys/kernel/mm/vmpressure/.  The "level" file is sysfs_notify()'d every
+ * window at medium or above and whenever the level changes, so userspace
+ * can poll() it.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/notifier.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/vmpressure.h>
+
+static unsigned long vmpressure_win = SWAP_CLUSTER_MAX * 16;
+static unsigned int vmpressure_level_med = 60;
+static unsigned int vmpressure_level_critical = 95;
+
+static const char * const vmpressure_str_levels[] = {
+	[VMPRESSURE_LOW] = "low",
+	[VMPRESSURE_MEDIUM] = "medium",
+	[VMPRESSURE_CRITICAL] = "critical",
+};
+
+static BLOCKING_NOTIFIER_HEAD(vmpressure_notify_list);
+static struct kobject *vmpressure_kobj;
+
+int vmpressure_register_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_register(&vmpressure_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(vmpressure_register_notifier);
+
+int vmpressure_unregister_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&vmpressure_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(vmpressure_unregister_notifier);
+
+static enum vmpressure_levels vmpressure_level(unsigned long pressure)
+{
+	if (pressure >= vmpressure_level_critical)
+		return VMPRESSURE_CRITICAL;
+	else if (pressure >= vmpressure_level_med)
+		return VMPRESSURE_MEDIUM;
+	return VMPRESSURE_LOW;
+}
+
+static void vmpressure_work_fn(struct work_struct *work);
+
+static struct vmpressure {
+	spinlock_t sr_lock;
+	unsigned long scanned;
+	unsigned long reclaimed;
+	struct work_struct work;
+
+	/* Result of the last window, read by sysfs */
+	enum vmpressure_levels level;
+	unsigned long pressure;
+	unsigned long events[VMPRESSURE_NUM_LEVELS];
+} vmpr = {
+	.sr_lock = __SPIN_LOCK_UNLOCKED(vmpr.sr_lock),
+	.work = __WORK_INITIALIZER(vmpr.work, vmpressure_work_fn),
+};
+
+static void vmpressure_work_fn(struct work_struct *work)
+{
+	unsigned long scanned;
+	unsigned long reclaimed;
+	unsigned long pressure;
+	enum vmpressure_levels level, prev;
+
+	spin_lock(&vmpr.sr_lock);
+	scanned = vmpr.scanned;
+	reclaimed = vmpr.reclaimed;
+	vmpr.scanned = 0;
+	vmpr.reclaimed = 0;
+	spin_unlock(&vmpr.sr_lock);
+
+	if (!scanned)
+		return;
+
+	/*
+	 * reclaimed can exceed scanned when slab pages were freed along with
+	 * the LRU pages; that is no pressure at all.
+	 */
+	if (reclaimed >= scanned)
+		pressure = 0;
+	else
+		pressure = (scanned - reclaimed) * 100 / scanned;
+	level = vmpressure_level(pressure);
+
+	prev = vmpr.level;
+	vmpr.level = level;
+	vmpr.pressure = pressure;
+	vmpr.events[level]++;
+
+	if (vmpressure_kobj && (level != prev || level > VMPRESSURE_LOW))
+		sysfs_notify(vmpressure_kobj, NULL, "level");
+
+	blocking_notifier_call_chain(&vmpressure_notify_list, level, &pressure);
+}
+
+/**
+ * vmpressure() - Account reclaim efficiency for pressure levels
+ * @gfp:	reclaimer's gfp mask
+ * @scanned:	number of pages scanned
+ * @reclaimed:	number of pages reclaimed
+ *
+ * Called from vmscan after each per-zone global reclaim pass.  Once a
+ * window's worth of pages has been scanned the level is computed from a
+ * work item, so this is cheap and never blocks.
+ */
+void vmpressure(gfp_t gfp, unsigned long scanned, unsigned long reclaimed)
+{
+	/*
+	 * Only account reclaim for allocations that could be satisfied from
+	 * the regular LRU pages; pressure from e.g. GFP_DMA-only callers says
+	 * nothing about the memory available to userspace.
+	 */
+	if (!(gfp & (__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_IO | __GFP_FS)))
+		return;
+
+	if (!scanned)
+		return;
+
+	spin_lock(&vmpr.sr_lock);
+	vmpr.scanned += scanned;
+	vmpr.reclaimed += reclaimed;
+	scanned = vmpr.scanned;
+	spin_unlock(&vmpr.sr_lock);
+
+	if (scanned < vmpressure_win)
+		return;
+	schedule_work(&vmpr.work);
+}
+
+static ssize_t level_show(struct kobject *kobj, struct kobj_attribute *attr,
+			  char *buf)
+{
+	return sprintf(buf, "%s\n", vmpressure_str_levels[vmpr.level]);
+}
+static struct kobj_attribute level_attr = __ATTR_RO(level);
+
+static ssize_t pressure_show(struct kobject *kobj, struct kobj_attribute *attr,
+			     char *buf)
+{
+	return sprintf(buf, "%lu\n", vmpr.pressure);
+}
+static struct kobj_attribute pressure_attr = __ATTR_RO(pressure);
+
+static ssize_t events_show(struct kobject *kobj, struct kobj_attribute *attr,
+			   char *buf)
+{
+	return sprintf(buf, "low %lu\nmedium %lu\ncritical %lu\n",
+		       vmpr.events[VMPRESSURE_LOW],
+		       vmpr.events[VMPRESSURE_MEDIUM],
+		       vmpr.events[VMPRESSURE_CRITICAL]);
+}
+static struct kobj_attribute events_attr = __ATTR_RO(events);
+
+#define VMPRESSURE_ATTR(_name, _var, _min, _max)			\
+static ssize_t _name##_show(struct kobject *kobj,			\
+			    struct kobj_attribute *attr, char *buf)	\
+{									\
+	return sprintf(buf, "%lu\n", (unsigned long)_var);		\
+}									\
+static ssize_t _name##_store(struct kobject *kobj,			\
+			     struct kobj_attribute *attr,		\
+			     const char *buf, size_t count)		\
+{									\
+	unsigned long val;						\
+	int err;							\
+									\
+	err = strict_strtoul(buf, 10, &val);				\
+	if (err || val < (_min) || val > (_max))			\
+		return -EINVAL;						\
+	_var = val;							\
+	return count;							\
+}									\
+static struct kobj_attribute _name##_attr =				\
+	__ATTR(_name, 0644, _name##_show, _name##_store)
+
+VMPRESSURE_ATTR(window_pages, vmpressure_win, SWAP_CLUSTER_MAX, ULONG_MAX);
+VMPRESSURE_ATTR(medium, vmpressure_level_med, 0, 100);
+VMPRESSURE_ATTR(critical, vmpressure_level_critical, 0, 100);
+
+static struct attribute *vmpressure_attrs[] = {
+	&level_attr.attr,
+	&pressure_attr.attr,
+	&events_attr.attr,
+	&window_pages_attr.attr,
+	&medium_attr.attr,
+	&critical_attr.attr,
+	NULL,
+};
+
+static struct attribute_group vmpressure_attr_group = {
+	.attrs = vmpressure_attrs,
+};
+
+static int __init vmpressure_init(void)
+{
+	int err;
+
+	vmpressure_kobj = kobject_create_and_add("vmpressure", mm_kobj);
+	if (!vmpressure_kobj)
+		return -ENOMEM;
+
+	err = sysfs_create_group(vmpressure_kobj, &vmpressure_attr_group);
+	if (err) {
+		kobject_put(vmpressure_kobj);
+		vmpressure_kobj = NULL;
+	}
+	return err;
+}
+subsys_initcall(vmpressure_init);